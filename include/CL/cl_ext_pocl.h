@@ -0,0 +1,51 @@
+/* pocl specific extensions to the OpenCL API
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#ifndef __CL_EXT_POCL_H
+#define __CL_EXT_POCL_H
+
+#include <CL/cl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* cl_context_properties */
+
+/* The page size (a size_t) of the memory of the large buffers of the
+   context in bytes. 0 uses transparent huge pages where available, the
+   size of the normal pages disables the huge pages, and a huge page
+   size allocates the huge pages explicitly. The default is read from
+   the POCL_PAGE_SIZE environment variable. */
+#define CL_CONTEXT_PAGE_SIZE_POCL                   0x4B10
+
+/* Whether (a cl_bool) to fault in the pages of the buffers of the
+   context when they are created instead of at their first use. The
+   default is read from the POCL_PREFAULT environment variable. */
+#define CL_CONTEXT_PREFAULT_POCL                    0x4B11
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
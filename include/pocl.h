@@ -66,14 +66,24 @@ typedef struct
   void *data;
   char *tmp_dir; 
   pocl_workgroup wg;
+  /* Executes a range of work groups in one call, NULL if not available. */
+  pocl_workgroup_range wg_range;
+  /* The size of the scratch buffer the work-group function needs in
+     the context. */
+  size_t context_scratch_size;
   cl_kernel kernel;
-  /* A list of argument buffers to free after the command has 
-     been executed. */
+  /* A list of argument buffers and images to free after the command
+     has been executed. */
   cl_mem *arg_buffers;
+  /* Nonzero for the arg_buffers the kernel may write to. */
+  char *arg_buffer_writes;
   int arg_buffer_count;
   size_t local_x;
   size_t local_y;
   size_t local_z;
+  /* The work-group function reads the local size from the context
+     instead of being specialized for it. */
+  int dynamic_local_size;
   struct pocl_context pc;
   struct pocl_argument *arguments;
 } _cl_command_run;
@@ -170,6 +180,25 @@ typedef struct
   size_t pixel_size;
 } _cl_command_fill_image;
 
+/* clEnqueueFillBuffer */
+typedef struct
+{
+  void *data;
+  void *device_ptr;
+  size_t size;
+  void *pattern;
+  size_t pattern_size;
+  cl_mem buffer;
+} _cl_command_fill;
+
+/* clEnqueueMigrateMemObjects */
+typedef struct
+{
+  cl_mem *mem_objects;
+  cl_uint num_mem_objects;
+  cl_mem_migration_flags flags;
+} _cl_command_migrate;
+
 typedef struct
 {
   void *data;
@@ -185,6 +214,8 @@ typedef union
   _cl_command_map map;
   _cl_command_map_image map_image;
   _cl_command_fill_image fill_image;
+  _cl_command_fill fill;
+  _cl_command_migrate migrate;
   _cl_command_rw_image rw_image;
   _cl_command_marker marker;
   _cl_command_unmap unmap;
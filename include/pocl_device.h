@@ -36,10 +36,19 @@ struct pocl_context {
   size_t num_groups[3];
   size_t group_id[3];
   size_t global_offset[3];
-  
+  /* Read only by the work-group functions generated for a dynamic
+     local size. */
+  size_t local_size[3];
+  /* The buffer for the context arrays of the work-group functions
+     generated to keep them out of the stack. */
+  void *context_scratch;
 };
 
 typedef void (*pocl_workgroup) (void **, struct pocl_context *);
+/* Executes the work groups from first to last, inclusive, numbered
+   linearly with x changing the fastest. */
+typedef void (*pocl_workgroup_range) (void **, struct pocl_context *,
+                                      size_t first, size_t last);
 
 #define MAX_KERNEL_ARGS 64
 #define MAX_KERNEL_NAME_LENGTH 64
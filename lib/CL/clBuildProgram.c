@@ -31,6 +31,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include "pocl_llvm.h"
+#include "pocl_cache.h"
+#include "devices.h"
 
 /* supported compiler parameters which should pass to the frontend directly
    by using -Xclang */
@@ -84,6 +86,7 @@ CL_API_SUFFIX__VERSION_1_0
   char *modded_options = NULL;
   char *token;
   char *saveptr;
+  char *cache_key;
 
   if (program == NULL)
   {
@@ -119,6 +122,11 @@ CL_API_SUFFIX__VERSION_1_0
                   /* the LLVM API call pushes the parameters directly to the 
                      frontend without using -Xclang */
                 }
+              else if (strncmp (token, POCL_VECTOR_WIDTH_OPTION,
+                                strlen (POCL_VECTOR_WIDTH_OPTION)) == 0)
+                {
+                  /* passed to the kernel compiler with the program */
+                }
               else if (strstr (cl_parameters_not_yet_supported_by_clang, token))
                 {
                   token = strtok_r (NULL, " ", &saveptr);  
@@ -182,6 +190,15 @@ CL_API_SUFFIX__VERSION_1_0
       real_device_list = device_list;
     }
 
+  /* Indexed with the dev_id of the device. */
+  if (program->cache_keys == NULL &&
+      (program->cache_keys = calloc (pocl_num_devices, 
+                                     POCL_CACHE_KEY_LENGTH)) == NULL)
+    {
+      errcode = CL_OUT_OF_HOST_MEMORY;
+      goto ERROR_CLEAN_OPTIONS;
+    }
+
   if (program->binaries == NULL)
     {
       printf("program-binaries was null\n");
@@ -217,17 +234,35 @@ CL_API_SUFFIX__VERSION_1_0
             (binary_file_name, POCL_FILENAME_LENGTH, "%s/%s", 
              device_tmpdir, POCL_PROGRAM_BC_FILENAME);
 
-          printf("about to build program\n");
-          error = pocl_llvm_build_program
-              (program, device, device_i, tmpdir,
-               binary_file_name, device_tmpdir,
-               user_options);     
+          cache_key = program->cache_keys[device->dev_id];
+          pocl_cache_program_key (device, user_options, program->source, 
+                                  strlen (program->source), cache_key);
 
-          if (error != 0)
-          {
-            errcode = CL_BUILD_PROGRAM_FAILURE;
-            goto ERROR_CLEAN_BINARIES;
-          }
+          /* A build of an earlier run, the bitcode is read below. */
+          if (!pocl_cache_fetch (cache_key, POCL_PROGRAM_BC_FILENAME, 
+                                 binary_file_name))
+            {
+              printf("about to build program\n");
+              error = pocl_llvm_build_program
+                (program, device, device_i, tmpdir,
+                 binary_file_name, device_tmpdir,
+                 user_options);     
+
+              if (error != 0)
+                {
+                  errcode = CL_BUILD_PROGRAM_FAILURE;
+                  goto ERROR_CLEAN_BINARIES;
+                }
+
+              if (pocl_cache_enabled ())
+                {
+                  if (program->llvm_irs[device_i] != NULL)
+                    pocl_llvm_write_program_binary (program, device_i,
+                                                    binary_file_name);
+                  pocl_cache_insert (cache_key, POCL_PROGRAM_BC_FILENAME,
+                                     binary_file_name);
+                }
+            }
 
           /* In case we cached the llvm::Module, we might not have
              dumped the bitcode yet. FIXME: always assume this and
@@ -294,6 +329,12 @@ CL_API_SUFFIX__VERSION_1_0
                   binary_file);
 
           fclose (binary_file);
+
+          pocl_cache_program_key (real_device_list[device_i], user_options, 
+                                  program->binaries[device_i], 
+                                  program->binary_sizes[device_i],
+                                  program->cache_keys
+                                  [real_device_list[device_i]->dev_id]);
         }      
     }
 
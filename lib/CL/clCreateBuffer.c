@@ -22,8 +22,10 @@
    THE SOFTWARE.
 */
 
+#include <string.h>
 #include "pocl_cl.h"
 #include "devices.h"
+#include "pocl_large_pages.h"
 
 CL_API_ENTRY cl_mem CL_API_CALL
 POname(clCreateBuffer)(cl_context context,
@@ -160,6 +162,23 @@ POname(clCreateBuffer)(cl_context context,
   mem->mem_host_ptr = host_ptr; 
   mem->size = size;
   mem->context = context;
+
+  /* The host memory of an ALLOC_HOST_PTR buffer is shared by the host
+     and the devices in the host address space, so that mapping it does
+     not copy. */
+  if (flags & CL_MEM_ALLOC_HOST_PTR)
+    {
+      mem->mem_host_ptr = pocl_alloc_host_buffer (context, size);
+      if (mem->mem_host_ptr == NULL)
+        {
+          errcode = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+          goto ERROR_CLEAN_MEM;
+        }
+      if (flags & CL_MEM_COPY_HOST_PTR)
+        memcpy (mem->mem_host_ptr, host_ptr, size);
+      else
+        pocl_prefault_buffer (context, mem->mem_host_ptr, size);
+    }
   
   for (i = 0; i < context->num_devices; ++i)
     {
@@ -187,6 +206,8 @@ POname(clCreateBuffer)(cl_context context,
       device->ops->free(device->data, flags, 
                         mem->device_ptrs[device->dev_id].mem_ptr);
     }
+  if (flags & CL_MEM_ALLOC_HOST_PTR)
+    pocl_free_host_buffer (mem->mem_host_ptr);
  ERROR_CLEAN_MEM:
   free(mem);
  ERROR:
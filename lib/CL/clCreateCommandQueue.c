@@ -23,6 +23,7 @@
 
 #include "pocl_cl.h"
 #include "pocl_util.h"
+#include "pocl_queue_util.h"
 
 CL_API_ENTRY cl_command_queue CL_API_CALL
 POname(clCreateCommandQueue)(cl_context context, 
@@ -41,13 +42,6 @@ POname(clCreateCommandQueue)(cl_context context,
     goto ERROR;
   }
 
-  /* we don't handle out-of-order queues yet */
-  if (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) 
-  {
-    errcode = CL_INVALID_QUEUE_PROPERTIES;
-    goto ERROR;
-  }
-
   for (i=0; i<context->num_devices; i++)
     {
       if (context->devices[i] == device)
@@ -72,7 +66,13 @@ POname(clCreateCommandQueue)(cl_context context,
   command_queue->context = context;
   command_queue->device = device;
   command_queue->properties = properties;
-  command_queue->root = NULL;
+
+  errcode = pocl_queue_init (command_queue);
+  if (errcode != CL_SUCCESS)
+    {
+      free (command_queue);
+      goto ERROR;
+    }
 
   if (errcode_ret != NULL)
     *errcode_ret = CL_SUCCESS;
@@ -24,6 +24,8 @@
 #include "devices/devices.h"
 #include "pocl_cl.h"
 #include "pocl_mem_management.h"
+#include "pocl_runtime_config.h"
+#include "CL/cl_ext_pocl.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -35,6 +37,10 @@ int context_set_properties(cl_context                    context,
   int num_properties = 0;
   
   context->properties = NULL;
+  context->page_size = pocl_get_int_option ("POCL_PAGE_SIZE", 0);
+  if ((context->page_size & (context->page_size - 1)) != 0)
+    context->page_size = 0;
+  context->prefault = pocl_get_bool_option ("POCL_PREFAULT", 0);
   
   /* verify if data in properties is valid
    * and set them */
@@ -79,6 +85,22 @@ int context_set_properties(cl_context                    context,
               p += 2;
               break;
 
+            case CL_CONTEXT_PAGE_SIZE_POCL:
+              /* 0 or a power of two */
+              if ((p[1] & (p[1] - 1)) != 0)
+                {
+                  *errcode = CL_INVALID_PROPERTY;
+                  return 0;
+                }
+              context->page_size = (size_t)p[1];
+              p += 2;
+              break;
+
+            case CL_CONTEXT_PREFAULT_POCL:
+              context->prefault = p[1] ? CL_TRUE : CL_FALSE;
+              p += 2;
+              break;
+
             default: 
               *errcode = CL_INVALID_PROPERTY;
               return 0;
@@ -25,6 +25,7 @@
 #include "pocl_cl.h"
 #include "pocl_llvm.h"
 #include "install-paths.h"
+#include "devices.h"
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
@@ -66,6 +67,14 @@ POname(clCreateKernel)(cl_program program,
 
   POCL_INIT_OBJECT (kernel);
 
+  kernel->llvm_irs = (void **) calloc (pocl_num_devices, sizeof (void *));
+  if (kernel->llvm_irs == NULL)
+    {
+      errcode = CL_OUT_OF_HOST_MEMORY;
+      goto ERROR_CLEAN_KERNEL;
+    }
+  kernel->num_llvm_irs = pocl_num_devices;
+
   for (device_i = 0; device_i < program->num_devices; ++device_i)
     {
       if (device_i > 0)
@@ -97,11 +106,14 @@ POname(clCreateKernel)(cl_program program,
 
   kernel->context = program->context;
   kernel->program = program;
+  kernel->wg_cache = NULL;
+  kernel->local_size_counts = NULL;
   kernel->next = NULL;
 
-  cl_kernel k = program->kernels;
+  POCL_LOCK_OBJ (program);
+  kernel->next = program->kernels;
   program->kernels = kernel;
-  kernel->next = k;
+  POCL_UNLOCK_OBJ (program);
 
   POCL_RETAIN_OBJECT(program);
 
@@ -110,6 +122,7 @@ POname(clCreateKernel)(cl_program program,
   return kernel;
 
 ERROR_CLEAN_KERNEL:
+  free(kernel->llvm_irs);
   free(kernel);
 ERROR:
   if(errcode_ret != NULL)
@@ -108,6 +108,7 @@ POname(clCreateProgramWithBinary)(cl_context                     context,
   program->binaries = NULL;
   program->compiler_options = NULL;
   program->llvm_irs = NULL;
+  program->cache_keys = NULL;
 
   /* Allocate a continuous chunk of memory for all the binaries. */
   if ((program->binary_sizes = 
@@ -131,6 +132,7 @@ POname(clCreateProgramWithBinary)(cl_context                     context,
   /* Create the temporary directory where all kernel files and compilation
      (intermediate) results are stored. */
   program->temp_dir = pocl_create_temp_dir();
+  program->id = pocl_unique_id ();
 
   pos = program->binaries[0];
   for (i = 0; i < num_devices; ++i)
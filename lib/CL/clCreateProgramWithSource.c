@@ -109,10 +109,12 @@ POname(clCreateProgramWithSource)(cl_context context,
   program->binaries = NULL;
   program->kernels = NULL;
   program->llvm_irs = NULL;
+  program->cache_keys = NULL;
 
   /* Create the temporary directory where all kernel files and compilation
      (intermediate) results are stored. */
   program->temp_dir = pocl_create_temp_dir();
+  program->id = pocl_unique_id ();
 
   POCL_RETAIN_OBJECT(context);
 
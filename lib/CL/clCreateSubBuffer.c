@@ -123,7 +123,7 @@ POname(clCreateSubBuffer)(cl_mem                   buffer,
     (buffer->flags & CL_MEM_ALLOC_HOST_PTR) |
     (buffer->flags & CL_MEM_COPY_HOST_PTR);
 
-  if (mem->flags & CL_MEM_USE_HOST_PTR)
+  if (mem->flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR))
     {
       mem->mem_host_ptr = buffer->mem_host_ptr + info->origin;
     }
@@ -0,0 +1,92 @@
+/* OpenCL runtime library: clEnqueueFillBuffer()
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_cl.h"
+#include "pocl_util.h"
+#include <string.h>
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname(clEnqueueFillBuffer)(cl_command_queue  command_queue,
+                            cl_mem            buffer,
+                            const void *      pattern,
+                            size_t            pattern_size,
+                            size_t            offset,
+                            size_t            size,
+                            cl_uint           num_events_in_wait_list,
+                            const cl_event*   event_wait_list,
+                            cl_event*         event)
+CL_API_SUFFIX__VERSION_1_2
+{
+  cl_device_id device_id;
+  _cl_command_node *cmd = NULL;
+  void *pattern_copy;
+  int errcode;
+
+  if (command_queue == NULL)
+    return CL_INVALID_COMMAND_QUEUE;
+
+  if (buffer == NULL || buffer->is_image)
+    return CL_INVALID_MEM_OBJECT;
+
+  if (command_queue->context != buffer->context)
+    return CL_INVALID_CONTEXT;
+
+  /* The pattern is a scalar or vector OpenCL type of 1 to 128 bytes. */
+  if (pattern == NULL || pattern_size == 0 || pattern_size > 128 ||
+      (pattern_size & (pattern_size - 1)) != 0)
+    return CL_INVALID_VALUE;
+
+  if (offset % pattern_size != 0 || size % pattern_size != 0 ||
+      offset + size > buffer->size)
+    return CL_INVALID_VALUE;
+
+  device_id = command_queue->device;
+
+  pattern_copy = malloc (pattern_size);
+  if (pattern_copy == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  memcpy (pattern_copy, pattern, pattern_size);
+
+  errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_FILL_BUFFER,
+                                 event, num_events_in_wait_list,
+                                 event_wait_list);
+  if (errcode != CL_SUCCESS)
+    {
+      free (pattern_copy);
+      return errcode;
+    }
+
+  cmd->command.fill.data = device_id->data;
+  cmd->command.fill.device_ptr =
+    buffer->device_ptrs[device_id->dev_id].mem_ptr + offset;
+  cmd->command.fill.size = size;
+  cmd->command.fill.pattern = pattern_copy;
+  cmd->command.fill.pattern_size = pattern_size;
+  cmd->command.fill.buffer = buffer;
+  POname(clRetainMemObject) (buffer);
+
+  pocl_command_enqueue (command_queue, cmd);
+
+  return CL_SUCCESS;
+}
+POsym(clEnqueueFillBuffer)
@@ -78,10 +78,11 @@ POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
       goto ERROR;
     }
 
-  if (buffer->flags & CL_MEM_USE_HOST_PTR)
+  if (buffer->flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR))
     {
       /* In this case it should use the given host_ptr + offset as
-         the mapping area in the host memory. */   
+         the mapping area in the host memory. An ALLOC_HOST_PTR buffer
+         is mapped to its host memory allocated by pocl. */   
       assert (buffer->mem_host_ptr != NULL);
       host_ptr = buffer->mem_host_ptr + offset;
     }
@@ -118,7 +119,9 @@ POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
   mapping_info->host_ptr = host_ptr;
   mapping_info->offset = offset;
   mapping_info->size = size;
+  POCL_LOCK_OBJ (buffer);
   DL_APPEND (buffer->mappings, mapping_info);  
+  POCL_UNLOCK_OBJ (buffer);
   pocl_command_enqueue(command_queue, cmd);
 
   if (blocking_map != CL_TRUE)
@@ -139,7 +142,6 @@ POname(clEnqueueMapBuffer)(cl_command_queue command_queue,
  ERROR:
   if (event)
     free(*event);
-  free(cmd);
   free(event);
   free (mapping_info);
   if (errcode_ret)
@@ -161,7 +163,9 @@ pocl_map_mem_cmd(cl_device_id device,
     (device->data, buffer->device_ptrs[device->dev_id].mem_ptr, 
      mapping_info->offset, mapping_info->size, mapping_info->host_ptr);
   
+  POCL_LOCK_OBJ (buffer);
   buffer->map_count++;
+  POCL_UNLOCK_OBJ (buffer);
   return mapping_info->host_ptr;
 
 }
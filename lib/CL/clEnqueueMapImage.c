@@ -109,7 +109,7 @@ CL_API_SUFFIX__VERSION_1_0
       goto ERROR;
     }
 
-  if (image->flags & CL_MEM_USE_HOST_PTR)
+  if (image->flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR))
     {
       /* In this case it should use the given host_ptr + offset as
          the mapping area in the host memory. */   
@@ -145,13 +145,16 @@ CL_API_SUFFIX__VERSION_1_0
   mapping_info->host_ptr = map;
   mapping_info->offset = offset;
   mapping_info->size = 0;/* not needed ?? */
-  DL_APPEND (image->mappings, mapping_info);
 
   errcode = pocl_create_command (&cmd, command_queue, CL_COMMAND_MAP_IMAGE, 
                                  event, num_events_in_wait_list, 
                                  event_wait_list);
   if (errcode != CL_SUCCESS)
     goto ERROR;
+
+  POCL_LOCK_OBJ (image);
+  DL_APPEND (image->mappings, mapping_info);
+  POCL_UNLOCK_OBJ (image);
       
   
   cmd->command.map.buffer = image;
@@ -174,7 +177,6 @@ CL_API_SUFFIX__VERSION_1_0
  
  ERROR:
   free (map);
-  free (cmd);
   free (mapping_info);
   if (event != NULL)
     free (*event);
@@ -52,7 +52,6 @@ CL_API_SUFFIX__VERSION_1_2
 
  ERROR:
   free (event); 
-  free (cmd);
   return errcode;
 
 }
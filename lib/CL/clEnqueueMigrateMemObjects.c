@@ -0,0 +1,87 @@
+/* OpenCL runtime library: clEnqueueMigrateMemObjects()
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include "pocl_cl.h"
+#include "pocl_util.h"
+#include <string.h>
+
+CL_API_ENTRY cl_int CL_API_CALL
+POname(clEnqueueMigrateMemObjects)(cl_command_queue       command_queue,
+                                   cl_uint                num_mem_objects,
+                                   const cl_mem *         mem_objects,
+                                   cl_mem_migration_flags flags,
+                                   cl_uint                num_events_in_wait_list,
+                                   const cl_event *       event_wait_list,
+                                   cl_event *             event)
+CL_API_SUFFIX__VERSION_1_2
+{
+  _cl_command_node *cmd = NULL;
+  cl_mem *mem_list;
+  cl_uint i;
+  int errcode;
+
+  if (command_queue == NULL)
+    return CL_INVALID_COMMAND_QUEUE;
+
+  if (num_mem_objects == 0 || mem_objects == NULL)
+    return CL_INVALID_VALUE;
+
+  if ((flags & ~(CL_MIGRATE_MEM_OBJECT_HOST |
+                 CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED)) != 0)
+    return CL_INVALID_VALUE;
+
+  for (i = 0; i < num_mem_objects; ++i)
+    {
+      if (mem_objects[i] == NULL)
+        return CL_INVALID_MEM_OBJECT;
+      if (mem_objects[i]->context != command_queue->context)
+        return CL_INVALID_CONTEXT;
+    }
+
+  mem_list = (cl_mem*) malloc (num_mem_objects * sizeof (cl_mem));
+  if (mem_list == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  memcpy (mem_list, mem_objects, num_mem_objects * sizeof (cl_mem));
+
+  errcode = pocl_create_command (&cmd, command_queue,
+                                 CL_COMMAND_MIGRATE_MEM_OBJECTS,
+                                 event, num_events_in_wait_list,
+                                 event_wait_list);
+  if (errcode != CL_SUCCESS)
+    {
+      free (mem_list);
+      return errcode;
+    }
+
+  for (i = 0; i < num_mem_objects; ++i)
+    POname(clRetainMemObject) (mem_list[i]);
+
+  cmd->command.migrate.mem_objects = mem_list;
+  cmd->command.migrate.num_mem_objects = num_mem_objects;
+  cmd->command.migrate.flags = flags;
+
+  pocl_command_enqueue (command_queue, cmd);
+
+  return CL_SUCCESS;
+}
+POsym(clEnqueueMigrateMemObjects)
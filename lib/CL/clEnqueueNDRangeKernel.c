@@ -25,19 +25,240 @@
 #include "config.h"
 #include "pocl_cl.h"
 #include "pocl_llvm.h"
+#include "pocl_cache.h"
 #include "pocl_util.h"
+#include "pocl_runtime_config.h"
 #include "utlist.h"
 #include "install-paths.h"
 #include <assert.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
 #define COMMAND_LENGTH 1024
 #define ARGUMENT_STRING_LENGTH 32
 
-#define DEBUG_NDRANGE
+/* #define DEBUG_NDRANGE */
+
+/* Writes the kernel bitcode and generates the work-group function
+   bitcode for the local size to the temporary directory, unless it
+   exists already. 
+
+   The work-group function depends only on the kernel and the local
+   size. The rest of the launch parameters (the global offset, the
+   number of groups and the dimensions) are read at runtime from the
+   pocl_context, thus they are not part of the directory name. 
+
+   A zero local size generates the work-group function that reads
+   also the local size from the pocl_context. */
+static cl_int
+generate_workgroup_function (cl_device_id device, cl_kernel kernel,
+                             size_t local_x, size_t local_y, size_t local_z,
+                             char *tmpdir)
+{
+  char kernel_filename[POCL_FILENAME_LENGTH];
+  FILE *kernel_file;
+  char parallel_filename[POCL_FILENAME_LENGTH];
+  char cache_key[POCL_CACHE_KEY_LENGTH];
+  int use_cache;
+  size_t n;
+  int error;
+
+  snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/%s/%s/%zu-%zu-%zu", 
+            kernel->program->temp_dir, device->short_name, 
+            kernel->name, local_x, local_y, local_z);
+  mkdir (tmpdir, S_IRWXU);
+
+  
+  const char* wg_method = 
+    pocl_get_string_option("POCL_WORK_GROUP_METHOD", "loopvec");
+  if(strcmp(wg_method,"spmd") == 0){
+    error = snprintf
+      (parallel_filename, POCL_FILENAME_LENGTH,
+       "%s/%s", tmpdir, "parallel_hwacha.bc");
+  }else{
+    error = snprintf
+      (parallel_filename, POCL_FILENAME_LENGTH,
+       "%s/%s", tmpdir, POCL_PARALLEL_BC_FILENAME);
+  }
+  if (error < 0)
+    return CL_OUT_OF_HOST_MEMORY;
+
+  if (access (parallel_filename, F_OK) == 0)
+    return CL_SUCCESS;
+
+  /* The file names differ with the spmd method. */
+  use_cache = strcmp (wg_method, "spmd") != 0 && 
+    kernel->program->cache_keys != NULL;
+  if (use_cache)
+    {
+      pocl_cache_workgroup_key 
+        (kernel->program->cache_keys[device->dev_id],
+         kernel->function_name, local_x, local_y, local_z, cache_key);
+      if (pocl_cache_fetch (cache_key, POCL_PARALLEL_BC_FILENAME, 
+                            parallel_filename))
+        return CL_SUCCESS;
+    }
+
+  if (kernel->program->llvm_irs[0] == NULL)
+    {
+      error = snprintf
+        (kernel_filename, POCL_FILENAME_LENGTH,
+         "%s/%s/%s/kernel.bc", kernel->program->temp_dir, 
+         device->short_name, kernel->name);
+
+      if (error < 0)
+        return CL_OUT_OF_HOST_MEMORY;
+
+      if (access (kernel_filename, F_OK) != 0) 
+        {
+          kernel_file = fopen(kernel_filename, "w+");
+          if (kernel_file == NULL)
+            return CL_OUT_OF_HOST_MEMORY;
+
+          n = fwrite(kernel->program->binaries[device->dev_id], 1,
+                     kernel->program->binary_sizes[device->dev_id], 
+                     kernel_file);
+          if (n < kernel->program->binary_sizes[device->dev_id])
+            return CL_OUT_OF_HOST_MEMORY;
+  
+          fclose(kernel_file);
+
+#ifdef DEBUG_NDRANGE
+          printf("[kernel bc written] ");
+#endif
+        }
+      else
+        {
+#ifdef DEBUG_NDRANGE
+          printf("[kernel bc already written] ");
+#endif
+        }
+    }
+
+  error = pocl_llvm_generate_workgroup_function
+    (device, kernel, local_x, local_y, local_z,
+     parallel_filename, kernel_filename);
+  if (error) return error;
+
+  if (use_cache)
+    pocl_cache_insert (cache_key, POCL_PARALLEL_BC_FILENAME, 
+                       parallel_filename);
+
+#ifdef DEBUG_NDRANGE
+  printf("[parallel bc created]\n");
+#endif
+
+  return CL_SUCCESS;
+}
+
+typedef struct specialize_job
+{
+  cl_device_id device;
+  cl_kernel kernel;
+  size_t local_x;
+  size_t local_y;
+  size_t local_z;
+} specialize_job;
+
+/* Generates and loads the work-group function specialized for the
+   local size of the job. The device installs it to the kernel's
+   wg_cache, where the later launches find it. */
+static void *
+specialize_workgroup_function (void *data)
+{
+  specialize_job *job = (specialize_job *) data;
+  char tmpdir[POCL_FILENAME_LENGTH];
+  _cl_command_node cmd;
+
+  if (generate_workgroup_function (job->device, job->kernel, job->local_x,
+                                   job->local_y, job->local_z,
+                                   tmpdir) == CL_SUCCESS)
+    {
+      memset (&cmd, 0, sizeof (cmd));
+      cmd.type = CL_COMMAND_NDRANGE_KERNEL;
+      cmd.device = job->device;
+      cmd.command.run.kernel = job->kernel;
+      cmd.command.run.tmp_dir = tmpdir;
+      cmd.command.run.local_x = job->local_x;
+      cmd.command.run.local_y = job->local_y;
+      cmd.command.run.local_z = job->local_z;
+      job->device->ops->compile_submitted_kernels (&cmd);
+    }
+
+  POname(clReleaseKernel) (job->kernel);
+  free (job);
+  return NULL;
+}
+
+/* Starts compiling the specialized work-group function in a thread of
+   its own. Returns non-zero if the thread was started. */
+static int
+specialize_in_background (cl_device_id device, cl_kernel kernel,
+                          size_t local_x, size_t local_y, size_t local_z)
+{
+  specialize_job *job;
+  pthread_t thread;
+
+  if (device->ops->compile_submitted_kernels == NULL)
+    return 0;
+
+  job = (specialize_job *) malloc (sizeof (specialize_job));
+  if (job == NULL)
+    return 0;
+  job->device = device;
+  job->kernel = kernel;
+  job->local_x = local_x;
+  job->local_y = local_y;
+  job->local_z = local_z;
+
+  /* The kernel keeps also the program alive until the job is done. */
+  POname(clRetainKernel) (kernel);
+  if (pthread_create (&thread, NULL, specialize_workgroup_function, job))
+    {
+      POname(clReleaseKernel) (kernel);
+      free (job);
+      return 0;
+    }
+  pthread_detach (thread);
+  return 1;
+}
+
+/* Returns non-zero if the launch should use the work-group function
+   reading the local size at run time instead of one specialized for
+   the local size. That is the case for the first
+   POCL_DYNAMIC_LOCAL_SIZE_LAUNCHES launches with each local size, thus
+   a local size launched only a few times is never compiled separately.
+   The specialized function is faster for the sizes launched often. 
+   It is compiled in the background after the last of those launches,
+   which keep using the dynamic one until it is ready. */
+static int
+use_dynamic_local_size (cl_device_id device, cl_kernel kernel,
+                        size_t local_x, size_t local_y, size_t local_z)
+{
+  int max_launches = 
+    pocl_get_int_option ("POCL_DYNAMIC_LOCAL_SIZE_LAUNCHES", 0);
+  unsigned launches;
+
+  if (max_launches <= 0 || !device->dynamic_local_size ||
+      strcmp (pocl_get_string_option ("POCL_WORK_GROUP_METHOD", "loopvec"),
+              "spmd") == 0)
+    return 0;
+
+  launches = pocl_kernel_count_launch (kernel, device, 
+                                       local_x, local_y, local_z);
+  if (launches <= (unsigned)max_launches)
+    return 1;
+
+  /* Only the first launch past the limit starts the compilation, or
+     compiles synchronously if no thread could be started for it. */
+  if (launches == (unsigned)max_launches + 1)
+    return specialize_in_background (device, kernel,
+                                     local_x, local_y, local_z);
+  return 1;
+}
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
@@ -54,10 +275,8 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   size_t global_x, global_y, global_z;
   size_t local_x, local_y, local_z;
   char tmpdir[POCL_FILENAME_LENGTH];
-  char kernel_filename[POCL_FILENAME_LENGTH];
-  FILE *kernel_file;
-  char parallel_filename[POCL_FILENAME_LENGTH];
-  size_t n;
+  pocl_wg_cache_item *wg_item;
+  int dynamic_local_size;
   int i, count;
   int error;
   struct pocl_context pc;
@@ -80,8 +299,8 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   if (global_work_offset != NULL)
     {
       offset_x = global_work_offset[0];
-      offset_y = work_dim > 1 ? global_work_offset[1] : 1;
-      offset_z = work_dim > 2 ? global_work_offset[2] : 1;
+      offset_y = work_dim > 1 ? global_work_offset[1] : 0;
+      offset_z = work_dim > 2 ? global_work_offset[2] : 0;
     }
   else
     {
@@ -156,82 +375,31 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
       (event_wait_list != NULL && num_events_in_wait_list == 0))
     return CL_INVALID_EVENT_WAIT_LIST;
 
-  snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/%s/%s/%zu-%zu-%zu.%zu-%zu-%zu", 
-            kernel->program->temp_dir, command_queue->device->short_name, 
-            kernel->name, 
-            local_x, local_y, local_z, offset_x, offset_y, offset_z);
-  mkdir (tmpdir, S_IRWXU);
-
-  
-  const char* wg_method = 
-    pocl_get_string_option("POCL_WORK_GROUP_METHOD", "loopvec");
-  if(strcmp(wg_method,"spmd") == 0){
-    error = snprintf
-      (parallel_filename, POCL_FILENAME_LENGTH,
-       "%s/%s", tmpdir, "parallel_hwacha.bc");
-  }else{
-    error = snprintf
-      (parallel_filename, POCL_FILENAME_LENGTH,
-       "%s/%s", tmpdir, POCL_PARALLEL_BC_FILENAME);
-  }
-  if (error < 0)
-    return CL_OUT_OF_HOST_MEMORY;
-
-  if (kernel->program->llvm_irs[0] == NULL)
+  /* The fast path for the launches with an already generated
+     work-group function: no file system access needed. */
+  dynamic_local_size = 0;
+  wg_item = pocl_kernel_find_wg (kernel, command_queue->device,
+                                 local_x, local_y, local_z);
+  if (wg_item == NULL &&
+      use_dynamic_local_size (command_queue->device, kernel,
+                              local_x, local_y, local_z))
     {
-      error = snprintf
-        (kernel_filename, POCL_FILENAME_LENGTH,
-         "%s/%s/%s/kernel.bc", kernel->program->temp_dir, 
-         command_queue->device->short_name, kernel->name);
-
-      if (error < 0)
-        return CL_OUT_OF_HOST_MEMORY;
-
-      if (access (kernel_filename, F_OK) != 0) 
-        {
-          kernel_file = fopen(kernel_filename, "w+");
-          if (kernel_file == NULL)
-            return CL_OUT_OF_HOST_MEMORY;
-
-          n = fwrite(kernel->program->binaries[command_queue->device->dev_id], 1,
-                     kernel->program->binary_sizes[command_queue->device->dev_id], 
-                     kernel_file);
-          if (n < kernel->program->binary_sizes[command_queue->device->dev_id])
-            return CL_OUT_OF_HOST_MEMORY;
-  
-          fclose(kernel_file);
-
-#ifdef DEBUG_NDRANGE
-          printf("[kernel bc written] ");
-#endif
-        }
-      else
-        {
-#ifdef DEBUG_NDRANGE
-          printf("[kernel bc already written] ");
-#endif
-        }
-    }
-
-  if (access (parallel_filename, F_OK) != 0) 
-    {
-      error = pocl_llvm_generate_workgroup_function
-          (command_queue->device,
-           kernel, local_x, local_y, local_z,
-           parallel_filename, kernel_filename);
-      if (error) return error;
-
-#ifdef DEBUG_NDRANGE
-      printf("[parallel bc created]\n");
-#endif
+      dynamic_local_size = 1;
+      wg_item = pocl_kernel_find_wg (kernel, command_queue->device, 0, 0, 0);
     }
-  else
+  if (wg_item == NULL)
     {
-#ifdef DEBUG_NDRANGE
-      printf("[parallel bc already created]\n");
-#endif
+      if (dynamic_local_size)
+        error = generate_workgroup_function (command_queue->device, kernel,
+                                             0, 0, 0, tmpdir);
+      else
+        error = generate_workgroup_function (command_queue->device, kernel,
+                                             local_x, local_y, local_z,
+                                             tmpdir);
+      if (error != CL_SUCCESS)
+        return error;
     }
-  
+
   error = pocl_create_command (&command_node, command_queue,
                                CL_COMMAND_NDRANGE_KERNEL,
                                event, num_events_in_wait_list,
@@ -246,15 +414,26 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   pc.global_offset[0] = offset_x;
   pc.global_offset[1] = offset_y;
   pc.global_offset[2] = offset_z;
+  pc.local_size[0] = local_x;
+  pc.local_size[1] = local_y;
+  pc.local_size[2] = local_z;
 
   command_node->type = CL_COMMAND_NDRANGE_KERNEL;
   command_node->command.run.data = command_queue->device->data;
-  command_node->command.run.tmp_dir = strdup(tmpdir);
+  command_node->command.run.tmp_dir = 
+    strdup (wg_item != NULL ? wg_item->tmp_dir : tmpdir);
+  /* Resolved by the device at the first launch. */
+  command_node->command.run.wg = wg_item != NULL ? wg_item->wg : NULL;
+  command_node->command.run.wg_range =
+    wg_item != NULL ? wg_item->wg_range : NULL;
+  command_node->command.run.context_scratch_size =
+    wg_item != NULL ? wg_item->context_scratch_size : 0;
   command_node->command.run.kernel = kernel;
   command_node->command.run.pc = pc;
   command_node->command.run.local_x = local_x;
   command_node->command.run.local_y = local_y;
   command_node->command.run.local_z = local_z;
+  command_node->command.run.dynamic_local_size = dynamic_local_size;
 
   /* Copy the currently set kernel arguments because the same kernel 
      object can be reused for new launches with different arguments. */
@@ -290,7 +469,6 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
 
   command_node->next = NULL; 
   
-  POname(clRetainCommandQueue) (command_queue);
   POname(clRetainKernel) (kernel);
 
   command_node->command.run.arg_buffer_count = 0;
@@ -299,18 +477,25 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
   for (i = 0; i < kernel->num_args; ++i)
   {
     struct pocl_argument *al = &(kernel->dyn_arguments[i]);
-    if (!kernel->arg_is_local[i] && kernel->arg_is_pointer[i] && al->value != NULL)
+    if (!kernel->arg_is_local[i] && 
+        (kernel->arg_is_pointer[i] || kernel->arg_is_image[i]) &&
+        al->value != NULL)
       ++command_node->command.run.arg_buffer_count;
   }
   
-  /* Copy the argument buffers just so we can free them after execution. */
+  /* Copy the argument buffers just so we can free them after execution.
+     The out-of-order queues also order the commands by them. */
   command_node->command.run.arg_buffers = 
     (cl_mem *) malloc (sizeof (struct _cl_mem) * command_node->command.run.arg_buffer_count);
+  command_node->command.run.arg_buffer_writes =
+    (char *) malloc (command_node->command.run.arg_buffer_count);
   count = 0;
   for (i = 0; i < kernel->num_args; ++i)
   {
     struct pocl_argument *al = &(kernel->dyn_arguments[i]);
-    if (!kernel->arg_is_local[i] && kernel->arg_is_pointer[i] && al->value != NULL)
+    if (!kernel->arg_is_local[i] && 
+        (kernel->arg_is_pointer[i] || kernel->arg_is_image[i]) &&
+        al->value != NULL)
       {
         cl_mem buf;
 //#if 0
@@ -320,6 +505,8 @@ POname(clEnqueueNDRangeKernel)(cl_command_queue command_queue,
         if (buf != NULL)
           POname(clRetainMemObject) (buf);
         command_node->command.run.arg_buffers[count] = buf;
+        command_node->command.run.arg_buffer_writes[count] =
+          !kernel->arg_is_read_only[i];
         ++count;
       }
   }
@@ -22,7 +22,7 @@
 */
 
 #include "pocl_cl.h"
-#include "utlist.h"
+#include "pocl_queue_util.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clFlush)(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
@@ -30,8 +30,12 @@ POname(clFlush)(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
   /* "clFlush only guarantees that all queued commands to command_queue
      will eventually be submitted to the appropriate device. There is no guarantee 
      that they will be complete after clFlush returns." */
-  /* This could be implemented as an asyc clFinish(), executing it in another
-     thread? */
-  return POname(clFinish) (command_queue);
+  if (command_queue == NULL)
+    return CL_INVALID_COMMAND_QUEUE;
+
+  /* The commands are executed in the background by the dispatcher
+     thread of the queue. */
+  pocl_queue_flush (command_queue);
+  return CL_SUCCESS;
 }
 POsym(clFlush)
@@ -56,9 +56,18 @@ POname(clGetMemObjectInfo)(cl_mem      memobj ,
   case CL_MEM_SIZE:
     POCL_RETURN_MEM_INFO (size_t, memobj->size);
   case CL_MEM_HOST_PTR:
-    POCL_RETURN_MEM_INFO (void *, memobj->mem_host_ptr);
+    /* Only the pointer given by the application is returned, not the
+       host memory of an ALLOC_HOST_PTR buffer. */
+    POCL_RETURN_MEM_INFO (void *, (memobj->flags & CL_MEM_USE_HOST_PTR) ?
+                          memobj->mem_host_ptr : NULL);
   case CL_MEM_MAP_COUNT:
-    POCL_RETURN_MEM_INFO (cl_uint, memobj->map_count);
+    {
+      cl_uint map_count;
+      POCL_LOCK_OBJ (memobj);
+      map_count = memobj->map_count;
+      POCL_UNLOCK_OBJ (memobj);
+      POCL_RETURN_MEM_INFO (cl_uint, map_count);
+    }
   case CL_MEM_REFERENCE_COUNT:
     POCL_RETURN_MEM_INFO (cl_uint, memobj->pocl_refcount);
   case CL_MEM_CONTEXT:
@@ -23,6 +23,7 @@
 
 #include "pocl_cl.h"
 #include "pocl_util.h"
+#include "pocl_queue_util.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clReleaseCommandQueue)(cl_command_queue command_queue) CL_API_SUFFIX__VERSION_1_0
@@ -37,7 +38,10 @@ POname(clReleaseCommandQueue)(cl_command_queue command_queue) CL_API_SUFFIX__VER
   POCL_RELEASE_OBJECT(command_queue, new_refcount);
   if (new_refcount == 0)
     {
-      free (command_queue);
+      /* The queue is freed by its dispatcher thread in case it dropped
+         the last reference. */
+      if (pocl_queue_destroy (command_queue))
+        free (command_queue);
       /* TODO: should clReleaseContext()? */
     }
   return CL_SUCCESS;
@@ -22,22 +22,29 @@
 */
 
 #include "pocl_cl.h"
+#include "pocl_llvm.h"
 #include "pocl_util.h"
+#include "utlist.h"
 
 CL_API_ENTRY cl_int CL_API_CALL
 POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
 {
   int new_refcount;
   cl_kernel *pk;
+  pocl_wg_cache_item *item, *tmp;
+  pocl_local_size_count *count, *next_count;
   int i;
   POCL_RELEASE_OBJECT (kernel, new_refcount);
 
   if (new_refcount == 0)
     {
 
+      pocl_llvm_release_kernel (kernel);
+
       if (kernel->program != NULL)
         {
           /* Find the kernel in the program's linked list of kernels */
+          POCL_LOCK_OBJ (kernel->program);
           for (pk=&kernel->program->kernels; *pk != NULL; pk = &(*pk)->next)
             {
               if (*pk == kernel) break;
@@ -46,12 +53,14 @@ POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
             {
               /* The kernel is not on the kernel's program's linked list
                  of kernels -- something is wrong */
+              POCL_UNLOCK_OBJ (kernel->program);
               return CL_INVALID_VALUE;
             }
           
           /* Remove the kernel from the program's linked list of
              kernels */
           *pk = (*pk)->next;
+          POCL_UNLOCK_OBJ (kernel->program);
           POname(clReleaseProgram) (kernel->program);
         }
       
@@ -67,6 +76,15 @@ POname(clReleaseKernel)(cl_kernel kernel) CL_API_SUFFIX__VERSION_1_0
             }
         }
 
+      LL_FOREACH_SAFE (kernel->wg_cache, item, tmp)
+        {
+          free (item->tmp_dir);
+          free (item);
+        }
+      LL_FOREACH_SAFE (kernel->local_size_counts, count, next_count)
+        free (count);
+
+      free (kernel->llvm_irs);
       free (kernel->dyn_arguments);
       free (kernel->reqd_wg_size);
       free (kernel);
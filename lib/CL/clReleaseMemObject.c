@@ -23,6 +23,7 @@
 
 #include "utlist.h"
 #include "pocl_cl.h"
+#include "pocl_large_pages.h"
 #include <stdio.h>
 
 CL_API_ENTRY cl_int CL_API_CALL
@@ -56,6 +57,8 @@ POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
               device_id->ops->free(device_id->data, memobj->flags, memobj->device_ptrs[device_id->dev_id].mem_ptr);
               memobj->device_ptrs[device_id->dev_id].mem_ptr = NULL;
             }
+          if (memobj->flags & CL_MEM_ALLOC_HOST_PTR)
+            pocl_free_host_buffer (memobj->mem_host_ptr);
         } else 
         {
           /* a sub buffer object does not free the memory from
@@ -63,11 +66,13 @@ POname(clReleaseMemObject)(cl_mem memobj) CL_API_SUFFIX__VERSION_1_0
           POCL_RELEASE_OBJECT(memobj->parent, new_refcount);
         }
       POCL_RELEASE_OBJECT(memobj->context, new_refcount);
+      POCL_LOCK_OBJ (memobj);
       DL_FOREACH_SAFE(memobj->mappings, mapping, temp)
         {
           free (mapping);
         }
       memobj->mappings = NULL;
+      POCL_UNLOCK_OBJ (memobj);
       
       free(memobj->device_ptrs);
       free(memobj);
@@ -22,10 +22,12 @@
    THE SOFTWARE.
 */
 
+#include <assert.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "pocl_cl.h"
+#include "pocl_llvm.h"
 #include "pocl_util.h"
 #include "pocl_runtime_config.h"
 
@@ -33,21 +35,27 @@ CL_API_ENTRY cl_int CL_API_CALL
 POname(clReleaseProgram)(cl_program program) CL_API_SUFFIX__VERSION_1_0
 {
   int new_refcount;
-  cl_kernel k;
+  unsigned i;
 
   POCL_RELEASE_OBJECT (program, new_refcount);
 
   if (new_refcount == 0)
     {
 
-      /* Mark all kernels as having no program.
-         FIXME: this should not be needed if the kernels
-         retain the parent program (and release when the kernel
-         is released). */
-      for (k=program->kernels; k!=NULL; k=k->next)
-        {          
-          k->program = NULL;
+      /* The kernels retain the program until they are released, and
+         the commands retain their kernel until they have run. Thus no
+         kernel, and no work-group function in a kernel's cache,
+         refers to the program anymore, and its work-group functions
+         can be freed. */
+      assert (program->kernels == NULL);
+
+      for (i = 0; i < program->num_devices; ++i)
+        {
+          cl_device_id device = program->devices[i];
+          if (device->ops->free_program != NULL)
+            device->ops->free_program (device, program);
         }
+      pocl_llvm_release_workgroup_functions (program);
 
       POCL_RELEASE_OBJECT (program->context, new_refcount);
       free (program->source);
@@ -65,6 +73,7 @@ POname(clReleaseProgram)(cl_program program) CL_API_SUFFIX__VERSION_1_0
         }
 
       free (program->llvm_irs);
+      free (program->cache_keys);
       free (program->temp_dir);
       free (program);
     }
@@ -28,11 +28,30 @@ POname(clWaitForEvents)(cl_uint              num_events ,
                   const cl_event *     event_list ) CL_API_SUFFIX__VERSION_1_0
 {
   int event_i;
-  // dummy implementation, waits until *all* events have completed.
+  int failed = 0;
+
+  if (num_events == 0 || event_list == NULL)
+    return CL_INVALID_VALUE;
+
   for (event_i = 0; event_i < num_events; ++event_i)
     {
-      POname(clFinish)(event_list[event_i]->queue);
+      if (event_list[event_i] == NULL)
+        return CL_INVALID_EVENT;
     }
-  return CL_SUCCESS;
+
+  /* The commands are executed by the dispatcher threads of the queues
+     in the background. Block until each of the events signals its 
+     completion. */
+  for (event_i = 0; event_i < num_events; ++event_i)
+    {
+      cl_event event = event_list[event_i];
+      POCL_LOCK_OBJ (event);
+      while (event->status > CL_COMPLETE)
+        pthread_cond_wait (&event->completion_cond, &event->pocl_lock);
+      failed |= event->status < 0;
+      POCL_UNLOCK_OBJ (event);
+    }
+
+  return failed ? CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST : CL_SUCCESS;
 }
 POsym(clWaitForEvents)
@@ -28,8 +28,14 @@
 #include "install-paths.h"
 #include "common.h"
 #include "utlist.h"
+#include "pocl_util.h"
+#include "pocl_runtime_config.h"
+#include "pocl_large_pages.h"
+#include "bulkcopy.h"
 
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -201,8 +207,10 @@ pocl_basic_init_device_ops(struct pocl_device_ops *ops)
   ops->copy = pocl_basic_copy;
   ops->copy_rect = pocl_basic_copy_rect;
   ops->fill_rect = pocl_basic_fill_rect;
+  ops->fill = pocl_basic_fill;
   ops->map_mem = pocl_basic_map_mem;
   ops->compile_submitted_kernels = pocl_basic_compile_submitted_kernels;
+  ops->free_program = pocl_basic_free_program;
   ops->run = pocl_basic_run;
   ops->run_native = pocl_basic_run_native;
   ops->get_timer_value = pocl_basic_get_timer_value;
@@ -282,6 +290,8 @@ pocl_basic_init_device_infos(struct _cl_device_id* dev)
   dev->llvm_cpu = OCL_KERNEL_TARGET_CPU;
   dev->llvm_target_arch = OCL_KERNEL_ARCH;
   dev->has_64bit_long = 1;
+  dev->dynamic_local_size = 1;
+  dev->context_scratch = 1;
 }
 
 
@@ -360,18 +370,26 @@ pocl_basic_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
   /* if memory for this global memory is not yet allocated -> do it */
   if (mem_obj->device_ptrs[device->global_mem_id].mem_ptr == NULL)
     {
-      if (flags & CL_MEM_USE_HOST_PTR && mem_obj->mem_host_ptr != NULL)
+      if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR) &&
+          mem_obj->mem_host_ptr != NULL)
         {
           b = mem_obj->mem_host_ptr;
         }
-      else if (posix_memalign (&b, MAX_EXTENDED_ALIGNMENT, 
-                               mem_obj->size) != 0){
-        printf("align:%d, size:%d\n",MAX_EXTENDED_ALIGNMENT,mem_obj->size);
-        return CL_MEM_OBJECT_ALLOCATION_FAILURE;
-        }
+      else 
+        {
+          b = pocl_large_pages_alloc (mem_obj->context, mem_obj->size);
+          if (b == NULL &&
+              posix_memalign (&b, MAX_EXTENDED_ALIGNMENT, 
+                              mem_obj->size) != 0){
+            printf("align:%d, size:%d\n",MAX_EXTENDED_ALIGNMENT,mem_obj->size);
+            return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+            }
 
-      if (flags & CL_MEM_COPY_HOST_PTR)
-        memcpy (b, mem_obj->mem_host_ptr, mem_obj->size);
+          if (flags & CL_MEM_COPY_HOST_PTR)
+            memcpy (b, mem_obj->mem_host_ptr, mem_obj->size);
+          else
+            pocl_prefault_buffer (mem_obj->context, b, mem_obj->size);
+        }
     
       mem_obj->device_ptrs[device->global_mem_id].mem_ptr = b;
       mem_obj->device_ptrs[device->global_mem_id].global_mem_id = 
@@ -387,29 +405,24 @@ pocl_basic_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
 void
 pocl_basic_free (void *data, cl_mem_flags flags, void *ptr)
 {
-  if (flags & CL_MEM_USE_HOST_PTR){
+  if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR)){
     return;
   }
   
-  free (ptr);
+  if (pocl_large_pages_free (ptr) != 0)
+    free (ptr);
 }
 
 void
 pocl_basic_read (void *data, void *host_ptr, const void *device_ptr, size_t cb)
 {
-  if (host_ptr == device_ptr)
-    return;
-
-  memcpy (host_ptr, device_ptr, cb);
+  bulk_copy (NULL, host_ptr, device_ptr, cb);
 }
 
 void
 pocl_basic_write (void *data, const void *host_ptr, void *device_ptr, size_t cb)
 {
-  if (host_ptr == device_ptr)
-    return;
-
-  memcpy (device_ptr, host_ptr, cb);
+  bulk_copy (NULL, device_ptr, host_ptr, cb);
 }
 
 
@@ -505,18 +518,33 @@ pocl_basic_run
       *(void **)(arguments[i]) = pocl_basic_malloc (data, 0, al->size, NULL);
     }
 
-  for (z = 0; z < pc->num_groups[2]; ++z)
+  pc->context_scratch = 
+    pocl_context_scratch (cmd->command.run.context_scratch_size);
+  if (cmd->command.run.context_scratch_size > 0 && 
+      pc->context_scratch == NULL)
+    POCL_ABORT ("Could not allocate the context scratch buffer.\n");
+
+  if (cmd->command.run.wg_range != NULL)
     {
-      for (y = 0; y < pc->num_groups[1]; ++y)
+      size_t num_groups = 
+        pc->num_groups[0] * pc->num_groups[1] * pc->num_groups[2];
+      if (num_groups > 0)
+        cmd->command.run.wg_range (arguments, pc, 0, num_groups - 1);
+    }
+  else
+    {
+      for (z = 0; z < pc->num_groups[2]; ++z)
         {
-          for (x = 0; x < pc->num_groups[0]; ++x)
+          for (y = 0; y < pc->num_groups[1]; ++y)
             {
-              pc->group_id[0] = x;
-              pc->group_id[1] = y;
-              pc->group_id[2] = z;
-
-              cmd->command.run.wg (arguments, pc);
-
+              for (x = 0; x < pc->num_groups[0]; ++x)
+                {
+                  pc->group_id[0] = x;
+                  pc->group_id[1] = y;
+                  pc->group_id[2] = z;
+
+                  cmd->command.run.wg (arguments, pc);
+                }
             }
         }
     }
@@ -545,10 +573,7 @@ pocl_basic_run_native
 void
 pocl_basic_copy (void *data, const void *src_ptr, void *__restrict__ dst_ptr, size_t cb)
 {
-  if (src_ptr == dst_ptr)
-    return;
-  
-  memcpy (dst_ptr, src_ptr, cb);
+  bulk_copy (NULL, dst_ptr, src_ptr, cb);
 }
 
 void
@@ -563,22 +588,9 @@ pocl_basic_copy_rect (void *data,
                       size_t const dst_row_pitch,
                       size_t const dst_slice_pitch)
 {
-  char const *__restrict const adjusted_src_ptr = 
-    (char const*)src_ptr +
-    src_origin[0] + src_row_pitch * src_origin[1] + src_slice_pitch * src_origin[2];
-  char *__restrict__ const adjusted_dst_ptr = 
-    (char*)dst_ptr +
-    dst_origin[0] + dst_row_pitch * dst_origin[1] + dst_slice_pitch * dst_origin[2];
-  
-  size_t j, k;
-
-  /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_dst_ptr + dst_row_pitch * j + dst_slice_pitch * k,
-              adjusted_src_ptr + src_row_pitch * j + src_slice_pitch * k,
-              region[0]);
+  bulk_copy_rect (NULL, dst_ptr, src_ptr, dst_origin, src_origin, region,
+                  dst_row_pitch, dst_slice_pitch,
+                  src_row_pitch, src_slice_pitch);
 }
 
 void
@@ -593,22 +605,9 @@ pocl_basic_write_rect (void *data,
                        size_t const host_row_pitch,
                        size_t const host_slice_pitch)
 {
-  char *__restrict const adjusted_device_ptr = 
-    (char*)device_ptr +
-    buffer_origin[0] + buffer_row_pitch * buffer_origin[1] + buffer_slice_pitch * buffer_origin[2];
-  char const *__restrict__ const adjusted_host_ptr = 
-    (char const*)host_ptr +
-    host_origin[0] + host_row_pitch * host_origin[1] + host_slice_pitch * host_origin[2];
-  
-  size_t j, k;
-
-  /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_device_ptr + buffer_row_pitch * j + buffer_slice_pitch * k,
-              adjusted_host_ptr + host_row_pitch * j + host_slice_pitch * k,
-              region[0]);
+  bulk_copy_rect (NULL, device_ptr, host_ptr, buffer_origin, host_origin,
+                  region, buffer_row_pitch, buffer_slice_pitch,
+                  host_row_pitch, host_slice_pitch);
 }
 
 void
@@ -623,22 +622,9 @@ pocl_basic_read_rect (void *data,
                       size_t const host_row_pitch,
                       size_t const host_slice_pitch)
 {
-  char const *__restrict const adjusted_device_ptr = 
-    (char const*)device_ptr +
-    buffer_origin[0] + buffer_row_pitch * (buffer_origin[1] + buffer_slice_pitch * buffer_origin[2]);
-  char *__restrict__ const adjusted_host_ptr = 
-    (char*)host_ptr +
-    host_origin[0] + host_row_pitch * (host_origin[1] + host_slice_pitch * host_origin[2]);
-  
-  size_t j, k;
-  
-  /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_host_ptr + host_row_pitch * j + host_slice_pitch * k,
-              adjusted_device_ptr + buffer_row_pitch * j + buffer_slice_pitch * k,
-              region[0]);
+  bulk_copy_rect (NULL, host_ptr, device_ptr, host_origin, buffer_origin,
+                  region, host_row_pitch, host_slice_pitch,
+                  buffer_row_pitch, buffer_slice_pitch);
 }
 
 /* origin and region must be in original shape unlike in copy/read/write_rect()
@@ -653,19 +639,19 @@ pocl_basic_fill_rect (void *data,
                       void *fill_pixel,
                       size_t pixel_size)                    
 {
-  char *__restrict const adjusted_device_ptr = (char*)device_ptr 
-    + buffer_origin[0] * pixel_size 
-    + buffer_row_pitch * buffer_origin[1] 
-    + buffer_slice_pitch * buffer_origin[2];
-    
-  size_t i, j, k;
+  size_t origin[3] = { buffer_origin[0] * pixel_size, buffer_origin[1],
+                       buffer_origin[2] };
+  size_t bytes[3] = { region[0] * pixel_size, region[1], region[2] };
 
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      for (i = 0; i < region[0]; ++i)
-        memcpy (adjusted_device_ptr + pixel_size * i 
-                + buffer_row_pitch * j 
-                + buffer_slice_pitch * k, fill_pixel, pixel_size);
+  bulk_fill_rect (NULL, device_ptr, origin, bytes, buffer_row_pitch,
+                  buffer_slice_pitch, fill_pixel, pixel_size);
+}
+
+void
+pocl_basic_fill (void *data, void *device_ptr, size_t size,
+                 const void *pattern, size_t pattern_size)
+{
+  bulk_fill (NULL, device_ptr, size, pattern, pattern_size);
 }
 
 void *
@@ -709,61 +695,322 @@ pocl_basic_get_supported_image_formats (cl_mem_flags flags,
     return CL_SUCCESS; 
 }
 
+/* The work-group functions loaded by all the devices sharing this
+   code, in a hash table. The key is the identity of the program, the
+   kernel name, the device and the local size. The lookups only take
+   the read lock. The first thread missing a function adds an entry for
+   it and compiles it without holding any lock, so different functions
+   compile in parallel. The threads needing the same function meanwhile
+   wait for its entry to become ready. */
 typedef struct compiler_cache_item compiler_cache_item;
 struct compiler_cache_item
 {
-  char *tmp_dir;
+  unsigned long program_id;
+  cl_device_id device;
+  size_t local_x;
+  size_t local_y;
+  size_t local_z;
+  unsigned hash;
   char *function_name;
   pocl_workgroup wg;
+  pocl_workgroup_range wg_range;
+  size_t context_scratch_size;
+  /* Zero while the function is being compiled by the thread that
+     added the entry. */
+  volatile int ready;
   compiler_cache_item *next;
 };
 
-static compiler_cache_item *compiler_cache;
-static pocl_lock_t compiler_cache_lock;
+#define COMPILER_CACHE_INITIAL_BUCKETS 64
 
-void check_compiler_cache (_cl_command_node *cmd)
+typedef struct compiler_cache
 {
-  char workgroup_string[WORKGROUP_STRING_LENGTH];
-  lt_dlhandle dlhandle;
-  compiler_cache_item *ci = NULL;
-  
-  //if (compiler_cache == NULL)
-    //POCL_INIT_LOCK (compiler_cache_lock);
+  pthread_rwlock_t lock;
+  compiler_cache_item **buckets;
+  unsigned num_buckets;
+  unsigned num_items;
+  unsigned long hits;
+  unsigned long misses;
+} compiler_cache;
+
+static compiler_cache cache = { PTHREAD_RWLOCK_INITIALIZER };
+/* Signaled when a function being compiled becomes ready. */
+static pocl_lock_t compiled_lock = POCL_LOCK_INITIALIZER;
+static pthread_cond_t compiled = PTHREAD_COND_INITIALIZER;
+static pthread_once_t cache_stats_once = PTHREAD_ONCE_INIT;
+
+static unsigned
+compiler_cache_hash (unsigned long program_id, cl_device_id device,
+                     size_t local_x, size_t local_y, size_t local_z,
+                     const char *function_name)
+{
+  /* FNV-1a over the name, mixed with the numeric part of the key. */
+  unsigned h = 2166136261u;
+  for (; *function_name; ++function_name)
+    h = (h ^ (unsigned char)*function_name) * 16777619u;
+  h = h * 31 + (unsigned)program_id;
+  h = h * 31 + (unsigned)((uintptr_t)device >> 4);
+  h = h * 31 + (unsigned)local_x;
+  h = h * 31 + (unsigned)local_y;
+  h = h * 31 + (unsigned)local_z;
+  return h ^ (h >> 16);
+}
 
-  //POCL_LOCK (compiler_cache_lock);
-  LL_FOREACH (compiler_cache, ci)
+/* Returns the local size the work-group function of the command is
+   generated for: zero for the function reading it at run time. */
+static void
+command_wg_local_size (const _cl_command_run *run, size_t local[3])
+{
+  if (run->dynamic_local_size)
     {
-      if (strcmp (ci->tmp_dir, cmd->command.run.tmp_dir) == 0 &&
-          strcmp (ci->function_name, 
-                  cmd->command.run.kernel->function_name) == 0)
+      local[0] = local[1] = local[2] = 0;
+    }
+  else
+    {
+      local[0] = run->local_x;
+      local[1] = run->local_y;
+      local[2] = run->local_z;
+    }
+}
+
+/* Must be called with the cache lock held, for reading at least. */
+static compiler_cache_item *
+compiler_cache_find (unsigned hash, _cl_command_node *cmd,
+                     const size_t local[3])
+{
+  compiler_cache_item *ci;
+  _cl_command_run *run = &cmd->command.run;
+
+  if (cache.num_buckets == 0)
+    return NULL;
+
+  for (ci = cache.buckets[hash % cache.num_buckets]; ci != NULL; ci = ci->next)
+    {
+      if (ci->hash == hash && 
+          ci->program_id == run->kernel->program->id &&
+          ci->device == cmd->device &&
+          ci->local_x == local[0] && ci->local_y == local[1] &&
+          ci->local_z == local[2] &&
+          strcmp (ci->function_name, run->kernel->function_name) == 0)
+        return ci;
+    }
+  return NULL;
+}
+
+/* Must be called with the cache lock held for writing. */
+static void
+compiler_cache_insert (compiler_cache_item *item)
+{
+  compiler_cache_item **buckets, *ci, *next;
+  unsigned num_buckets, i;
+
+  if (cache.num_items >= 2 * cache.num_buckets)
+    {
+      num_buckets = cache.num_buckets == 0 ? 
+        COMPILER_CACHE_INITIAL_BUCKETS : 2 * cache.num_buckets;
+      buckets = (compiler_cache_item**) 
+        calloc (num_buckets, sizeof (compiler_cache_item*));
+      if (buckets != NULL)
         {
-          //POCL_UNLOCK (compiler_cache_lock);
-          cmd->command.run.wg = ci->wg;
-          return;
+          for (i = 0; i < cache.num_buckets; ++i)
+            for (ci = cache.buckets[i]; ci != NULL; ci = next)
+              {
+                next = ci->next;
+                ci->next = buckets[ci->hash % num_buckets];
+                buckets[ci->hash % num_buckets] = ci;
+              }
+          free (cache.buckets);
+          cache.buckets = buckets;
+          cache.num_buckets = num_buckets;
         }
+      else if (cache.num_buckets == 0)
+        return;
     }
+
+  item->next = cache.buckets[item->hash % cache.num_buckets];
+  cache.buckets[item->hash % cache.num_buckets] = item;
+  ++cache.num_items;
+}
+
+void
+pocl_basic_compiler_cache_stats (unsigned long *hits, unsigned long *misses,
+                                 unsigned *entries)
+{
+  pthread_rwlock_rdlock (&cache.lock);
+  *hits = cache.hits;
+  *misses = cache.misses;
+  *entries = cache.num_items;
+  pthread_rwlock_unlock (&cache.lock);
+}
+
+static void
+print_compiler_cache_stats (void)
+{
+  unsigned long hits, misses;
+  unsigned entries;
+
+  pocl_basic_compiler_cache_stats (&hits, &misses, &entries);
+  fprintf (stderr, "pocl: work-group function cache: %lu hits, %lu misses, "
+           "%u entries\n", hits, misses, entries);
+}
+
+static void
+register_compiler_cache_stats (void)
+{
+  if (pocl_get_bool_option ("POCL_DEBUG", 0))
+    atexit (print_compiler_cache_stats);
+}
+
+void
+pocl_basic_free_program (cl_device_id device, cl_program program)
+{
+  compiler_cache_item **cip, *ci;
+  unsigned i;
+
+  pthread_rwlock_wrlock (&cache.lock);
+  for (i = 0; i < cache.num_buckets; ++i)
+    {
+      cip = &cache.buckets[i];
+      while (*cip != NULL)
+        {
+          ci = *cip;
+          if (ci->program_id == program->id && ci->device == device)
+            {
+              *cip = ci->next;
+              --cache.num_items;
+              free (ci->function_name);
+              free (ci);
+            }
+          else
+            cip = &ci->next;
+        }
+    }
+  pthread_rwlock_unlock (&cache.lock);
+}
+
+/* Returns a new cache entry for the work-group function of the command,
+   not ready yet, or NULL if there is no memory for it. */
+static compiler_cache_item *
+new_compiler_cache_item (unsigned hash, _cl_command_node *cmd,
+                         const size_t local[3])
+{
+  compiler_cache_item *ci;
+  _cl_command_run *run = &cmd->command.run;
+
   ci = malloc (sizeof (compiler_cache_item));
-  ci->next = NULL;
-  ci->tmp_dir = strdup(cmd->command.run.tmp_dir);
-  ci->function_name = strdup (cmd->command.run.kernel->function_name);
-  const char* module_fn = llvm_codegen (cmd->command.run.tmp_dir);
-  dlhandle = lt_dlopen (module_fn);     
-  if (dlhandle == NULL)
+  if (ci == NULL)
+    return NULL;
+  ci->function_name = strdup (run->kernel->function_name);
+  if (ci->function_name == NULL)
     {
-      printf ("pocl error: lt_dlopen(\"%s\") failed with '%s'.\n", 
-              module_fn, lt_dlerror());
-      printf ("note: missing symbols in the kernel binary might be" 
-              "reported as 'file not found' errors.\n");
-      abort();
+      free (ci);
+      return NULL;
     }
-  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
-            "_%s_workgroup", cmd->command.run.kernel->function_name);
-  cmd->command.run.wg = ci->wg = 
-    (pocl_workgroup) lt_dlsym (dlhandle, workgroup_string);
+  ci->next = NULL;
+  ci->hash = hash;
+  ci->program_id = run->kernel->program->id;
+  ci->device = cmd->device;
+  ci->local_x = local[0];
+  ci->local_y = local[1];
+  ci->local_z = local[2];
+  ci->wg = NULL;
+  ci->ready = 0;
+  return ci;
+}
+
+static int
+compiler_cache_item_ready (compiler_cache_item *ci)
+{
+  int ready = ci->ready;
+  /* The fields of the entry are read only after seeing it ready. */
+  __sync_synchronize ();
+  return ready;
+}
+
+static void
+check_compiler_cache (_cl_command_node *cmd)
+{
+  compiler_cache_item *ci;
+  _cl_command_run *run = &cmd->command.run;
+  size_t local[3];
+  unsigned hash;
+  int compile = 0;
+
+  /* Found from the kernel's own cache at enqueue. */
+  if (run->wg != NULL)
+    return;
+
+  command_wg_local_size (run, local);
+  hash = compiler_cache_hash (run->kernel->program->id, cmd->device,
+                              local[0], local[1], local[2],
+                              run->kernel->function_name);
 
-  LL_APPEND (compiler_cache, ci);
-  //POCL_UNLOCK (compiler_cache_lock);
+  pthread_rwlock_rdlock (&cache.lock);
+  ci = compiler_cache_find (hash, cmd, local);
+  pthread_rwlock_unlock (&cache.lock);
 
+  if (ci == NULL)
+    {
+      /* Add the entry to compile, unless another thread added it while
+         we were waiting for the lock. */
+      pthread_once (&cache_stats_once, register_compiler_cache_stats);
+      pthread_rwlock_wrlock (&cache.lock);
+      ci = compiler_cache_find (hash, cmd, local);
+      if (ci == NULL)
+        {
+          ci = new_compiler_cache_item (hash, cmd, local);
+          if (ci != NULL)
+            {
+              compiler_cache_insert (ci);
+              ++cache.misses;
+              compile = 1;
+            }
+        }
+      pthread_rwlock_unlock (&cache.lock);
+    }
+
+  if (ci == NULL)
+    {
+      /* No memory for the cache entry, load the function uncached. */
+      run->wg = pocl_load_workgroup_function (cmd->device, run->kernel, 
+                                              local[0], local[1], local[2],
+                                              run->tmp_dir, &run->wg_range,
+                                              &run->context_scratch_size);
+    }
+  else
+    {
+      if (compile)
+        {
+          /* No lock is held, so the other functions compile meanwhile. */
+          ci->wg = pocl_load_workgroup_function (cmd->device, run->kernel, 
+                                                 local[0], local[1], local[2],
+                                                 run->tmp_dir, &ci->wg_range,
+                                                 &ci->context_scratch_size);
+          __sync_synchronize ();
+          POCL_LOCK (compiled_lock);
+          ci->ready = 1;
+          pthread_cond_broadcast (&compiled);
+          POCL_UNLOCK (compiled_lock);
+        }
+      else
+        {
+          __sync_fetch_and_add (&cache.hits, 1);
+          if (!compiler_cache_item_ready (ci))
+            {
+              /* Another thread is compiling the same function. */
+              POCL_LOCK (compiled_lock);
+              while (!ci->ready)
+                pthread_cond_wait (&compiled, &compiled_lock);
+              POCL_UNLOCK (compiled_lock);
+            }
+        }
+      run->wg = ci->wg;
+      run->wg_range = ci->wg_range;
+      run->context_scratch_size = ci->context_scratch_size;
+    }
+  pocl_kernel_add_wg (run->kernel, cmd->device, local[0], local[1], 
+                      local[2], run->tmp_dir, run->wg, run->wg_range,
+                      run->context_scratch_size);
 }
 
 void
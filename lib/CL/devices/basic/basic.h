@@ -45,4 +45,12 @@
 #include "prototypes.inc"
 GEN_PROTOTYPES (basic)
 
+/* Returns the number of lookups of the work-group function cache that
+   found a loaded function, the number of functions that had to be
+   generated and the number of functions in the cache. The cache is
+   shared by the devices using pocl_basic_compile_submitted_kernels. */
+void pocl_basic_compiler_cache_stats (unsigned long *hits, 
+                                      unsigned long *misses,
+                                      unsigned *entries);
+
 #endif /* POCL_BASIC_H */
@@ -0,0 +1,763 @@
+/* OpenCL runtime/device driver library: size-class buffer pool
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * This file implements the size-class buffer pool.
+ *
+ * The small buffers are rounded up to one of the size classes and
+ * allocated from slabs, which are split to buffers of a single class.
+ * The slabs are carved from slab regions aligned to their size, so the
+ * slab of a buffer is found without locking from a page map indexed by
+ * the address. Each thread caches the freed small buffers of each class
+ * and allocates from the cache first, so the short-lived buffers
+ * usually do not touch the lock of the pool at all.
+ *
+ * The large buffers are allocated from regions obtained from the system
+ * with the best-fit strategy. The free extents between the buffers are
+ * kept in a treap ordered by their size and the allocated ones in
+ * another ordered by their address, so both the allocation and the free
+ * are logarithmic in the number of extents. The neighbouring extents of
+ * a region are also linked in the address order, so a freed extent is
+ * merged with the free neighbours in constant time.
+ *
+ * @file bufpool.c
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bufpool.h"
+#include "pocl_cl.h"
+#include "utlist.h"
+
+/* The small buffers are allocated from slabs of this size (256 kB). */
+#define SLAB_SHIFT 18
+#define SLAB_SIZE ((size_t)1 << SLAB_SHIFT)
+
+/* The slabs are carved from regions of this size (4 MB) aligned to it. */
+#define SLAB_REGION_SHIFT 22
+#define SLAB_REGION_SIZE ((size_t)1 << SLAB_REGION_SHIFT)
+#define SLABS_IN_REGION (SLAB_REGION_SIZE / SLAB_SIZE)
+#define NO_CLASS 0xff
+
+/* The size classes in multiples of the alignment of the pool. Only the
+   classes fitting at least eight times into a slab are used. */
+static const unsigned size_class_units[] =
+  { 1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 256 };
+#define MAX_SIZE_CLASSES \
+  (sizeof (size_class_units) / sizeof (size_class_units[0]))
+
+/* The number of freed small buffers a thread caches per size class.
+   A full cache returns half of its buffers to the pool. */
+#define THREAD_CACHE_SIZE 32
+
+/* The page map covers the addresses of this many bits with a root
+   table of leaves of 1 << PAGEMAP_LEAF_BITS slab regions each. */
+#define PAGEMAP_ADDRESS_BITS (sizeof (void*) == 8 ? 48 : 32)
+#define PAGEMAP_LEAF_BITS 10
+#define PAGEMAP_ROOT_SIZE \
+  ((size_t)1 << (PAGEMAP_ADDRESS_BITS - SLAB_REGION_SHIFT - PAGEMAP_LEAF_BITS))
+
+/* Instead of allocating a region for a single large buffer, try to
+   allocate this many times the buffer size to serve the next buffers
+   from it. Falls back to the buffer size if that fails. */
+#define ALLOCATION_MULTIPLE 32
+
+/* To avoid hogging the memory with the larger buffers, limit the extra
+   allocation margin to this number of megabytes. */
+#define ADDITIONAL_ALLOCATION_MAX_MB 100
+
+typedef struct extent extent_t;
+typedef struct region region_t;
+typedef struct slab_region slab_region_t;
+typedef struct thread_cache thread_cache_t;
+
+/* A piece of a region, either a large buffer or free space. */
+struct extent
+{
+  size_t start;
+  size_t size;
+  int is_free;
+  region_t *region;
+  /* The neighbours in the region in the address order. */
+  extent_t *prev;
+  extent_t *next;
+  /* The links in the treap of the free or the allocated extents. */
+  extent_t *left;
+  extent_t *right;
+  unsigned priority;
+};
+
+/* A block of memory from the system for the large buffers. */
+struct region
+{
+  void *memory;
+  size_t size;
+  /* The extent at the start of the region. The merges keep it, so it
+     stays the first one. */
+  extent_t *first;
+  region_t *next;
+};
+
+/* A block of memory from the system for the slabs. */
+struct slab_region
+{
+  void *memory;
+  /* The size class of each slab, NO_CLASS if not carved yet. Written
+     before the buffers of the slab are handed out and never changed,
+     so bufpool_free can read it without the lock. */
+  unsigned char slab_class[SLABS_IN_REGION];
+  unsigned slabs_used;
+  slab_region_t *next;
+};
+
+struct thread_cache
+{
+  bufpool_t *pool;
+  unsigned count[MAX_SIZE_CLASSES];
+  void *buffers[MAX_SIZE_CLASSES][THREAD_CACHE_SIZE];
+  thread_cache_t *prev;
+  thread_cache_t *next;
+};
+
+struct bufpool
+{
+  pocl_lock_t lock;
+  size_t alignment;
+  unsigned num_classes;
+  size_t class_size[MAX_SIZE_CLASSES];
+  /* The free small buffers of each class not cached by any thread,
+     linked through their first word. */
+  void *small_free[MAX_SIZE_CLASSES];
+
+  region_t *regions;
+  extent_t *free_extents;      /* ordered by size, then address */
+  extent_t *allocated_extents; /* ordered by address */
+  unsigned random_state;
+
+  slab_region_t *slab_regions;
+  slab_region_t *current_slab_region;
+  slab_region_t ***pagemap;
+
+  pthread_key_t cache_key;
+  thread_cache_t *caches;
+
+  bufpool_stats_t stats;
+};
+
+/* Treaps of extents. The free extents are ordered by (size, start), the
+   allocated ones by start. */
+
+static int
+extent_before (const extent_t *a, const extent_t *b, int by_size)
+{
+  if (by_size && a->size != b->size)
+    return a->size < b->size;
+  return a->start < b->start;
+}
+
+static extent_t *
+treap_insert (extent_t *root, extent_t *e, int by_size)
+{
+  extent_t *child;
+  if (root == NULL)
+    {
+      e->left = e->right = NULL;
+      return e;
+    }
+  if (extent_before (e, root, by_size))
+    {
+      root->left = treap_insert (root->left, e, by_size);
+      if (root->left->priority > root->priority)
+        {
+          child = root->left;
+          root->left = child->right;
+          child->right = root;
+          return child;
+        }
+    }
+  else
+    {
+      root->right = treap_insert (root->right, e, by_size);
+      if (root->right->priority > root->priority)
+        {
+          child = root->right;
+          root->right = child->left;
+          child->left = root;
+          return child;
+        }
+    }
+  return root;
+}
+
+static extent_t *
+treap_merge (extent_t *a, extent_t *b)
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (a->priority > b->priority)
+    {
+      a->right = treap_merge (a->right, b);
+      return a;
+    }
+  b->left = treap_merge (a, b->left);
+  return b;
+}
+
+static extent_t *
+treap_remove (extent_t *root, extent_t *e, int by_size)
+{
+  assert (root != NULL);
+  if (root == e)
+    return treap_merge (e->left, e->right);
+  if (extent_before (e, root, by_size))
+    root->left = treap_remove (root->left, e, by_size);
+  else
+    root->right = treap_remove (root->right, e, by_size);
+  return root;
+}
+
+/* Returns the smallest free extent of at least size bytes. */
+static extent_t *
+find_best_fit (extent_t *root, size_t size)
+{
+  extent_t *best = NULL;
+  while (root != NULL)
+    {
+      if (root->size >= size)
+        {
+          best = root;
+          root = root->left;
+        }
+      else
+        root = root->right;
+    }
+  return best;
+}
+
+static extent_t *
+find_allocated (extent_t *root, size_t start)
+{
+  while (root != NULL && root->start != start)
+    root = start < root->start ? root->left : root->right;
+  return root;
+}
+
+/* All the following functions up to bufpool_create must be called with
+   the lock of the pool held. */
+
+static unsigned
+next_priority (bufpool_t *pool)
+{
+  /* xorshift32 */
+  unsigned x = pool->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  pool->random_state = x;
+  return x;
+}
+
+static void
+insert_free_extent (bufpool_t *pool, extent_t *e)
+{
+  e->is_free = 1;
+  e->priority = next_priority (pool);
+  pool->free_extents = treap_insert (pool->free_extents, e, 1);
+  pool->stats.free_extent_bytes += e->size;
+  ++pool->stats.free_extents;
+}
+
+static void
+remove_free_extent (bufpool_t *pool, extent_t *e)
+{
+  pool->free_extents = treap_remove (pool->free_extents, e, 1);
+  pool->stats.free_extent_bytes -= e->size;
+  --pool->stats.free_extents;
+}
+
+/* Adds a region for at least size bytes as one free extent. */
+static int
+add_region (bufpool_t *pool, size_t size)
+{
+  region_t *region;
+  extent_t *e;
+  void *memory = NULL;
+  /* Fall back to the minimum size in case of overflow. */
+  size_t region_size =
+    max (min (size + (size_t)ADDITIONAL_ALLOCATION_MAX_MB * 1024 * 1024,
+              size * ALLOCATION_MULTIPLE), size);
+
+  if (posix_memalign (&memory, pool->alignment, region_size) != 0)
+    {
+      region_size = size;
+      if (posix_memalign (&memory, pool->alignment, region_size) != 0)
+        return ENOMEM;
+    }
+
+  region = (region_t*) malloc (sizeof (region_t));
+  e = (extent_t*) malloc (sizeof (extent_t));
+  if (region == NULL || e == NULL)
+    {
+      free (region);
+      free (e);
+      free (memory);
+      return ENOMEM;
+    }
+  region->memory = memory;
+  region->size = region_size;
+  region->first = e;
+  region->next = pool->regions;
+  pool->regions = region;
+  pool->stats.reserved += region_size;
+
+  e->start = (size_t)memory;
+  e->size = region_size;
+  e->region = region;
+  e->prev = e->next = NULL;
+  insert_free_extent (pool, e);
+  return 0;
+}
+
+/* Returns a large buffer of the size, which must be a multiple of the
+   alignment. Stores the size of its extent to extent_size. */
+static void *
+alloc_large (bufpool_t *pool, size_t size, size_t *extent_size)
+{
+  extent_t *e, *rest;
+
+  e = find_best_fit (pool->free_extents, size);
+  if (e == NULL)
+    {
+      if (add_region (pool, size) != 0)
+        return NULL;
+      e = find_best_fit (pool->free_extents, size);
+      assert (e != NULL);
+    }
+  remove_free_extent (pool, e);
+
+  if (e->size > size)
+    {
+      rest = (extent_t*) malloc (sizeof (extent_t));
+      if (rest != NULL)
+        {
+          rest->start = e->start + size;
+          rest->size = e->size - size;
+          rest->region = e->region;
+          rest->prev = e;
+          rest->next = e->next;
+          if (e->next != NULL)
+            e->next->prev = rest;
+          e->next = rest;
+          e->size = size;
+          insert_free_extent (pool, rest);
+        }
+      /* else the whole extent is used for the buffer */
+    }
+
+  e->is_free = 0;
+  e->priority = next_priority (pool);
+  pool->allocated_extents = treap_insert (pool->allocated_extents, e, 0);
+  *extent_size = e->size;
+  return (void*)e->start;
+}
+
+static int
+free_large (bufpool_t *pool, size_t start, size_t *extent_size)
+{
+  extent_t *e, *n;
+
+  e = find_allocated (pool->allocated_extents, start);
+  if (e == NULL)
+    return EINVAL;
+  pool->allocated_extents = treap_remove (pool->allocated_extents, e, 0);
+  *extent_size = e->size;
+
+  if (e->prev != NULL && e->prev->is_free)
+    {
+      n = e;
+      e = e->prev;
+      remove_free_extent (pool, e);
+      e->size += n->size;
+      e->next = n->next;
+      if (n->next != NULL)
+        n->next->prev = e;
+      free (n);
+    }
+  if (e->next != NULL && e->next->is_free)
+    {
+      n = e->next;
+      remove_free_extent (pool, n);
+      e->size += n->size;
+      e->next = n->next;
+      if (n->next != NULL)
+        n->next->prev = e;
+      free (n);
+    }
+  insert_free_extent (pool, e);
+  return 0;
+}
+
+static slab_region_t *
+pagemap_lookup (bufpool_t *pool, size_t addr)
+{
+  size_t index = addr >> SLAB_REGION_SHIFT;
+  slab_region_t **leaf;
+
+  if ((index >> PAGEMAP_LEAF_BITS) >= PAGEMAP_ROOT_SIZE)
+    return NULL;
+  leaf = pool->pagemap[index >> PAGEMAP_LEAF_BITS];
+  if (leaf == NULL)
+    return NULL;
+  return leaf[index & ((1 << PAGEMAP_LEAF_BITS) - 1)];
+}
+
+static int
+pagemap_insert (bufpool_t *pool, slab_region_t *r)
+{
+  size_t index = (size_t)r->memory >> SLAB_REGION_SHIFT;
+  slab_region_t **leaf;
+
+  if ((index >> PAGEMAP_LEAF_BITS) >= PAGEMAP_ROOT_SIZE)
+    return EINVAL;
+  leaf = pool->pagemap[index >> PAGEMAP_LEAF_BITS];
+  if (leaf == NULL)
+    {
+      leaf = (slab_region_t**)
+        calloc ((size_t)1 << PAGEMAP_LEAF_BITS, sizeof (slab_region_t*));
+      if (leaf == NULL)
+        return ENOMEM;
+      /* The readers in bufpool_free must see the cleared leaf. */
+      __sync_synchronize ();
+      pool->pagemap[index >> PAGEMAP_LEAF_BITS] = leaf;
+    }
+  leaf[index & ((1 << PAGEMAP_LEAF_BITS) - 1)] = r;
+  return 0;
+}
+
+/* Splits a new slab to free buffers of the size class. */
+static int
+add_slab (bufpool_t *pool, unsigned c)
+{
+  slab_region_t *r = pool->current_slab_region;
+  size_t slab, size = pool->class_size[c];
+  char *buf;
+  void *memory = NULL;
+
+  if (r == NULL || r->slabs_used == SLABS_IN_REGION)
+    {
+      if (posix_memalign (&memory, SLAB_REGION_SIZE, SLAB_REGION_SIZE) != 0)
+        return ENOMEM;
+      r = (slab_region_t*) malloc (sizeof (slab_region_t));
+      if (r == NULL)
+        {
+          free (memory);
+          return ENOMEM;
+        }
+      r->memory = memory;
+      memset (r->slab_class, NO_CLASS, sizeof (r->slab_class));
+      r->slabs_used = 0;
+      if (pagemap_insert (pool, r) != 0)
+        {
+          free (memory);
+          free (r);
+          return ENOMEM;
+        }
+      r->next = pool->slab_regions;
+      pool->slab_regions = r;
+      pool->current_slab_region = r;
+      pool->stats.reserved += SLAB_REGION_SIZE;
+    }
+
+  slab = r->slabs_used++;
+  r->slab_class[slab] = c;
+  pool->stats.slab_bytes += SLAB_SIZE;
+
+  buf = (char*)r->memory + slab * SLAB_SIZE;
+  for (; buf + size <= (char*)r->memory + (slab + 1) * SLAB_SIZE; buf += size)
+    {
+      *(void**)buf = pool->small_free[c];
+      pool->small_free[c] = buf;
+    }
+  return 0;
+}
+
+/* Moves up to count free buffers of the class to the thread cache. */
+static void
+refill_cache (bufpool_t *pool, thread_cache_t *cache, unsigned c,
+              unsigned count)
+{
+  void *buf;
+  while (count-- > 0)
+    {
+      if (pool->small_free[c] == NULL && add_slab (pool, c) != 0)
+        return;
+      buf = pool->small_free[c];
+      pool->small_free[c] = *(void**)buf;
+      cache->buffers[c][cache->count[c]++] = buf;
+    }
+}
+
+/* Returns count of the cached buffers of the class to the pool. */
+static void
+flush_cache (bufpool_t *pool, thread_cache_t *cache, unsigned c,
+             unsigned count)
+{
+  void *buf;
+  while (count-- > 0 && cache->count[c] > 0)
+    {
+      buf = cache->buffers[c][--cache->count[c]];
+      *(void**)buf = pool->small_free[c];
+      pool->small_free[c] = buf;
+    }
+}
+
+static void
+free_thread_cache (void *data)
+{
+  thread_cache_t *cache = (thread_cache_t*)data;
+  bufpool_t *pool = cache->pool;
+  unsigned c;
+
+  POCL_LOCK (pool->lock);
+  for (c = 0; c < pool->num_classes; ++c)
+    flush_cache (pool, cache, c, THREAD_CACHE_SIZE);
+  DL_DELETE (pool->caches, cache);
+  POCL_UNLOCK (pool->lock);
+  free (cache);
+}
+
+static thread_cache_t *
+get_thread_cache (bufpool_t *pool)
+{
+  thread_cache_t *cache =
+    (thread_cache_t*) pthread_getspecific (pool->cache_key);
+  if (cache != NULL)
+    return cache;
+
+  cache = (thread_cache_t*) calloc (1, sizeof (thread_cache_t));
+  if (cache == NULL)
+    return NULL;
+  cache->pool = pool;
+  if (pthread_setspecific (pool->cache_key, cache) != 0)
+    {
+      free (cache);
+      return NULL;
+    }
+  POCL_LOCK (pool->lock);
+  DL_APPEND (pool->caches, cache);
+  POCL_UNLOCK (pool->lock);
+  return cache;
+}
+
+/* The usage counters are updated atomically, as the buffers cached by
+   the threads are allocated and freed without the lock. */
+static void
+count_allocation (bufpool_t *pool, size_t size)
+{
+  size_t in_use = __sync_add_and_fetch (&pool->stats.in_use, size);
+  size_t peak;
+  while (in_use > (peak = pool->stats.peak_in_use) &&
+         !__sync_bool_compare_and_swap (&pool->stats.peak_in_use, peak,
+                                        in_use))
+    ;
+  __sync_fetch_and_add (&pool->stats.allocations, 1);
+}
+
+static void
+count_free (bufpool_t *pool, size_t size)
+{
+  __sync_fetch_and_sub (&pool->stats.in_use, size);
+  __sync_fetch_and_add (&pool->stats.frees, 1);
+}
+
+bufpool_t *
+bufpool_create (size_t alignment)
+{
+  bufpool_t *pool;
+  unsigned c;
+
+  assert ((alignment & (alignment - 1)) == 0);
+  if (alignment < sizeof (void*))
+    alignment = sizeof (void*);
+
+  pool = (bufpool_t*) calloc (1, sizeof (bufpool_t));
+  if (pool == NULL)
+    return NULL;
+  pool->pagemap = (slab_region_t***)
+    calloc (PAGEMAP_ROOT_SIZE, sizeof (slab_region_t**));
+  if (pool->pagemap == NULL ||
+      pthread_key_create (&pool->cache_key, free_thread_cache) != 0)
+    {
+      free (pool->pagemap);
+      free (pool);
+      return NULL;
+    }
+  POCL_INIT_LOCK (pool->lock);
+  pool->alignment = alignment;
+  pool->random_state = 2463534242u;
+  for (c = 0; c < MAX_SIZE_CLASSES &&
+         size_class_units[c] * alignment * 8 <= SLAB_SIZE; ++c)
+    pool->class_size[c] = size_class_units[c] * alignment;
+  pool->num_classes = c;
+  return pool;
+}
+
+void
+bufpool_destroy (bufpool_t *pool)
+{
+  region_t *region;
+  slab_region_t *slab_region;
+  thread_cache_t *cache;
+  extent_t *e, *next;
+  size_t i;
+
+  /* The caches of the threads still running are freed here. */
+  pthread_key_delete (pool->cache_key);
+  while ((cache = pool->caches) != NULL)
+    {
+      DL_DELETE (pool->caches, cache);
+      free (cache);
+    }
+
+  while ((region = pool->regions) != NULL)
+    {
+      for (e = region->first; e != NULL; e = next)
+        {
+          next = e->next;
+          free (e);
+        }
+      pool->regions = region->next;
+      free (region->memory);
+      free (region);
+    }
+
+  while ((slab_region = pool->slab_regions) != NULL)
+    {
+      pool->slab_regions = slab_region->next;
+      free (slab_region->memory);
+      free (slab_region);
+    }
+  for (i = 0; i < PAGEMAP_ROOT_SIZE; ++i)
+    free (pool->pagemap[i]);
+  free (pool->pagemap);
+  free (pool);
+}
+
+void *
+bufpool_alloc (bufpool_t *pool, size_t size)
+{
+  thread_cache_t *cache;
+  unsigned c;
+  size_t extent_size;
+  void *buf = NULL;
+
+  for (c = 0; c < pool->num_classes && pool->class_size[c] < size; ++c)
+    ;
+  if (c < pool->num_classes && (cache = get_thread_cache (pool)) != NULL)
+    {
+      if (cache->count[c] == 0)
+        {
+          POCL_LOCK (pool->lock);
+          refill_cache (pool, cache, c, THREAD_CACHE_SIZE / 2);
+          POCL_UNLOCK (pool->lock);
+        }
+      if (cache->count[c] > 0)
+        {
+          buf = cache->buffers[c][--cache->count[c]];
+          count_allocation (pool, pool->class_size[c]);
+          return buf;
+        }
+      /* Out of memory for a new slab. Try a large buffer. */
+    }
+
+  if (size == 0)
+    size = 1;
+  size = (size + pool->alignment - 1) & ~(pool->alignment - 1);
+  POCL_LOCK (pool->lock);
+  buf = alloc_large (pool, size, &extent_size);
+  POCL_UNLOCK (pool->lock);
+  if (buf != NULL)
+    count_allocation (pool, extent_size);
+  return buf;
+}
+
+int
+bufpool_free (bufpool_t *pool, void *ptr)
+{
+  slab_region_t *r = pagemap_lookup (pool, (size_t)ptr);
+  thread_cache_t *cache;
+  unsigned c;
+  size_t extent_size;
+  int error;
+
+  if (r != NULL)
+    {
+      c = r->slab_class[((size_t)ptr - (size_t)r->memory) >> SLAB_SHIFT];
+      if (c == NO_CLASS)
+        return EINVAL;
+      count_free (pool, pool->class_size[c]);
+
+      cache = get_thread_cache (pool);
+      if (cache != NULL && cache->count[c] < THREAD_CACHE_SIZE)
+        {
+          cache->buffers[c][cache->count[c]++] = ptr;
+          return 0;
+        }
+      POCL_LOCK (pool->lock);
+      if (cache != NULL)
+        {
+          flush_cache (pool, cache, c, THREAD_CACHE_SIZE / 2);
+          cache->buffers[c][cache->count[c]++] = ptr;
+        }
+      else
+        {
+          *(void**)ptr = pool->small_free[c];
+          pool->small_free[c] = ptr;
+        }
+      POCL_UNLOCK (pool->lock);
+      return 0;
+    }
+
+  POCL_LOCK (pool->lock);
+  error = free_large (pool, (size_t)ptr, &extent_size);
+  POCL_UNLOCK (pool->lock);
+  if (error == 0)
+    count_free (pool, extent_size);
+  return error;
+}
+
+void
+bufpool_get_stats (bufpool_t *pool, bufpool_stats_t *stats)
+{
+  extent_t *e;
+
+  POCL_LOCK (pool->lock);
+  *stats = pool->stats;
+  stats->largest_free_extent = 0;
+  for (e = pool->free_extents; e != NULL; e = e->right)
+    stats->largest_free_extent = e->size;
+  POCL_UNLOCK (pool->lock);
+}
@@ -0,0 +1,86 @@
+/* OpenCL runtime/device driver library: size-class buffer pool
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * A thread-safe allocator for the OpenCL buffers in the host memory.
+ *
+ * Unlike bufalloc, which manages the memory of external devices with
+ * a fixed number of chunks per region, the pool has no limit on the
+ * number of buffers and finds the space for them in logarithmic time.
+ *
+ * @see bufpool.c
+ * @file bufpool.h
+ */
+
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct bufpool bufpool_t;
+
+/* The usage statistics of a pool. The fragmentation of the free space
+   of the large buffers is 1 - largest_free_extent / free_extent_bytes. */
+typedef struct bufpool_stats
+{
+  size_t reserved;            /* bytes allocated from the system */
+  size_t in_use;              /* bytes in the allocated buffers, rounded up
+                                 to the size class or the alignment */
+  size_t peak_in_use;         /* the maximum of in_use */
+  size_t slab_bytes;          /* bytes reserved for the small buffers */
+  size_t free_extent_bytes;   /* free bytes between the large buffers */
+  size_t free_extents;        /* the number of free extents */
+  size_t largest_free_extent; /* the largest buffer allocable without
+                                 reserving more memory */
+  unsigned long allocations;
+  unsigned long frees;
+} bufpool_stats_t;
+
+#pragma GCC visibility push(hidden)
+
+/* Creates a pool returning buffers aligned to the alignment, which must
+   be a power of two. Returns NULL if out of memory. */
+bufpool_t *bufpool_create (size_t alignment);
+
+/* Releases all the memory of the pool, including the buffers not freed. */
+void bufpool_destroy (bufpool_t *pool);
+
+/* Returns a buffer of at least size bytes, or NULL if out of memory. */
+void *bufpool_alloc (bufpool_t *pool, size_t size);
+
+/* Returns the buffer to the pool. Returns non-zero if the buffer was
+   not allocated from the pool. */
+int bufpool_free (bufpool_t *pool, void *ptr);
+
+void bufpool_get_stats (bufpool_t *pool, bufpool_stats_t *stats);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,451 @@
+/* OpenCL runtime/device driver library: bulk copies and fills of the
+   host memory
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+#include "pocl_cl.h"
+#include "bulkcopy.h"
+#include "topology/pocl_topology.h"
+
+/* The transfers are split into parts of about this many bytes. */
+#define PART_SIZE ((size_t)1024 * 1024)
+
+/* The smaller transfers are not worth waking up the other threads for. */
+#define PARALLEL_MIN_SIZE (4 * PART_SIZE)
+
+/* Used as the size of the last level cache if it is unknown. */
+#define DEFAULT_LLC_SIZE ((size_t)8 * 1024 * 1024)
+
+#define VECTOR_SIZE 16
+
+/* The longest fill pattern stored with vectors. The longer ones are
+   stored with memcpy. */
+#define MAX_VECTOR_PATTERN 128
+
+/* The bytes copied at a time when the fill pattern is replicated with
+   memcpy. Small enough for the source to stay in the cache. */
+#define REPLICATE_SIZE ((size_t)64 * 1024)
+
+static size_t streaming_threshold;
+static pthread_once_t streaming_threshold_once = PTHREAD_ONCE_INIT;
+
+static void
+init_streaming_threshold (void)
+{
+  size_t llc_size = pocl_topology_llc_size ();
+  streaming_threshold = llc_size > 0 ? llc_size : DEFAULT_LLC_SIZE;
+}
+
+/* Returns non-zero if a transfer of size bytes should bypass the caches,
+   as it would evict them anyway. */
+static int
+use_streaming (size_t size)
+{
+  pthread_once (&streaming_threshold_once, init_streaming_threshold);
+  return size > streaming_threshold;
+}
+
+static int
+overlap (const char *a, size_t a_size, const char *b, size_t b_size)
+{
+  return a < b + b_size && b < a + a_size;
+}
+
+static void
+copy_bytes (char *dst, const char *src, size_t size, int streaming)
+{
+#ifdef __SSE2__
+  if (streaming && size >= 4 * VECTOR_SIZE)
+    {
+      size_t head = -(uintptr_t)dst & (VECTOR_SIZE - 1);
+      memcpy (dst, src, head);
+      dst += head;
+      src += head;
+      size -= head;
+
+      for (; size >= 4 * VECTOR_SIZE; size -= 4 * VECTOR_SIZE)
+        {
+          __m128i a = _mm_loadu_si128 ((const __m128i*)src);
+          __m128i b = _mm_loadu_si128 ((const __m128i*)src + 1);
+          __m128i c = _mm_loadu_si128 ((const __m128i*)src + 2);
+          __m128i d = _mm_loadu_si128 ((const __m128i*)src + 3);
+          _mm_stream_si128 ((__m128i*)dst, a);
+          _mm_stream_si128 ((__m128i*)dst + 1, b);
+          _mm_stream_si128 ((__m128i*)dst + 2, c);
+          _mm_stream_si128 ((__m128i*)dst + 3, d);
+          dst += 4 * VECTOR_SIZE;
+          src += 4 * VECTOR_SIZE;
+        }
+      memcpy (dst, src, size);
+      /* The streaming stores are weakly ordered. */
+      _mm_sfence ();
+      return;
+    }
+#endif
+  memcpy (dst, src, size);
+}
+
+/* Fills size bytes at dst with the pattern repeated, starting from the
+   beginning of the pattern. */
+static void
+fill_bytes (char *dst, size_t size, const char *pattern, size_t pattern_size,
+            int streaming)
+{
+  size_t done, limit;
+
+#ifdef __SSE2__
+  if (pattern_size <= MAX_VECTOR_PATTERN && size >= 4 * VECTOR_SIZE)
+    {
+      /* The pattern repeats in the vectors after period bytes, the least
+         common multiple of the pattern and the vector sizes. block holds
+         the pattern repeated, so that the vector for any position can be
+         loaded from it. */
+      char block[MAX_VECTOR_PATTERN * VECTOR_SIZE + VECTOR_SIZE
+                 + MAX_VECTOR_PATTERN];
+      __m128i vectors[MAX_VECTOR_PATTERN];
+      size_t period = pattern_size;
+      size_t head = -(uintptr_t)dst & (VECTOR_SIZE - 1);
+      size_t i, v, num_vectors;
+
+      while (period % VECTOR_SIZE != 0)
+        period += pattern_size;
+      for (i = 0; i < period + VECTOR_SIZE; i += pattern_size)
+        memcpy (block + i, pattern, pattern_size);
+
+      num_vectors = period / VECTOR_SIZE;
+      for (v = 0; v < num_vectors; ++v)
+        vectors[v] = _mm_loadu_si128
+          ((const __m128i*)(block + (head + v * VECTOR_SIZE) % period));
+
+      memcpy (dst, block, head);
+      i = head;
+      if (num_vectors == 1 && streaming)
+        for (; i + VECTOR_SIZE <= size; i += VECTOR_SIZE)
+          _mm_stream_si128 ((__m128i*)(dst + i), vectors[0]);
+      else if (num_vectors == 1)
+        for (; i + VECTOR_SIZE <= size; i += VECTOR_SIZE)
+          _mm_store_si128 ((__m128i*)(dst + i), vectors[0]);
+      else
+        for (v = 0; i + VECTOR_SIZE <= size; i += VECTOR_SIZE)
+          {
+            if (streaming)
+              _mm_stream_si128 ((__m128i*)(dst + i), vectors[v]);
+            else
+              _mm_store_si128 ((__m128i*)(dst + i), vectors[v]);
+            if (++v == num_vectors)
+              v = 0;
+          }
+      memcpy (dst + i, block + i % period, size - i);
+      if (streaming)
+        _mm_sfence ();
+      return;
+    }
+#endif
+
+  /* Double the filled area until the source would not fit in the cache.
+     The copies start at multiples of the pattern size. */
+  done = min (pattern_size, size);
+  memcpy (dst, pattern, done);
+  limit = max (REPLICATE_SIZE - REPLICATE_SIZE % pattern_size, pattern_size);
+  while (done < size)
+    {
+      size_t chunk = min (min (done, limit), size - done);
+      memcpy (dst + done, dst, chunk);
+      done += chunk;
+    }
+}
+
+typedef struct bulk_transfer
+{
+  char *dst;
+  const char *src;
+  const char *pattern;
+  size_t pattern_size;
+  /* The bytes in a linear transfer or in a row of a rectangle. */
+  size_t size;
+  /* The bytes of a linear transfer or the rows of a rectangle in each
+     part. */
+  size_t part_size;
+  size_t num_rows;
+  size_t rows_per_slice;
+  size_t dst_row_pitch, dst_slice_pitch;
+  size_t src_row_pitch, src_slice_pitch;
+  int streaming;
+} bulk_transfer;
+
+static size_t
+row_offset (size_t row, size_t rows_per_slice, size_t row_pitch,
+            size_t slice_pitch)
+{
+  return (row % rows_per_slice) * row_pitch
+    + (row / rows_per_slice) * slice_pitch;
+}
+
+/* The bytes from the first to the last byte of a rectangle. */
+static size_t
+rect_extent (const size_t *region, size_t row_pitch, size_t slice_pitch)
+{
+  return (region[2] - 1) * slice_pitch + (region[1] - 1) * row_pitch
+    + region[0];
+}
+
+static void
+copy_parts (void *transfer, size_t first, size_t last)
+{
+  bulk_transfer *t = (bulk_transfer*)transfer;
+  size_t begin = first * t->part_size;
+  size_t end = min ((last + 1) * t->part_size, t->size);
+  copy_bytes (t->dst + begin, t->src + begin, end - begin, t->streaming);
+}
+
+static void
+fill_parts (void *transfer, size_t first, size_t last)
+{
+  bulk_transfer *t = (bulk_transfer*)transfer;
+  size_t begin = first * t->part_size;
+  size_t end = min ((last + 1) * t->part_size, t->size);
+  fill_bytes (t->dst + begin, end - begin, t->pattern, t->pattern_size,
+              t->streaming);
+}
+
+static void
+copy_rows (void *transfer, size_t first, size_t last)
+{
+  bulk_transfer *t = (bulk_transfer*)transfer;
+  size_t row = first * t->part_size;
+  size_t end = min ((last + 1) * t->part_size, t->num_rows);
+  for (; row < end; ++row)
+    copy_bytes (t->dst + row_offset (row, t->rows_per_slice,
+                                     t->dst_row_pitch, t->dst_slice_pitch),
+                t->src + row_offset (row, t->rows_per_slice,
+                                     t->src_row_pitch, t->src_slice_pitch),
+                t->size, t->streaming);
+}
+
+static void
+fill_rows (void *transfer, size_t first, size_t last)
+{
+  bulk_transfer *t = (bulk_transfer*)transfer;
+  size_t row = first * t->part_size;
+  size_t end = min ((last + 1) * t->part_size, t->num_rows);
+  for (; row < end; ++row)
+    fill_bytes (t->dst + row_offset (row, t->rows_per_slice,
+                                     t->dst_row_pitch, t->dst_slice_pitch),
+                t->size, t->pattern, t->pattern_size, t->streaming);
+}
+
+/* Executes the parts of the transfer with run, or in the calling thread
+   if it is NULL or the transfer is small. */
+static void
+run_parts (bulk_run_fn run, bulk_part_fn fn, bulk_transfer *t,
+           size_t num_parts, size_t total_size)
+{
+  if (run == NULL || num_parts < 2 || total_size < PARALLEL_MIN_SIZE)
+    fn (t, 0, num_parts - 1);
+  else
+    run (fn, t, num_parts);
+}
+
+void
+bulk_copy (bulk_run_fn run, void *dst, const void *src, size_t size)
+{
+  bulk_transfer t;
+
+  if (dst == src || size == 0)
+    return;
+
+  /* The overlapping copies are not split, as the parts would read the
+     areas written by the others. */
+  if (overlap ((char*)dst, size, (const char*)src, size))
+    {
+      memmove (dst, src, size);
+      return;
+    }
+
+  t.dst = (char*)dst;
+  t.src = (const char*)src;
+  t.size = size;
+  t.part_size = PART_SIZE;
+  t.streaming = use_streaming (size);
+  run_parts (run, copy_parts, &t, (size + PART_SIZE - 1) / PART_SIZE, size);
+}
+
+/* Copies a rectangle overlapping its source in the calling thread. */
+static void
+copy_rect_overlapping (bulk_transfer *t)
+{
+  size_t row;
+  char *tmp, *p;
+
+  if (t->dst_row_pitch == t->src_row_pitch &&
+      t->dst_slice_pitch == t->src_slice_pitch)
+    {
+      /* All the rows move by the same distance, so copying them in the
+         direction of the move never overwrites a row not yet copied. */
+      if (t->dst > t->src)
+        for (row = t->num_rows; row-- > 0;)
+          memmove (t->dst + row_offset (row, t->rows_per_slice,
+                                        t->dst_row_pitch, t->dst_slice_pitch),
+                   t->src + row_offset (row, t->rows_per_slice,
+                                        t->src_row_pitch, t->src_slice_pitch),
+                   t->size);
+      else
+        for (row = 0; row < t->num_rows; ++row)
+          memmove (t->dst + row_offset (row, t->rows_per_slice,
+                                        t->dst_row_pitch, t->dst_slice_pitch),
+                   t->src + row_offset (row, t->rows_per_slice,
+                                        t->src_row_pitch, t->src_slice_pitch),
+                   t->size);
+      return;
+    }
+
+  /* The rows of different shapes can overlap in any order, so copy the
+     source aside first. */
+  tmp = (char*)malloc (t->size * t->num_rows);
+  if (tmp == NULL)
+    POCL_ABORT ("Out of memory in an overlapping rectangle copy.\n");
+  for (row = 0, p = tmp; row < t->num_rows; ++row, p += t->size)
+    memcpy (p, t->src + row_offset (row, t->rows_per_slice,
+                                    t->src_row_pitch, t->src_slice_pitch),
+            t->size);
+  for (row = 0, p = tmp; row < t->num_rows; ++row, p += t->size)
+    memcpy (t->dst + row_offset (row, t->rows_per_slice,
+                                 t->dst_row_pitch, t->dst_slice_pitch),
+            p, t->size);
+  free (tmp);
+}
+
+void
+bulk_copy_rect (bulk_run_fn run,
+                void *dst, const void *src,
+                const size_t *dst_origin,
+                const size_t *src_origin,
+                const size_t *region,
+                size_t dst_row_pitch, size_t dst_slice_pitch,
+                size_t src_row_pitch, size_t src_slice_pitch)
+{
+  bulk_transfer t;
+  size_t num_parts;
+
+  if (region[0] == 0 || region[1] == 0 || region[2] == 0)
+    return;
+
+  t.dst = (char*)dst + dst_origin[0] + dst_row_pitch * dst_origin[1]
+    + dst_slice_pitch * dst_origin[2];
+  t.src = (const char*)src + src_origin[0] + src_row_pitch * src_origin[1]
+    + src_slice_pitch * src_origin[2];
+  t.size = region[0];
+  t.num_rows = region[1] * region[2];
+  t.rows_per_slice = region[1];
+  t.dst_row_pitch = dst_row_pitch;
+  t.dst_slice_pitch = dst_slice_pitch;
+  t.src_row_pitch = src_row_pitch;
+  t.src_slice_pitch = src_slice_pitch;
+
+  if (t.dst == t.src && dst_row_pitch == src_row_pitch &&
+      dst_slice_pitch == src_slice_pitch)
+    return;
+
+  /* Both rectangles without gaps between the rows. */
+  if (dst_row_pitch == region[0] && src_row_pitch == region[0] &&
+      (region[2] == 1 || (dst_slice_pitch == region[0] * region[1] &&
+                          src_slice_pitch == region[0] * region[1])))
+    {
+      bulk_copy (run, t.dst, t.src, region[0] * t.num_rows);
+      return;
+    }
+
+  if (overlap (t.dst, rect_extent (region, dst_row_pitch, dst_slice_pitch),
+               t.src, rect_extent (region, src_row_pitch, src_slice_pitch)))
+    {
+      copy_rect_overlapping (&t);
+      return;
+    }
+
+  t.part_size = max (PART_SIZE / region[0], 1);
+  t.streaming = use_streaming (region[0] * t.num_rows);
+  num_parts = (t.num_rows + t.part_size - 1) / t.part_size;
+  run_parts (run, copy_rows, &t, num_parts, region[0] * t.num_rows);
+}
+
+void
+bulk_fill (bulk_run_fn run, void *dst, size_t size,
+           const void *pattern, size_t pattern_size)
+{
+  bulk_transfer t;
+
+  if (size == 0)
+    return;
+
+  t.dst = (char*)dst;
+  t.pattern = (const char*)pattern;
+  t.pattern_size = pattern_size;
+  t.size = size;
+  /* The parts start at the beginning of the pattern. */
+  t.part_size = max (PART_SIZE - PART_SIZE % pattern_size, pattern_size);
+  t.streaming = use_streaming (size);
+  run_parts (run, fill_parts, &t, (size + t.part_size - 1) / t.part_size,
+             size);
+}
+
+void
+bulk_fill_rect (bulk_run_fn run, void *dst,
+                const size_t *origin, const size_t *region,
+                size_t row_pitch, size_t slice_pitch,
+                const void *pattern, size_t pattern_size)
+{
+  bulk_transfer t;
+  size_t num_parts;
+
+  if (region[0] == 0 || region[1] == 0 || region[2] == 0)
+    return;
+
+  t.dst = (char*)dst + origin[0] + row_pitch * origin[1]
+    + slice_pitch * origin[2];
+  t.num_rows = region[1] * region[2];
+
+  if (row_pitch == region[0] &&
+      (region[2] == 1 || slice_pitch == region[0] * region[1]))
+    {
+      bulk_fill (run, t.dst, region[0] * t.num_rows, pattern, pattern_size);
+      return;
+    }
+
+  t.pattern = (const char*)pattern;
+  t.pattern_size = pattern_size;
+  t.size = region[0];
+  t.rows_per_slice = region[1];
+  t.dst_row_pitch = row_pitch;
+  t.dst_slice_pitch = slice_pitch;
+  t.part_size = max (PART_SIZE / region[0], 1);
+  t.streaming = use_streaming (region[0] * t.num_rows);
+  num_parts = (t.num_rows + t.part_size - 1) / t.part_size;
+  run_parts (run, fill_rows, &t, num_parts, region[0] * t.num_rows);
+}
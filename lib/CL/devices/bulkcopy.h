@@ -0,0 +1,89 @@
+/* OpenCL runtime/device driver library: bulk copies and fills of the
+   host memory
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+/**
+ * The buffer and image transfers of the CPU devices.
+ *
+ * The large transfers are split into parts that a device can execute
+ * with its threads in parallel. The stores of the transfers larger than
+ * the last level cache bypass the cache, so that they do not evict the
+ * data of the kernels. The fills store whole vectors of the repeated
+ * pattern. The source and the destination of a copy may overlap.
+ *
+ * @see bulkcopy.c
+ * @file bulkcopy.h
+ */
+
+#ifndef BULKCOPY_H
+#define BULKCOPY_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Processes the parts first to last (inclusive) of a transfer. */
+typedef void (*bulk_part_fn) (void *transfer, size_t first, size_t last);
+
+/* Calls fn for the ranges of parts covering the parts 0 to num_parts - 1,
+   possibly in several threads in parallel, and returns when all of them
+   have been processed. */
+typedef void (*bulk_run_fn) (bulk_part_fn fn, void *transfer,
+                             size_t num_parts);
+
+#pragma GCC visibility push(hidden)
+
+/* The transfers below execute in the calling thread if run is NULL. */
+
+void bulk_copy (bulk_run_fn run, void *dst, const void *src, size_t size);
+
+/* The origins and the region are in bytes in the x dimension. */
+void bulk_copy_rect (bulk_run_fn run,
+                     void *dst, const void *src,
+                     const size_t *dst_origin,
+                     const size_t *src_origin,
+                     const size_t *region,
+                     size_t dst_row_pitch, size_t dst_slice_pitch,
+                     size_t src_row_pitch, size_t src_slice_pitch);
+
+/* Fills the size bytes at dst with the pattern repeated. The size must be
+   a multiple of the pattern size. */
+void bulk_fill (bulk_run_fn run, void *dst, size_t size,
+                const void *pattern, size_t pattern_size);
+
+/* Fills each row of the region with the pattern repeated. The origin and
+   the region are in bytes in the x dimension, and region[0] must be a
+   multiple of the pattern size. */
+void bulk_fill_rect (bulk_run_fn run, void *dst,
+                     const size_t *origin, const size_t *region,
+                     size_t row_pitch, size_t slice_pitch,
+                     const void *pattern, size_t pattern_size);
+
+#pragma GCC visibility pop
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
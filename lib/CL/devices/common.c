@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "config.h"
 
 #include "pocl_image_util.h"
@@ -34,8 +35,13 @@
 #include "devices.h"
 #include "pocl_mem_management.h"
 #include "pocl_runtime_config.h"
+#include "pocl_llvm.h"
+#include "pocl_cache.h"
 
 #define COMMAND_LENGTH 2048
+#define WORKGROUP_STRING_LENGTH 128
+/* The alignment of the context arrays in the scratch buffer. */
+#define CONTEXT_SCRATCH_ALIGN 64
 
 
 /**
@@ -232,6 +238,152 @@ llvm_codegen (const char* tmpdir) {
   return module;
 }
 
+static pocl_lock_t dl_lock = POCL_LOCK_INITIALIZER;
+
+/**
+ * Generates the machine code of the work-group function in tmpdir and
+ * loads it to the process. The function executing a range of work
+ * groups is returned in wg_range, NULL if the code does not have one,
+ * and the size of the scratch buffer they need in context_scratch_size.
+ *
+ * The code is generated in-process when possible, otherwise a shared
+ * library is built with llvm_codegen and loaded.
+ */
+pocl_workgroup
+pocl_load_workgroup_function (cl_device_id device, cl_kernel kernel,
+                              size_t local_x, size_t local_y, size_t local_z,
+                              const char *tmpdir,
+                              pocl_workgroup_range *wg_range,
+                              size_t *context_scratch_size)
+{
+  char workgroup_string[WORKGROUP_STRING_LENGTH];
+  char parallel_filename[POCL_FILENAME_LENGTH];
+  char module[POCL_FILENAME_LENGTH];
+  char cache_key[POCL_CACHE_KEY_LENGTH];
+  const char *module_fn;
+  int use_cache;
+  lt_dlhandle dlhandle;
+  pocl_workgroup wg;
+  size_t *scratch_size;
+
+  const char* wg_method = 
+    pocl_get_string_option("POCL_WORK_GROUP_METHOD", "loopvec");
+
+  if (pocl_llvm_jit_enabled (device))
+    {
+      snprintf (parallel_filename, POCL_FILENAME_LENGTH, "%s/%s", 
+                tmpdir, POCL_PARALLEL_BC_FILENAME);
+      wg = pocl_llvm_jit_workgroup_function (device, kernel, 
+                                             parallel_filename, wg_range,
+                                             context_scratch_size);
+      if (wg != NULL)
+        return wg;
+    }
+
+  /* The shared libraries built by the earlier runs are in the kernel
+     cache. The file names differ with the spmd method. */
+  use_cache = strcmp (wg_method, "spmd") != 0 &&
+    kernel->program->cache_keys != NULL;
+  if (use_cache)
+    {
+      pocl_cache_workgroup_key (kernel->program->cache_keys[device->dev_id],
+                                kernel->function_name, 
+                                local_x, local_y, local_z, cache_key);
+      snprintf (module, POCL_FILENAME_LENGTH, "%s/parallel.so", tmpdir);
+      if (access (module, F_OK) == 0 ||
+          pocl_cache_fetch (cache_key, "parallel.so", module))
+        use_cache = 0;
+    }
+
+  module_fn = llvm_codegen (tmpdir);
+  if (use_cache)
+    pocl_cache_insert (cache_key, "parallel.so", module_fn);
+
+  /* libltdl is not thread safe, unlike the code generation above. */
+  POCL_LOCK (dl_lock);
+  dlhandle = lt_dlopen (module_fn);     
+  if (dlhandle == NULL)
+    {
+      printf ("pocl error: lt_dlopen(\"%s\") failed with '%s'.\n", 
+              module_fn, lt_dlerror());
+      printf ("note: missing symbols in the kernel binary might be" 
+              "reported as 'file not found' errors.\n");
+      abort();
+    }
+  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+            "_%s_workgroup_range", kernel->function_name);
+  *wg_range = (pocl_workgroup_range) lt_dlsym (dlhandle, workgroup_string);
+  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+            "_%s_context_scratch_size", kernel->function_name);
+  scratch_size = (size_t *) lt_dlsym (dlhandle, workgroup_string);
+  *context_scratch_size = scratch_size != NULL ? *scratch_size : 0;
+  snprintf (workgroup_string, WORKGROUP_STRING_LENGTH,
+            "_%s_workgroup", kernel->function_name);
+  wg = (pocl_workgroup) lt_dlsym (dlhandle, workgroup_string);
+  POCL_UNLOCK (dl_lock);
+  return wg;
+}
+
+static pthread_key_t context_scratch_key;
+static pthread_once_t context_scratch_once = PTHREAD_ONCE_INIT;
+
+typedef struct context_scratch
+{
+  void *buffer;
+  size_t size;
+} context_scratch;
+
+static void
+free_context_scratch (void *p)
+{
+  context_scratch *scratch = (context_scratch *) p;
+  pocl_aligned_free (scratch->buffer);
+  free (scratch);
+}
+
+static void
+init_context_scratch_key (void)
+{
+  pthread_key_create (&context_scratch_key, free_context_scratch);
+}
+
+/**
+ * Returns a scratch buffer of at least size bytes for the context arrays
+ * of the work-group functions executed by the calling thread.
+ *
+ * The buffer is kept for the later work groups of the thread and grown
+ * as needed, thus it must not be used after the next call. It is freed
+ * when the thread exits.
+ */
+void *
+pocl_context_scratch (size_t size)
+{
+  context_scratch *scratch;
+
+  if (size == 0)
+    return NULL;
+
+  pthread_once (&context_scratch_once, init_context_scratch_key);
+  scratch = (context_scratch *) pthread_getspecific (context_scratch_key);
+  if (scratch == NULL)
+    {
+      scratch = (context_scratch *) calloc (1, sizeof (context_scratch));
+      if (scratch == NULL)
+        return NULL;
+      pthread_setspecific (context_scratch_key, scratch);
+    }
+
+  if (scratch->size < size)
+    {
+      size = (size + CONTEXT_SCRATCH_ALIGN - 1) & 
+        ~(size_t)(CONTEXT_SCRATCH_ALIGN - 1);
+      pocl_aligned_free (scratch->buffer);
+      scratch->buffer = pocl_aligned_malloc (CONTEXT_SCRATCH_ALIGN, size);
+      scratch->size = scratch->buffer != NULL ? size : 0;
+    }
+  return scratch->buffer;
+}
+
 /**
  * Populates the device specific image data structure used by kernel
  * from given kernel image argument
@@ -75,6 +75,16 @@
 
 const char* llvm_codegen (const char* tmpdir);
 
+pocl_workgroup pocl_load_workgroup_function (cl_device_id device, 
+                                             cl_kernel kernel,
+                                             size_t local_x, size_t local_y,
+                                             size_t local_z,
+                                             const char *tmpdir,
+                                             pocl_workgroup_range *wg_range,
+                                             size_t *context_scratch_size);
+
+void *pocl_context_scratch (size_t size);
+
 void fill_dev_image_t (dev_image_t* di, struct pocl_argument* parg, 
                        cl_int device);
 
@@ -38,4 +38,11 @@ GEN_PROTOTYPES (pthread)
 #include "prototypes.inc"
 GEN_PROTOTYPES (basic)
 
+#ifdef CUSTOM_BUFFER_ALLOCATOR
+#include "bufpool.h"
+
+/* Returns the usage statistics of the buffer pool of the devices. */
+void pocl_pthread_buffer_pool_stats (bufpool_stats_t *stats);
+#endif
+
 #endif /* POCL_PTHREAD_H */
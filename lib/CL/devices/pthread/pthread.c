@@ -25,7 +25,9 @@
 #include "pocl-pthread.h"
 #include "install-paths.h"
 #include <assert.h>
-//#include <pthread.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -38,33 +40,16 @@
 #include "config.h"
 #include "devices.h"
 #include "pocl_util.h"
+#include "pocl_large_pages.h"
 #include "pocl_mem_management.h"
+#include "pthread_scheduler.h"
+#include "bulkcopy.h"
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
 
-#include "bufalloc.h"
+#include "bufpool.h"
 #include <../dev_image.h>
 
-/* Instead of mallocing a buffer size for a region, try to allocate 
-   this many times the buffer size to hopefully avoid mallocs for 
-   the next buffer allocations.
-   
-   Falls back to single multiple allocation if fails to allocate a
-   larger region. */
-#define ALLOCATION_MULTIPLE 32
-
-/* To avoid memory hogging in case of larger buffers, limit the
-   extra allocation margin to this number of megabytes.
-
-   The extra allocation should be done to avoid repetitive calls and
-   memory fragmentation for smaller buffers only. 
- */
-#define ADDITIONAL_ALLOCATION_MAX_MB 100
-
-/* Whether to immediately free a region in case the last chunk was
-   deallocated. If 0, it can reuse the same region over multiple kernels. */
-#define FREE_EMPTY_REGIONS 0
-
 /* CUSTOM_BUFFER_ALLOCATOR */
 #endif
 
@@ -75,74 +60,110 @@
    for the thread execution. */
 #define THREAD_COUNT_ENV "POCL_MAX_PTHREAD_COUNT"
 
+/* The NUMA placement of the buffers: the pages are placed by the first
+   touch, interleaved over the nodes, or placed to the given node. */
+#define NUMA_FIRST_TOUCH -2
+#define NUMA_INTERLEAVE -1
+
+/* The smaller buffers share pages with others, so they are left to the
+   first touch. */
+#define NUMA_PLACEMENT_MIN_SIZE (256 * 1024)
+
+/* The worker threads are not bound, bound to the cores of all the
+   nodes, or bound to the cores of the given node. */
+#define NO_AFFINITY -2
+#define ALL_NODES -1
+
+/* The descriptor of a single NDRange execution in the worker pool. */
 typedef struct thread_arguments thread_arguments;
 struct thread_arguments 
 {
+  /* Must be the first member, the pool passes a pointer to it to
+     workgroup_thread. */
+  pool_job job;
   void *data;
   cl_kernel kernel;
   unsigned device;
   struct pocl_context pc;
-  int last_gid_x; 
   pocl_workgroup workgroup;
+  pocl_workgroup_range workgroup_range;
+  size_t context_scratch_size;
   struct pocl_argument *kernel_args;
   thread_arguments *volatile next;
 };
 
-typedef struct _mem_regions_management{
-  ba_lock_t mem_regions_lock;
-  struct memory_region *mem_regions;
-} mem_regions_management;
-
 struct data {
   /* Currently loaded kernel. */
   cl_kernel current_kernel;
   /* Loaded kernel dynamic library handle. */
   lt_dlhandle current_dlhandle;
+  /* NUMA_FIRST_TOUCH, NUMA_INTERLEAVE or the node of the buffers. */
+  int numa_node;
 
 #ifdef CUSTOM_BUFFER_ALLOCATOR
-  /* Lock for protecting the mem_regions linked list. Held when new mem_regions
-     are created or old ones freed. */
-  mem_regions_management* mem_regions;
+  /* The pool of the buffers, shared by all the pthread devices. */
+  bufpool_t *buffer_pool;
 #endif
 
 };
 
 
-static thread_arguments *volatile thread_argument_pool = 0;
-static int argument_pool_initialized = 0;
-pocl_lock_t ta_pool_lock;
+#ifdef CUSTOM_BUFFER_ALLOCATOR
+static bufpool_t *buffer_pool = NULL;
+static int buffer_pool_users = 0;
+static pocl_lock_t buffer_pool_lock = POCL_LOCK_INITIALIZER;
+static pthread_once_t buffer_pool_stats_once = PTHREAD_ONCE_INIT;
+
+static void
+print_buffer_pool_stats (void)
+{
+  bufpool_stats_t stats;
+
+  pocl_pthread_buffer_pool_stats (&stats);
+  fprintf (stderr, "pocl: pthread buffer pool: %lu allocations, %lu frees, "
+           "%zu bytes in use, peak %zu, %zu reserved, %zu in slabs, "
+           "%zu free extents of %zu bytes, largest %zu\n",
+           stats.allocations, stats.frees, stats.in_use, stats.peak_in_use,
+           stats.reserved, stats.slab_bytes, stats.free_extents,
+           stats.free_extent_bytes, stats.largest_free_extent);
+}
+
+static void
+register_buffer_pool_stats (void)
+{
+  if (pocl_get_bool_option ("POCL_DEBUG", 0))
+    atexit (print_buffer_pool_stats);
+}
+#endif
+
+/* The worker threads are shared by the pthread devices, so they are
+   bound by the parameters of the first device setting the affinity. */
+static int worker_affinity = NO_AFFINITY;
+
+static pocl_object_pool thread_argument_pool;
+static pthread_once_t argument_pool_once = PTHREAD_ONCE_INIT;
 static int get_max_thread_count();
-static void * workgroup_thread (void *p);
+static void workgroup_thread (pool_job *job);
+
+static void init_thread_argument_pool (void)
+{
+  pocl_object_pool_init (&thread_argument_pool, sizeof (thread_arguments),
+                         offsetof (thread_arguments, next), NULL);
+}
 
 void pocl_init_thread_argument_manager (void)
 {
-  if (!argument_pool_initialized)
-    {
-      argument_pool_initialized = 1;
-      //POCL_INIT_LOCK (ta_pool_lock);
-    }
+  pthread_once (&argument_pool_once, init_thread_argument_pool);
 }
 
 thread_arguments* new_thread_arguments ()
 {
-  thread_arguments *ta = NULL;
-  //POCL_LOCK (ta_pool_lock);
-  if (ta = thread_argument_pool)
-    {
-      LL_DELETE (thread_argument_pool, ta);
-      //POCL_UNLOCK (ta_pool_lock);
-      return ta;
-    }
-  //POCL_UNLOCK (ta_pool_lock);
-    
-  return calloc (1, sizeof (thread_arguments));
+  return (thread_arguments*) pocl_object_pool_alloc (&thread_argument_pool);
 }
 
 void free_thread_arguments (thread_arguments *ta)
 {
-  //POCL_LOCK (ta_pool_lock);
-  LL_PREPEND (thread_argument_pool, ta);
-  //POCL_UNLOCK (ta_pool_lock);
+  pocl_object_pool_free (&thread_argument_pool, ta);
 }
 
 void
@@ -163,6 +184,11 @@ pocl_pthread_init_device_ops(struct pocl_device_ops *ops)
   ops->write = pocl_pthread_write;
   ops->copy = pocl_pthread_copy;
   ops->copy_rect = pocl_pthread_copy_rect;
+  ops->read_rect = pocl_pthread_read_rect;
+  ops->write_rect = pocl_pthread_write_rect;
+  ops->fill_rect = pocl_pthread_fill_rect;
+  ops->fill = pocl_pthread_fill;
+  ops->migrate = pocl_pthread_migrate;
   ops->run = pocl_pthread_run;
   ops->compile_submitted_kernels = pocl_basic_compile_submitted_kernels;
 
@@ -182,13 +208,72 @@ pocl_pthread_init_device_infos(struct _cl_device_id* dev)
 
 }
 
+/* Parses the device parameters, a list of the following separated by
+   spaces or commas:
+
+   affinity         bind the worker threads to the cores, filling one
+                    NUMA node after another
+   numa=interleave  interleave the pages of the large buffers over the
+                    NUMA nodes
+   numa=N           bind the worker threads to the cores of the NUMA
+                    node N and place the large buffers to its memory
+
+   The unknown parameters and nonexistent NUMA nodes are ignored with
+   a warning. */
+static void
+parse_parameters (struct data *d, const char *parameters, int *affinity)
+{
+  char *params, *token, *saveptr;
+
+  d->numa_node = NUMA_FIRST_TOUCH;
+  *affinity = NO_AFFINITY;
+  if (parameters == NULL)
+    return;
+
+  params = strdup (parameters);
+  for (token = strtok_r (params, " ,", &saveptr); token != NULL;
+       token = strtok_r (NULL, " ,", &saveptr))
+    {
+      if (strcmp (token, "affinity") == 0)
+        *affinity = ALL_NODES;
+      else if (strcmp (token, "numa=interleave") == 0)
+        d->numa_node = NUMA_INTERLEAVE;
+      else if (strncmp (token, "numa=", 5) == 0 && isdigit (token[5]))
+        {
+          int node = atoi (token + 5);
+          if (node >= (int)pocl_topology_num_nodes ())
+            {
+              fprintf (stderr, "pocl: the NUMA node %d of the pthread device "
+                       "does not exist, using first-touch placement\n", node);
+              d->numa_node = NUMA_FIRST_TOUCH;
+              *affinity = NO_AFFINITY;
+            }
+          else
+            {
+              d->numa_node = node;
+              *affinity = node;
+            }
+        }
+      else
+        fprintf (stderr, "pocl: ignoring the unknown pthread device "
+                 "parameter '%s'\n", token);
+    }
+  free (params);
+}
+
+static void
+bind_worker (unsigned index)
+{
+  /* The first core is left for the thread submitting the jobs. */
+  pocl_topology_bind_thread (worker_affinity, index + 1);
+}
+
 void
 pocl_pthread_init (cl_device_id device, const char* parameters)
 {
   struct data *d; 
-  static mem_regions_management* mrm = NULL;
   static int global_mem_id;
-  int i;
+  int i, affinity;
 
   // TODO: this checks if the device was already initialized previously.
   // Should we instead have a separate bool field in device, or do the
@@ -200,16 +285,19 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   
   d->current_kernel = NULL;
   d->current_dlhandle = 0;
+  parse_parameters (d, parameters, &affinity);
 
   device->data = d;
 #ifdef CUSTOM_BUFFER_ALLOCATOR  
-  if (mrm == NULL)
-    {
-      mrm = malloc (sizeof (mem_regions_management));
-      //BA_INIT_LOCK (mrm->mem_regions_lock);
-      mrm->mem_regions = NULL;
-    }
-  d->mem_regions = mrm;
+  POCL_LOCK (buffer_pool_lock);
+  if (buffer_pool == NULL)
+    buffer_pool = bufpool_create (MAX_EXTENDED_ALIGNMENT);
+  if (buffer_pool == NULL)
+    POCL_ABORT ("Could not create the buffer pool.\n");
+  ++buffer_pool_users;
+  d->buffer_pool = buffer_pool;
+  POCL_UNLOCK (buffer_pool_lock);
+  pthread_once (&buffer_pool_stats_once, register_buffer_pool_stats);
 #endif  
 
   device->address_bits = sizeof(void*) * 8;
@@ -255,8 +343,17 @@ pocl_pthread_init (cl_device_id device, const char* parameters)
   device->has_64bit_long=0;
   #endif
 
+  /* A device of a NUMA node executes with the cores of the node. */
+  if (d->numa_node >= 0)
+    device->max_compute_units = pocl_topology_num_cores (d->numa_node);
+
   pocl_init_thread_argument_manager();
-  
+
+  /* The worker threads are shared by all pthread devices. */
+  if (worker_affinity == NO_AFFINITY)
+    worker_affinity = affinity;
+  pocl_pthread_pool_init (get_max_thread_count (device),
+                          worker_affinity != NO_AFFINITY ? bind_worker : NULL);
 }
 
 void
@@ -264,80 +361,38 @@ pocl_pthread_uninit (cl_device_id device)
 {
   struct data *d = (struct data*)device->data;
 #ifdef CUSTOM_BUFFER_ALLOCATOR
-  memory_region_t *region, *temp;
-  DL_FOREACH_SAFE(d->mem_regions->mem_regions, region, temp)
+  POCL_LOCK (buffer_pool_lock);
+  if (--buffer_pool_users == 0)
     {
-      DL_DELETE(d->mem_regions->mem_regions, region);
-      free ((void*)region->chunks->start_address);
-      free (region);    
+      bufpool_destroy (buffer_pool);
+      buffer_pool = NULL;
     }
-  d->mem_regions->mem_regions = NULL;
+  POCL_UNLOCK (buffer_pool_lock);
 #endif  
+  pocl_pthread_pool_uninit ();
   free (d);
   device->data = NULL;
 }
 
 
+/* Places the pages of a new buffer to the NUMA nodes by the policy of
+   the device. The placement is a hint: failures are ignored. */
+static void
+place_buffer (struct data* d, void *ptr, size_t size)
+{
+  if (d->numa_node != NUMA_FIRST_TOUCH && size >= NUMA_PLACEMENT_MIN_SIZE)
+    pocl_topology_bind_memory (ptr, size, d->numa_node);
+}
+
 #ifdef CUSTOM_BUFFER_ALLOCATOR
 static int
 allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
 {
-  printf("pocl info: attempting to allocate buffer via custom_buf_alloc(%d,%d,%d)\n",memptr,alignment,size);
-  //BA_LOCK(d->mem_regions->mem_regions_lock);
-  chunk_info_t *chunk = alloc_buffer (d->mem_regions->mem_regions, size);
-  if (chunk == NULL)
-    {
-      memory_region_t *new_mem_region = 
-        (memory_region_t*)malloc (sizeof (memory_region_t));
-
-      if (new_mem_region == NULL) 
-        {
-          //BA_UNLOCK (d->mem_regions->mem_regions_lock);
-          printf("ENONMEM malloc==null\n");
-          return ENOMEM;
-        }
-
-      /* Fallback to the minimum size in case of overflow. 
-         Allocate a larger chunk to avoid allocation overheads
-         later on. */
-      size_t region_size = 
-        max(min(size + ADDITIONAL_ALLOCATION_MAX_MB * 1024 * 1024, 
-                size * ALLOCATION_MULTIPLE), size);
-
-      assert (region_size >= size);
-
-      void* space = NULL;
-      if ((posix_memalign (&space, alignment, region_size)) != 0)
-        {
-          /* Failed to allocate a large region. Fall back to allocating 
-             the smallest possible region for the buffer. */
-          if ((posix_memalign (&space, alignment, size)) != 0) 
-            {
-              //BA_UNLOCK (d->mem_regions->mem_regions_lock);
-              printf("ENOMEM posix_memalign(%d,%d,%d) fail\n",space,alignment,size);
-              return ENOMEM;
-            }
-          region_size = size;
-        }
-
-      init_mem_region (new_mem_region, (memory_address_t)space, region_size);
-      new_mem_region->alignment = alignment;
-      DL_APPEND (d->mem_regions->mem_regions, new_mem_region);
-      chunk = alloc_buffer_from_region (new_mem_region, size);
-
-      if (chunk == NULL)
-      {
-        printf("pocl error: could not allocate a buffer of size %zu from the newly created region of size %zu.\n",
-               size, region_size);
-        print_chunks(new_mem_region->chunks);
-        /* In case the malloc didn't fail it should have been able to allocate 
-           the buffer to a newly created Region. */
-        assert (chunk != NULL);
-      }
-    }
-  //BA_UNLOCK (d->mem_regions->mem_regions_lock);
-  
-  *memptr = (void*) chunk->start_address;
+  assert (alignment <= MAX_EXTENDED_ALIGNMENT);
+  *memptr = bufpool_alloc (d->buffer_pool, size);
+  if (*memptr == NULL)
+    return ENOMEM;
+  place_buffer (d, *memptr, size);
   return 0;
 }
 
@@ -347,7 +402,10 @@ static int
 allocate_aligned_buffer (struct data* d, void **memptr, size_t alignment, size_t size) 
 {
   printf("pocl info: attempting to allocate buffer via posix_memalign(%d,%d,%d)\n",memptr,alignment,size);
-  return posix_memalign (memptr, alignment, size);
+  int error = posix_memalign (memptr, alignment, size);
+  if (error == 0)
+    place_buffer (d, *memptr, size);
+  return error;
 }
 
 #endif
@@ -395,12 +453,27 @@ pocl_pthread_alloc_mem_obj (cl_device_id device, cl_mem mem_obj)
         {
           b = mem_obj->mem_host_ptr;
         }
-      else if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, 
-                                        mem_obj->size) != 0)
-        return CL_MEM_OBJECT_ALLOCATION_FAILURE;
-
-      if (flags & CL_MEM_COPY_HOST_PTR)
-        memcpy (b, mem_obj->mem_host_ptr, mem_obj->size);
+      else if (flags & CL_MEM_ALLOC_HOST_PTR)
+        {
+          /* The host memory allocated by the runtime is the storage of
+             the buffer. */
+          b = mem_obj->mem_host_ptr;
+          place_buffer (d, b, mem_obj->size);
+        }
+      else
+        {
+          b = pocl_large_pages_alloc (mem_obj->context, mem_obj->size);
+          if (b != NULL)
+            place_buffer (d, b, mem_obj->size);
+          else if (allocate_aligned_buffer (d, &b, MAX_EXTENDED_ALIGNMENT, 
+                                            mem_obj->size) != 0)
+            return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+
+          if (flags & CL_MEM_COPY_HOST_PTR)
+            memcpy (b, mem_obj->mem_host_ptr, mem_obj->size);
+          else
+            pocl_prefault_buffer (mem_obj->context, b, mem_obj->size);
+        }
     
       mem_obj->device_ptrs[device->global_mem_id].mem_ptr = b;
       mem_obj->device_ptrs[device->global_mem_id].global_mem_id = 
@@ -418,30 +491,23 @@ void
 pocl_pthread_free (void *device_data, cl_mem_flags flags, void *ptr)
 {
   struct data* d = (struct data*) device_data;
-  memory_region_t *region = NULL;
 
-  if (flags & CL_MEM_USE_HOST_PTR)
+  if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR))
       return; /* The host code should free the host ptr. */
 
-  region = free_buffer (d->mem_regions->mem_regions, (memory_address_t)ptr);
-
-  assert(region != NULL && "Unable to find the region for chunk.");
+  if (pocl_large_pages_free (ptr) != 0 && bufpool_free (d->buffer_pool, ptr) != 0)
+    assert (0 && "Unable to find the pool of the buffer.");
+}
 
-#if FREE_EMPTY_REGIONS == 1
-  //BA_LOCK(d->mem_regions->mem_regions_lock);
-  //BA_LOCK(region->lock);
-  if (region->last_chunk == region->chunks && 
-      !region->chunks->is_allocated) 
-    {
-      /* All chunks have been deallocated. free() the whole 
-         memory region at once. */
-      DL_DELETE(d->mem_regions->mem_regions, region);
-      free ((void*)region->last_chunk->start_address);
-      free (region);    
-    }  
-  //BA_UNLOCK(region->lock);
-  //BA_UNLOCK(d->mem_regions->mem_regions_lock);
-#endif
+void
+pocl_pthread_buffer_pool_stats (bufpool_stats_t *stats)
+{
+  POCL_LOCK (buffer_pool_lock);
+  if (buffer_pool != NULL)
+    bufpool_get_stats (buffer_pool, stats);
+  else
+    memset (stats, 0, sizeof (bufpool_stats_t));
+  POCL_UNLOCK (buffer_pool_lock);
 }
 
 #else
@@ -449,39 +515,61 @@ pocl_pthread_free (void *device_data, cl_mem_flags flags, void *ptr)
 void
 pocl_pthread_free (void *data, cl_mem_flags flags, void *ptr)
 {
-  if (flags & CL_MEM_COPY_HOST_PTR)
+  if (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR))
     return;
   
-  free (ptr);
+  if (pocl_large_pages_free (ptr) != 0)
+    free (ptr);
 }
 #endif
 
+/* A buffer or image transfer executed by the worker pool. */
+typedef struct transfer_job
+{
+  pool_job job;
+  bulk_part_fn fn;
+  void *transfer;
+} transfer_job;
+
+static void
+transfer_thread (pool_job *job)
+{
+  transfer_job *tj = (transfer_job *) job;
+  size_t first, last;
+
+  while (pool_job_next_chunk (job, &first, &last))
+    tj->fn (tj->transfer, first, last);
+}
+
+/* Splits the bulk transfers over the worker threads. */
+static void
+run_transfer (bulk_part_fn fn, void *transfer, size_t num_parts)
+{
+  transfer_job tj;
+  tj.job.fn = transfer_thread;
+  tj.job.num_items = num_parts;
+  tj.fn = fn;
+  tj.transfer = transfer;
+  pocl_pthread_pool_run (&tj.job);
+}
+
 void
 pocl_pthread_read (void *data, void *host_ptr, const void *device_ptr, size_t cb)
 {
-  if (host_ptr == device_ptr)
-    return;
-
-  memcpy (host_ptr, device_ptr, cb);
+  bulk_copy (run_transfer, host_ptr, device_ptr, cb);
 }
 
 void
 pocl_pthread_write (void *data, const void *host_ptr, void *device_ptr, size_t cb)
 {
-  if (host_ptr == device_ptr)
-    return;
-  
-  memcpy (device_ptr, host_ptr, cb);
+  bulk_copy (run_transfer, device_ptr, host_ptr, cb);
 }
 
 
 void
 pocl_pthread_copy (void *data, const void *src_ptr, void *__restrict__ dst_ptr, size_t cb)
 {
-  if (src_ptr == dst_ptr)
-    return;
-  
-  memcpy (dst_ptr, src_ptr, cb);
+  bulk_copy (run_transfer, dst_ptr, src_ptr, cb);
 }
 
 void
@@ -496,22 +584,89 @@ pocl_pthread_copy_rect (void *data,
                         size_t const dst_row_pitch,
                         size_t const dst_slice_pitch)
 {
-  char const *__restrict const adjusted_src_ptr = 
-    (char const*)src_ptr +
-    src_origin[0] + src_row_pitch * (src_origin[1] + src_slice_pitch * src_origin[2]);
-  char *__restrict__ const adjusted_dst_ptr = 
-    (char*)dst_ptr +
-    dst_origin[0] + dst_row_pitch * (dst_origin[1] + dst_slice_pitch * dst_origin[2]);
-  
-  size_t j, k;
+  bulk_copy_rect (run_transfer, dst_ptr, src_ptr, dst_origin, src_origin,
+                  region, dst_row_pitch, dst_slice_pitch,
+                  src_row_pitch, src_slice_pitch);
+}
 
-  /* TODO: handle overlaping regions */
-  
-  for (k = 0; k < region[2]; ++k)
-    for (j = 0; j < region[1]; ++j)
-      memcpy (adjusted_dst_ptr + dst_row_pitch * j + dst_slice_pitch * k,
-              adjusted_src_ptr + src_row_pitch * j + src_slice_pitch * k,
-              region[0]);
+void
+pocl_pthread_write_rect (void *data,
+                         const void *__restrict__ const host_ptr,
+                         void *__restrict__ const device_ptr,
+                         const size_t *__restrict__ const buffer_origin,
+                         const size_t *__restrict__ const host_origin, 
+                         const size_t *__restrict__ const region,
+                         size_t const buffer_row_pitch,
+                         size_t const buffer_slice_pitch,
+                         size_t const host_row_pitch,
+                         size_t const host_slice_pitch)
+{
+  bulk_copy_rect (run_transfer, device_ptr, host_ptr, buffer_origin,
+                  host_origin, region, buffer_row_pitch, buffer_slice_pitch,
+                  host_row_pitch, host_slice_pitch);
+}
+
+void
+pocl_pthread_read_rect (void *data,
+                        void *__restrict__ const host_ptr,
+                        void *__restrict__ const device_ptr,
+                        const size_t *__restrict__ const buffer_origin,
+                        const size_t *__restrict__ const host_origin, 
+                        const size_t *__restrict__ const region,
+                        size_t const buffer_row_pitch,
+                        size_t const buffer_slice_pitch,
+                        size_t const host_row_pitch,
+                        size_t const host_slice_pitch)
+{
+  bulk_copy_rect (run_transfer, host_ptr, device_ptr, host_origin,
+                  buffer_origin, region, host_row_pitch, host_slice_pitch,
+                  buffer_row_pitch, buffer_slice_pitch);
+}
+
+/* origin and region must be in original shape unlike in copy/read/write_rect()
+ */
+void
+pocl_pthread_fill_rect (void *data,
+                        void *__restrict__ const device_ptr,
+                        const size_t *__restrict__ const buffer_origin,
+                        const size_t *__restrict__ const region,
+                        size_t const buffer_row_pitch,
+                        size_t const buffer_slice_pitch,
+                        void *fill_pixel,
+                        size_t pixel_size)
+{
+  size_t origin[3] = { buffer_origin[0] * pixel_size, buffer_origin[1],
+                       buffer_origin[2] };
+  size_t bytes[3] = { region[0] * pixel_size, region[1], region[2] };
+
+  bulk_fill_rect (run_transfer, device_ptr, origin, bytes, buffer_row_pitch,
+                  buffer_slice_pitch, fill_pixel, pixel_size);
+}
+
+void
+pocl_pthread_fill (void *data, void *device_ptr, size_t size,
+                   const void *pattern, size_t pattern_size)
+{
+  bulk_fill (run_transfer, device_ptr, size, pattern, pattern_size);
+}
+
+void
+pocl_pthread_migrate (cl_device_id device, cl_mem *mem_objects,
+                      cl_uint num_mem_objects, cl_mem_migration_flags flags)
+{
+  struct data *d = (struct data*)device->data;
+  cl_uint i;
+
+  /* The host and all the CPU devices share the memory, so only the
+     placement to the NUMA node of the device can change. The pages
+     of the objects with undefined contents are not moved. */
+  if (flags & (CL_MIGRATE_MEM_OBJECT_HOST |
+               CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED))
+    return;
+
+  for (i = 0; i < num_mem_objects; ++i)
+    place_buffer (d, mem_objects[i]->device_ptrs[device->dev_id].mem_ptr,
+                  mem_objects[i]->size);
 }
 
 #define FALLBACK_MAX_THREAD_COUNT 8
@@ -538,18 +693,11 @@ pocl_pthread_run
 (void *data, 
  _cl_command_node* cmd)
 {
-  struct data *d;
-  int error;
-  char workgroup_string[WORKGROUP_STRING_LENGTH];
   unsigned device;
-  cl_device_id device_ptr;
   unsigned i;
   cl_kernel kernel = cmd->command.run.kernel;
   struct pocl_context *pc = &cmd->command.run.pc;
   struct thread_arguments *arguments;
-  static int max_threads = 0; /* this needs to be asked only once */
-
-  d = (struct data *) data;
 
   /* Find which device number within the context correspond
      to current device.  */
@@ -558,74 +706,34 @@ pocl_pthread_run
       if (kernel->context->devices[i]->data == data)
         {
           device = i;
-          device_ptr = kernel->context->devices[i];
           break;
         }
     }
 
-
-  int num_groups_x = pc->num_groups[0];
-  /* TODO: distributing the work groups in the x dimension is not always the
-     best option. This assumes x dimension has enough work groups to utilize
-     all the threads. */
-  if (max_threads == 0)
-    max_threads = get_max_thread_count(device_ptr);
-
-  int num_threads = min(max_threads, num_groups_x);
-  pthread_t *threads = (pthread_t*) malloc (sizeof (pthread_t)*num_threads);
-  
-  int wgs_per_thread = num_groups_x / num_threads;
-  /* In case the work group count is not divisible by the
-     number of threads, we have to execute the remaining
-     workgroups in one of the threads. */
-  /* TODO: This is inefficient; it is better to round up when
-     calculating wgs_per_thread */
-  int leftover_wgs = num_groups_x - (num_threads*wgs_per_thread);
+  /* The work groups of all dimensions are numbered linearly, x being
+     the fastest changing dimension, and distributed to the threads
+     in chunks. */
+  size_t num_groups = pc->num_groups[0] * pc->num_groups[1] * pc->num_groups[2];
 
 #ifdef DEBUG_MT    
-  printf("### creating %d work group threads\n", num_threads);
-  printf("### wgs per thread==%d leftover wgs==%d\n", wgs_per_thread, leftover_wgs);
+  printf("### running %zu work groups in the worker pool\n", num_groups);
 #endif
   
-  int first_gid_x = 0;
-  int last_gid_x = wgs_per_thread - 1;
-  for (i = 0; i < num_threads; 
-       ++i, first_gid_x += wgs_per_thread, last_gid_x += wgs_per_thread) {
-
-    if (i + 1 == num_threads) last_gid_x += leftover_wgs;
-
-#ifdef DEBUG_MT       
-    printf("### creating wg thread: first_gid_x==%d, last_gid_x==%d\n",
-           first_gid_x, last_gid_x);
-#endif
-    arguments = new_thread_arguments();
-    arguments->data = data;
-    arguments->kernel = kernel;
-    arguments->device = device;
-    arguments->pc = *pc;
-    arguments->pc.group_id[0] = first_gid_x;
-    arguments->workgroup = cmd->command.run.wg;
-    arguments->last_gid_x = last_gid_x;
-    arguments->kernel_args = cmd->command.run.arguments;
-
-    /* TODO: pool of worker threads to avoid syscalls here */
-    /*
-    error = pthread_create (&threads[i],
-                            NULL,
-                            workgroup_thread,
-                            arguments);
-                            */
-    assert(!error);
-  }
-
-  for (i = 0; i < num_threads; ++i) {
-    //pthread_join(threads[i], NULL);
-#ifdef DEBUG_MT       
-    printf("### thread %u finished\n", (unsigned)threads[i]);
-#endif
-  }
-
-  free(threads);
+  arguments = new_thread_arguments();
+  arguments->data = data;
+  arguments->kernel = kernel;
+  arguments->device = device;
+  arguments->pc = *pc;
+  arguments->workgroup = cmd->command.run.wg;
+  arguments->workgroup_range = cmd->command.run.wg_range;
+  arguments->context_scratch_size = cmd->command.run.context_scratch_size;
+  arguments->kernel_args = cmd->command.run.arguments;
+  arguments->job.fn = workgroup_thread;
+  arguments->job.num_items = num_groups;
+
+  pocl_pthread_pool_run (&arguments->job);
+
+  free_thread_arguments (arguments);
 }
 
 void *
@@ -637,12 +745,18 @@ pocl_pthread_map_mem (void *data, void *buf_ptr,
   return buf_ptr + offset;
 }
 
-void *
-workgroup_thread (void *p)
+/**
+ * Executes the ranges of work groups handed out by the worker pool.
+ * Called in each thread participating in the NDRange execution.
+ */
+static void
+workgroup_thread (pool_job *job)
 {
-  struct thread_arguments *ta = (struct thread_arguments *) p;
+  struct thread_arguments *ta = (struct thread_arguments *) job;
   void *arguments[ta->kernel->num_args + ta->kernel->num_locals];
   struct pocl_argument *al;  
+  struct pocl_context pc = ta->pc;
+  size_t first, last, n;
   unsigned i = 0;
 
   /* TODO: refactor this to share code with basic.c 
@@ -712,18 +826,36 @@ workgroup_thread (void *p)
                                                       NULL);
     }
 
-  int first_gid_x = ta->pc.group_id[0];
-  unsigned gid_z, gid_y, gid_x;
-  for (gid_z = 0; gid_z < ta->pc.num_groups[2]; ++gid_z)
+  /* Each worker has its own scratch buffer, reused across the
+     launches. */
+  pc.context_scratch = pocl_context_scratch (ta->context_scratch_size);
+  if (ta->context_scratch_size > 0 && pc.context_scratch == NULL)
+    POCL_ABORT ("Could not allocate the context scratch buffer.\n");
+
+  while (pool_job_next_chunk (job, &first, &last))
     {
-      for (gid_y = 0; gid_y < ta->pc.num_groups[1]; ++gid_y)
+      if (ta->workgroup_range != NULL)
         {
-          for (gid_x = first_gid_x; gid_x <= ta->last_gid_x; ++gid_x)
+          ta->workgroup_range (arguments, &pc, first, last);
+          continue;
+        }
+
+      /* Convert the linear index to the 3D group id only once per
+         chunk, and step through the rest of the chunk. */
+      pc.group_id[0] = first % pc.num_groups[0];
+      pc.group_id[1] = (first / pc.num_groups[0]) % pc.num_groups[1];
+      pc.group_id[2] = first / (pc.num_groups[0] * pc.num_groups[1]);
+      for (n = first; n <= last; ++n)
+        {
+          ta->workgroup (arguments, &pc);
+          if (++pc.group_id[0] == pc.num_groups[0])
             {
-              ta->pc.group_id[0] = gid_x;
-              ta->pc.group_id[1] = gid_y;
-              ta->pc.group_id[2] = gid_z;
-              ta->workgroup (arguments, &(ta->pc));              
+              pc.group_id[0] = 0;
+              if (++pc.group_id[1] == pc.num_groups[1])
+                {
+                  pc.group_id[1] = 0;
+                  ++pc.group_id[2];
+                }
             }
         }
     }
@@ -748,7 +880,4 @@ workgroup_thread (void *p)
       pocl_pthread_free (ta->data, 0, *(void **)(arguments[i]));
       free (arguments[i]);
     }
-  free_thread_arguments (ta);
-
-  return NULL;
 }
@@ -0,0 +1,299 @@
+/* pthread_scheduler.c - a persistent pool of worker threads for the
+   pthread device.
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pthread_scheduler.h"
+#include "pocl_cl.h"
+#include "pocl_runtime_config.h"
+#include "utlist.h"
+
+/* How many times an idle worker polls for new jobs before going to
+   sleep on the condition variable. Polling avoids the wake up latency
+   when kernels are launched back to back. */
+#define DEFAULT_SPIN_COUNT 20000
+
+#define SPIN_COUNT_ENV "POCL_PTHREAD_SPIN_COUNT"
+
+/* The policy for splitting the items of a job to chunks:
+   "guided" hands out chunks proportional to the number of items left,
+   so the first chunks are large and the last ones small (but at least
+   the chunk size), "dynamic" hands out fixed size chunks. */
+#define SCHEDULE_ENV "POCL_PTHREAD_SCHEDULE"
+#define CHUNK_SIZE_ENV "POCL_PTHREAD_CHUNK_SIZE"
+
+enum schedule_policy
+{
+  SCHEDULE_GUIDED,
+  SCHEDULE_DYNAMIC
+};
+
+typedef struct thread_pool
+{
+  pthread_mutex_t lock;
+  /* Signalled when a new job has been submitted or the workers should
+     exit. */
+  pthread_cond_t wake_cond;
+  /* Signalled when the last thread leaves an exhausted job. */
+  pthread_cond_t done_cond;
+  /* The jobs that (possibly) still have items to hand out. */
+  pool_job *volatile jobs;
+  pthread_t *workers;
+  unsigned num_workers;
+  pool_thread_start_fn thread_start;
+  unsigned spin_count;
+  enum schedule_policy schedule;
+  size_t chunk_size;
+  unsigned users;
+  int exit;
+} thread_pool;
+
+static thread_pool pool = { PTHREAD_MUTEX_INITIALIZER,
+                            PTHREAD_COND_INITIALIZER,
+                            PTHREAD_COND_INITIALIZER };
+
+static int
+job_exhausted (pool_job *job)
+{
+  return job->next_item >= job->num_items;
+}
+
+/* Removes the job from the list of jobs with work left. Must be called
+   with the pool lock held. */
+static void
+dequeue_job (pool_job *job)
+{
+  if (job->queued)
+    {
+      LL_DELETE (pool.jobs, job);
+      job->queued = 0;
+    }
+}
+
+/* Returns the first job which has items left, dropping the exhausted
+   ones from the list. Must be called with the pool lock held. */
+static pool_job *
+pick_job ()
+{
+  pool_job *job, *tmp;
+  LL_FOREACH_SAFE (pool.jobs, job, tmp)
+    {
+      if (!job_exhausted (job))
+        return job;
+      dequeue_job (job);
+    }
+  return NULL;
+}
+
+static void *
+pool_worker (void *p)
+{
+  pool_job *job;
+  unsigned spin;
+
+  if (pool.thread_start != NULL)
+    pool.thread_start ((unsigned)(size_t)p);
+
+  pthread_mutex_lock (&pool.lock);
+  while (!pool.exit)
+    {
+      job = pick_job ();
+      if (job != NULL)
+        {
+          ++job->active_threads;
+          pthread_mutex_unlock (&pool.lock);
+
+          job->fn (job);
+
+          pthread_mutex_lock (&pool.lock);
+          dequeue_job (job);
+          if (--job->active_threads == 0)
+            pthread_cond_broadcast (&pool.done_cond);
+          continue;
+        }
+
+      /* Nothing to do. Poll for a while without the lock before
+         sleeping in case another command is launched soon. */
+      pthread_mutex_unlock (&pool.lock);
+      for (spin = 0; spin < pool.spin_count; ++spin)
+        {
+          if (pool.jobs != NULL || pool.exit)
+            break;
+          __sync_synchronize ();
+        }
+      pthread_mutex_lock (&pool.lock);
+      if (pool.jobs == NULL && !pool.exit)
+        pthread_cond_wait (&pool.wake_cond, &pool.lock);
+    }
+  pthread_mutex_unlock (&pool.lock);
+  return NULL;
+}
+
+void
+pocl_pthread_pool_init (unsigned num_threads,
+                        pool_thread_start_fn thread_start)
+{
+  unsigned i;
+  int error;
+
+  pthread_mutex_lock (&pool.lock);
+  if (pool.users++ > 0)
+    {
+      pthread_mutex_unlock (&pool.lock);
+      return;
+    }
+
+  pool.exit = 0;
+  pool.jobs = NULL;
+  pool.spin_count = pocl_get_int_option (SPIN_COUNT_ENV, DEFAULT_SPIN_COUNT);
+  pool.schedule = 
+    strcmp (pocl_get_string_option (SCHEDULE_ENV, "guided"), "dynamic") == 0 ?
+    SCHEDULE_DYNAMIC : SCHEDULE_GUIDED;
+  pool.chunk_size = pocl_get_int_option (CHUNK_SIZE_ENV, 1);
+  if (pool.chunk_size < 1)
+    pool.chunk_size = 1;
+  /* The thread submitting the job executes it too. */
+  pool.num_workers = num_threads > 1 ? num_threads - 1 : 0;
+  pool.workers = (pthread_t*) malloc (sizeof (pthread_t) * pool.num_workers);
+  pool.thread_start = thread_start;
+
+  for (i = 0; i < pool.num_workers; ++i)
+    {
+      error = pthread_create (&pool.workers[i], NULL, pool_worker, 
+                              (void*)(size_t)i);
+      if (error)
+        {
+          fprintf (stderr, "pocl: could only create %u of %u pthread "
+                   "worker threads\n", i, pool.num_workers);
+          pool.num_workers = i;
+          break;
+        }
+    }
+  pthread_mutex_unlock (&pool.lock);
+}
+
+void
+pocl_pthread_pool_uninit ()
+{
+  unsigned i;
+
+  pthread_mutex_lock (&pool.lock);
+  if (--pool.users > 0)
+    {
+      pthread_mutex_unlock (&pool.lock);
+      return;
+    }
+  pool.exit = 1;
+  pthread_cond_broadcast (&pool.wake_cond);
+  pthread_mutex_unlock (&pool.lock);
+
+  for (i = 0; i < pool.num_workers; ++i)
+    pthread_join (pool.workers[i], NULL);
+
+  free (pool.workers);
+  pool.workers = NULL;
+  pool.num_workers = 0;
+}
+
+unsigned
+pocl_pthread_pool_num_threads ()
+{
+  return pool.num_workers + 1;
+}
+
+int
+pool_job_next_chunk (pool_job *job, size_t *first, size_t *last)
+{
+  size_t item, chunk, left;
+
+  if (job_exhausted (job))
+    return 0;
+
+  if (pool.schedule == SCHEDULE_DYNAMIC)
+    {
+      item = __sync_fetch_and_add (&job->next_item, pool.chunk_size);
+      if (item >= job->num_items)
+        return 0;
+      chunk = min (pool.chunk_size, job->num_items - item);
+    }
+  else
+    {
+      do
+        {
+          item = job->next_item;
+          if (item >= job->num_items)
+            return 0;
+          left = job->num_items - item;
+          chunk = left / (2 * (pool.num_workers + 1));
+          chunk = min (max (chunk, pool.chunk_size), left);
+        }
+      while (!__sync_bool_compare_and_swap (&job->next_item, item, 
+                                            item + chunk));
+    }
+
+  *first = item;
+  *last = item + chunk - 1;
+  return 1;
+}
+
+void
+pocl_pthread_pool_run (pool_job *job)
+{
+  job->next_item = 0;
+  job->active_threads = 1;
+  job->queued = 0;
+  job->next = NULL;
+
+  if (pool.num_workers == 0 || job->num_items < 2)
+    {
+      job->fn (job);
+      return;
+    }
+
+  pthread_mutex_lock (&pool.lock);
+  LL_APPEND (pool.jobs, job);
+  job->queued = 1;
+  if (job->num_items - 1 < pool.num_workers)
+    {
+      size_t i;
+      for (i = 1; i < job->num_items; ++i)
+        pthread_cond_signal (&pool.wake_cond);
+    }
+  else
+    pthread_cond_broadcast (&pool.wake_cond);
+  pthread_mutex_unlock (&pool.lock);
+
+  job->fn (job);
+
+  pthread_mutex_lock (&pool.lock);
+  dequeue_job (job);
+  --job->active_threads;
+  while (job->active_threads > 0)
+    pthread_cond_wait (&pool.done_cond, &pool.lock);
+  pthread_mutex_unlock (&pool.lock);
+}
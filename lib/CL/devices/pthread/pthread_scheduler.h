@@ -0,0 +1,99 @@
+/* pthread_scheduler.h - a persistent pool of worker threads for the
+   pthread device.
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/**
+ * @file pthread_scheduler.h
+ *
+ * The worker threads are created once when the first pthread device
+ * is initialized and they sleep until work is submitted to them.
+ * A unit of work is a "job" consisting of num_items independent
+ * items (e.g. work-groups). The items are handed out to the workers
+ * that join the job in chunks. The thread that submits the job
+ * participates in its execution and returns once all of the items
+ * have been processed and every worker has left the job.
+ */
+
+#ifndef POCL_PTHREAD_SCHEDULER_H
+#define POCL_PTHREAD_SCHEDULER_H
+
+#include <stddef.h>
+
+#pragma GCC visibility push(hidden)
+
+typedef struct pool_job pool_job;
+
+/* The function executed by each thread joining a job. It should
+   process chunks of items fetched with pool_job_next_chunk() until
+   it returns 0. */
+typedef void (*pool_job_fn) (pool_job *job);
+
+/* Called by each worker thread when it starts, with the index of the
+   worker (0 to the number of workers - 1). */
+typedef void (*pool_thread_start_fn) (unsigned index);
+
+struct pool_job
+{
+  pool_job_fn fn;
+  /* The number of items to process. */
+  size_t num_items;
+  /* The next item that has not been handed out yet. Can grow past
+     num_items. */
+  volatile size_t next_item;
+  /* The number of threads currently executing the job. */
+  unsigned active_threads;
+  /* Set while the job is in the pool's list of jobs. */
+  int queued;
+  pool_job *next;
+};
+
+/* Starts the worker threads at the first call. The pool is shared by
+   all the pthread device instances and reference counted.
+   num_threads is the total number of threads to execute jobs with,
+   including the submitting thread. If thread_start is not NULL, the
+   workers call it when they start. */
+void pocl_pthread_pool_init (unsigned num_threads,
+                             pool_thread_start_fn thread_start);
+
+/* Stops and joins the workers once the last user has released it. */
+void pocl_pthread_pool_uninit (void);
+
+/* The total number of threads executing a job, including the
+   submitter. */
+unsigned pocl_pthread_pool_num_threads (void);
+
+/* Executes the job with the workers and the calling thread. Returns
+   when the job has been completed. Multiple threads can submit jobs
+   at the same time, in which case the workers execute them in the
+   submission order. */
+void pocl_pthread_pool_run (pool_job *job);
+
+/* Fetches the next range of items [*first, *last] to process. Returns 0
+   if there are no items left in the job. The size of the range depends
+   on the scheduling policy selected with POCL_PTHREAD_SCHEDULE and
+   POCL_PTHREAD_CHUNK_SIZE. */
+int pool_job_next_chunk (pool_job *job, size_t *first, size_t *last);
+
+#pragma GCC visibility pop
+
+#endif
@@ -26,21 +26,57 @@
 
 #include "pocl_topology.h"
 
-void
-pocl_topology_detect_device_info(cl_device_id device)
-{
-  hwloc_topology_t pocl_topology;
+#if HWLOC_API_VERSION < 0x00010b00
+#define HWLOC_OBJ_NUMANODE HWLOC_OBJ_NODE
+#endif
 
+/* The topology is loaded once and shared by all the devices. hwloc
+   allows the concurrent queries and bindings on a loaded topology. */
+static hwloc_topology_t pocl_topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+static void
+load_topology (void)
+{
   int ret = hwloc_topology_init(&pocl_topology);
   if (ret == -1)
     POCL_ABORT("Cannot initialize the topology.\n");
-  /*
   ret = hwloc_topology_load(pocl_topology);
   if (ret == -1)
     POCL_ABORT("Cannot load the topology.\n");
-    */
+}
 
-  device->global_mem_size = hwloc_get_root_obj(pocl_topology)->memory.total_memory;
+static hwloc_topology_t
+get_topology (void)
+{
+  pthread_once (&topology_once, load_topology);
+  return pocl_topology;
+}
+
+/* Returns the cpuset of the NUMA node, or of the whole machine if the
+   node is negative or does not exist. */
+static hwloc_const_cpuset_t
+node_cpuset (int node)
+{
+  hwloc_topology_t topology = get_topology ();
+  hwloc_obj_t obj = NULL;
+  if (node >= 0)
+    obj = hwloc_get_obj_by_type (topology, HWLOC_OBJ_NUMANODE, node);
+  if (obj == NULL || obj->cpuset == NULL)
+    obj = hwloc_get_root_obj (topology);
+  return obj->cpuset;
+}
+
+void
+pocl_topology_detect_device_info(cl_device_id device)
+{
+  hwloc_topology_t topology = get_topology ();
+
+#if HWLOC_API_VERSION >= 0x00020000
+  device->global_mem_size = hwloc_get_root_obj(topology)->total_memory;
+#else
+  device->global_mem_size = hwloc_get_root_obj(topology)->memory.total_memory;
+#endif
 
   if (device->global_mem_size/4 > MIN_MAX_MEM_ALLOC_SIZE)
     device->max_mem_alloc_size = device->global_mem_size/4;
@@ -49,3 +85,66 @@ pocl_topology_detect_device_info(cl_device_id device)
 
   device->local_mem_size = device->max_constant_buffer_size = device->max_mem_alloc_size;
 }
+
+unsigned
+pocl_topology_num_nodes (void)
+{
+  int n = hwloc_get_nbobjs_by_type (get_topology (), HWLOC_OBJ_NUMANODE);
+  return n > 0 ? n : 1;
+}
+
+unsigned
+pocl_topology_num_cores (int node)
+{
+  int n = hwloc_get_nbobjs_inside_cpuset_by_type
+    (get_topology (), node_cpuset (node), HWLOC_OBJ_CORE);
+  return n > 0 ? n : 1;
+}
+
+int
+pocl_topology_bind_thread (int node, unsigned index)
+{
+  hwloc_topology_t topology = get_topology ();
+  hwloc_const_cpuset_t cpuset = node_cpuset (node);
+  unsigned cores = pocl_topology_num_cores (node);
+  hwloc_obj_t core;
+
+  /* The cores are numbered in the logical order, which visits the cores
+     of one node before the next one. */
+  core = hwloc_get_obj_inside_cpuset_by_type (topology, cpuset,
+                                              HWLOC_OBJ_CORE, index % cores);
+  if (core == NULL)
+    return -1;
+  return hwloc_set_cpubind (topology, core->cpuset, HWLOC_CPUBIND_THREAD);
+}
+
+int
+pocl_topology_bind_memory (void *ptr, size_t size, int node)
+{
+  return hwloc_set_area_membind
+    (get_topology (), ptr, size, node_cpuset (node),
+     node >= 0 ? HWLOC_MEMBIND_BIND : HWLOC_MEMBIND_INTERLEAVE,
+     HWLOC_MEMBIND_MIGRATE);
+}
+
+size_t
+pocl_topology_llc_size (void)
+{
+  hwloc_obj_t obj = hwloc_get_obj_by_type (get_topology (), HWLOC_OBJ_PU, 0);
+  size_t size = 0;
+
+  /* The caches shared by the core are its ancestors. */
+  for (; obj != NULL; obj = obj->parent)
+    {
+#if HWLOC_API_VERSION >= 0x00020000
+      if (!hwloc_obj_type_is_cache (obj->type))
+        continue;
+#else
+      if (obj->type != HWLOC_OBJ_CACHE)
+        continue;
+#endif
+      if (obj->attr->cache.size > size)
+        size = obj->attr->cache.size;
+    }
+  return size;
+}
@@ -35,6 +35,27 @@
 
 #pragma GCC visibility push(hidden)
 void pocl_topology_detect_device_info(cl_device_id device);
+
+/* Returns the number of NUMA nodes of the machine, at least 1. */
+unsigned pocl_topology_num_nodes (void);
+
+/* Returns the number of cores of the NUMA node, or of the machine if the
+   node is negative. */
+unsigned pocl_topology_num_cores (int node);
+
+/* Binds the calling thread to the index-th core (modulo the number of
+   cores) of the NUMA node, or of the machine if the node is negative.
+   Returns 0 on success. */
+int pocl_topology_bind_thread (int node, unsigned index);
+
+/* Places the pages of the memory area to the NUMA node, or interleaves
+   them over all the nodes if the node is negative. The pages already
+   touched are migrated. Returns 0 on success. */
+int pocl_topology_bind_memory (void *ptr, size_t size, int node);
+
+/* Returns the size in bytes of the largest cache of the first core,
+   or 0 if unknown. */
+size_t pocl_topology_llc_size (void);
 #pragma GCC visibility pop
 
 #endif /* POCL_TOPOLOGY_H */
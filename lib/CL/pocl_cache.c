@@ -0,0 +1,564 @@
+/* OpenCL runtime library: persistent kernel compilation cache
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "config.h"
+#include "pocl_cache.h"
+#include "pocl_llvm.h"
+#include "pocl_runtime_config.h"
+#include "pocl_util.h"
+
+#define CACHE_ENV "POCL_KERNEL_CACHE"
+#define CACHE_DIR_ENV "POCL_KERNEL_CACHE_DIR"
+#define CACHE_SIZE_ENV "POCL_KERNEL_CACHE_MAX_SIZE"
+
+/* In megabytes. */
+#define DEFAULT_CACHE_SIZE 256
+
+/* The temporary files of an insertion are removed by the eviction once
+   they are older than this (in seconds), in case the process writing
+   them died. */
+#define STALE_TEMP_FILE_AGE 3600
+
+/* The options that change the code produced by the kernel compiler. */
+static const char *compiler_options[] =
+  {
+    "POCL_CROSS_COMPILE",
+    "POCL_FULL_REPLICATION_THRESHOLD",
+    "POCL_KERNEL_COMPILER_OPT_SWITCH",
+    "POCL_SCALARIZE_KERNELS",
+    "POCL_VECTORIZE_MEM_ONLY",
+    "POCL_VECTORIZE_NO_FP",
+    "POCL_VECTORIZE_VECTOR_WIDTH",
+    "POCL_VECTORIZE_WORK_GROUPS",
+    "POCL_WILOOPS_MAX_UNROLL_COUNT",
+    "POCL_WORK_GROUP_METHOD",
+    NULL
+  };
+
+/* The headers included to every program by the kernel compiler. */
+static const char *kernel_headers[] =
+  {
+    "_kernel.h",
+    "_kernel_c.h",
+    "pocl_types.h",
+    "pocl_features.h",
+    NULL
+  };
+
+static char cache_dir[POCL_FILENAME_LENGTH];
+static int cache_enabled;
+static off_t cache_max_size;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+/* SHA-1 (FIPS 180-1). */
+
+typedef struct sha1_ctx
+{
+  uint32_t state[5];
+  uint64_t length;
+  unsigned char buffer[64];
+  size_t buffered;
+} sha1_ctx;
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void
+sha1_block (sha1_ctx *ctx, const unsigned char *block)
+{
+  uint32_t w[80], a, b, c, d, e, f, k, t;
+  unsigned i;
+
+  for (i = 0; i < 16; ++i)
+    w[i] = (uint32_t)block[4*i] << 24 | (uint32_t)block[4*i+1] << 16 |
+      (uint32_t)block[4*i+2] << 8 | (uint32_t)block[4*i+3];
+  for (i = 16; i < 80; ++i)
+    w[i] = ROL32 (w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+  a = ctx->state[0];
+  b = ctx->state[1];
+  c = ctx->state[2];
+  d = ctx->state[3];
+  e = ctx->state[4];
+
+  for (i = 0; i < 80; ++i)
+    {
+      if (i < 20)
+        {
+          f = (b & c) | (~b & d);
+          k = 0x5A827999;
+        }
+      else if (i < 40)
+        {
+          f = b ^ c ^ d;
+          k = 0x6ED9EBA1;
+        }
+      else if (i < 60)
+        {
+          f = (b & c) | (b & d) | (c & d);
+          k = 0x8F1BBCDC;
+        }
+      else
+        {
+          f = b ^ c ^ d;
+          k = 0xCA62C1D6;
+        }
+      t = ROL32 (a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = ROL32 (b, 30);
+      b = a;
+      a = t;
+    }
+
+  ctx->state[0] += a;
+  ctx->state[1] += b;
+  ctx->state[2] += c;
+  ctx->state[3] += d;
+  ctx->state[4] += e;
+}
+
+static void
+sha1_init (sha1_ctx *ctx)
+{
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xEFCDAB89;
+  ctx->state[2] = 0x98BADCFE;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xC3D2E1F0;
+  ctx->length = 0;
+  ctx->buffered = 0;
+}
+
+static void
+sha1_update (sha1_ctx *ctx, const void *data, size_t size)
+{
+  const unsigned char *p = (const unsigned char*) data;
+  size_t n;
+
+  ctx->length += size;
+  while (size > 0)
+    {
+      n = 64 - ctx->buffered;
+      if (n > size)
+        n = size;
+      memcpy (ctx->buffer + ctx->buffered, p, n);
+      ctx->buffered += n;
+      p += n;
+      size -= n;
+      if (ctx->buffered == 64)
+        {
+          sha1_block (ctx, ctx->buffer);
+          ctx->buffered = 0;
+        }
+    }
+}
+
+/* Writes the digest as a hex string. */
+static void
+sha1_final (sha1_ctx *ctx, char key[POCL_CACHE_KEY_LENGTH])
+{
+  static const char hex[] = "0123456789abcdef";
+  uint64_t bits = ctx->length * 8;
+  unsigned char pad = 0x80;
+  unsigned char length[8];
+  unsigned i;
+
+  sha1_update (ctx, &pad, 1);
+  pad = 0;
+  while (ctx->buffered != 56)
+    sha1_update (ctx, &pad, 1);
+  for (i = 0; i < 8; ++i)
+    length[i] = (unsigned char)(bits >> (56 - 8 * i));
+  sha1_update (ctx, length, 8);
+
+  for (i = 0; i < 20; ++i)
+    {
+      unsigned char byte = (unsigned char)(ctx->state[i / 4] >>
+                                           (24 - 8 * (i % 4)));
+      key[2*i] = hex[byte >> 4];
+      key[2*i+1] = hex[byte & 0xf];
+    }
+  key[40] = '\0';
+}
+
+/* Hashes a string including its terminating zero, so consecutive
+   strings cannot be confused. */
+static void
+sha1_update_string (sha1_ctx *ctx, const char *s)
+{
+  if (s == NULL)
+    s = "";
+  sha1_update (ctx, s, strlen (s) + 1);
+}
+
+/* Hashes the path, size and modification time of the file, so the
+   entries built from an older version of it are not used. */
+static void
+sha1_update_file_stat (sha1_ctx *ctx, const char *path)
+{
+  struct stat st;
+
+  sha1_update_string (ctx, path);
+  if (stat (path, &st) == 0)
+    {
+      sha1_update (ctx, &st.st_size, sizeof (st.st_size));
+      sha1_update (ctx, &st.st_mtime, sizeof (st.st_mtime));
+    }
+}
+
+/* Creates the directory and its missing parents. */
+static int
+make_directories (char *path)
+{
+  char *p;
+  for (p = path + 1; *p; ++p)
+    {
+      if (*p != '/')
+        continue;
+      *p = '\0';
+      if (mkdir (path, S_IRWXU) != 0 && errno != EEXIST)
+        {
+          *p = '/';
+          return -1;
+        }
+      *p = '/';
+    }
+  if (mkdir (path, S_IRWXU) != 0 && errno != EEXIST)
+    return -1;
+  return 0;
+}
+
+static void
+init_cache (void)
+{
+  const char *dir = pocl_get_string_option (CACHE_DIR_ENV, NULL);
+
+  if (!pocl_get_bool_option (CACHE_ENV, 1))
+    return;
+
+  if (dir != NULL)
+    snprintf (cache_dir, POCL_FILENAME_LENGTH, "%s", dir);
+  else if (getenv ("XDG_CACHE_HOME") != NULL)
+    snprintf (cache_dir, POCL_FILENAME_LENGTH, "%s/pocl/kcache",
+              getenv ("XDG_CACHE_HOME"));
+  else if (getenv ("HOME") != NULL)
+    snprintf (cache_dir, POCL_FILENAME_LENGTH, "%s/.cache/pocl/kcache",
+              getenv ("HOME"));
+  else
+    return;
+
+  if (make_directories (cache_dir) != 0)
+    return;
+
+  cache_max_size =
+    (off_t)pocl_get_int_option (CACHE_SIZE_ENV, DEFAULT_CACHE_SIZE)
+    * 1024 * 1024;
+  cache_enabled = 1;
+}
+
+int
+pocl_cache_enabled (void)
+{
+  pthread_once (&cache_once, init_cache);
+  return cache_enabled;
+}
+
+void
+pocl_cache_program_key (cl_device_id device, const char *options,
+                        const void *input, size_t input_size,
+                        char key[POCL_CACHE_KEY_LENGTH])
+{
+  char library[POCL_FILENAME_LENGTH];
+  sha1_ctx ctx;
+  unsigned i;
+
+  sha1_init (&ctx);
+  sha1_update_string (&ctx, "program " PACKAGE_VERSION);
+  sha1_update_string (&ctx, device->llvm_target_triplet);
+  sha1_update_string (&ctx, device->llvm_cpu);
+  sha1_update_string (&ctx, options);
+
+  /* A rebuilt kernel library invalidates the entries built with the
+     old one. */
+  pocl_llvm_get_kernel_library_path (device, library);
+  sha1_update_file_stat (&ctx, library);
+
+  for (i = 0; compiler_options[i] != NULL; ++i)
+    {
+      sha1_update_string (&ctx, compiler_options[i]);
+      sha1_update_string (&ctx, getenv (compiler_options[i]));
+    }
+
+  sha1_update (&ctx, &input_size, sizeof (input_size));
+  sha1_update (&ctx, input, input_size);
+  sha1_final (&ctx, key);
+}
+
+void
+pocl_cache_header_key (cl_device_id device, const char *options,
+                       const char *include_dir,
+                       char key[POCL_CACHE_KEY_LENGTH])
+{
+  char path[POCL_FILENAME_LENGTH];
+  sha1_ctx ctx;
+  unsigned i;
+
+  sha1_init (&ctx);
+  sha1_update_string (&ctx, "header " PACKAGE_VERSION);
+  sha1_update_string (&ctx, device->llvm_target_triplet);
+  sha1_update_string (&ctx, device->llvm_cpu);
+  sha1_update_string (&ctx, options);
+
+  /* The precompiled headers are not portable across Clang versions.
+     The kernel library is rebuilt with pocl for a new one. */
+  pocl_llvm_get_kernel_library_path (device, path);
+  sha1_update_file_stat (&ctx, path);
+
+  for (i = 0; kernel_headers[i] != NULL; ++i)
+    {
+      snprintf (path, POCL_FILENAME_LENGTH, "%s/%s", include_dir,
+                kernel_headers[i]);
+      sha1_update_file_stat (&ctx, path);
+    }
+  sha1_final (&ctx, key);
+}
+
+void
+pocl_cache_workgroup_key (const char *program_key, const char *function_name,
+                          size_t local_x, size_t local_y, size_t local_z,
+                          char key[POCL_CACHE_KEY_LENGTH])
+{
+  sha1_ctx ctx;
+
+  sha1_init (&ctx);
+  sha1_update_string (&ctx, "workgroup");
+  sha1_update_string (&ctx, program_key);
+  sha1_update_string (&ctx, function_name);
+  sha1_update (&ctx, &local_x, sizeof (size_t));
+  sha1_update (&ctx, &local_y, sizeof (size_t));
+  sha1_update (&ctx, &local_z, sizeof (size_t));
+  sha1_final (&ctx, key);
+}
+
+static void
+entry_path (char *path, const char *key, const char *suffix)
+{
+  snprintf (path, POCL_FILENAME_LENGTH, "%s/%s.%s", cache_dir, key, suffix);
+}
+
+/* Copies src to dest by writing a temporary file next to dest and
+   renaming it, so dest is never seen incomplete. */
+static int
+copy_file (const char *src, const char *dest)
+{
+  char tmp[POCL_FILENAME_LENGTH];
+  char buf[65536];
+  ssize_t n;
+  int in, out, error = 0;
+
+  in = open (src, O_RDONLY);
+  if (in < 0)
+    return -1;
+
+  snprintf (tmp, POCL_FILENAME_LENGTH, "%s.tmp.%ld.%lu", dest,
+            (long)getpid (), pocl_unique_id ());
+  out = open (tmp, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IXUSR);
+  if (out < 0)
+    {
+      close (in);
+      return -1;
+    }
+
+  while ((n = read (in, buf, sizeof (buf))) > 0)
+    {
+      if (write (out, buf, n) != n)
+        {
+          error = -1;
+          break;
+        }
+    }
+  if (n < 0)
+    error = -1;
+
+  close (in);
+  if (close (out) != 0)
+    error = -1;
+
+  if (error == 0 && rename (tmp, dest) != 0)
+    error = -1;
+  if (error != 0)
+    unlink (tmp);
+  return error;
+}
+
+int
+pocl_cache_fetch (const char *key, const char *suffix, const char *dest)
+{
+  char path[POCL_FILENAME_LENGTH];
+
+  if (!pocl_cache_enabled ())
+    return 0;
+
+  /* Copy instead of linking, the files in the temporary directories 
+     can be rewritten in place. */
+  entry_path (path, key, suffix);
+  if (copy_file (path, dest) != 0)
+    return 0;
+
+  /* The modification time tells the last use for the eviction. */
+  utime (path, NULL);
+  return 1;
+}
+
+int
+pocl_cache_fetch_shared (const char *key, const char *suffix,
+                         const char *dest)
+{
+  char path[POCL_FILENAME_LENGTH];
+
+  if (!pocl_cache_enabled ())
+    return 0;
+
+  /* A link keeps the file even if the entry is evicted meanwhile. */
+  entry_path (path, key, suffix);
+  unlink (dest);
+  if (link (path, dest) != 0)
+    return pocl_cache_fetch (key, suffix, dest);
+
+  utime (path, NULL);
+  return 1;
+}
+
+typedef struct cache_entry
+{
+  char *name;
+  off_t size;
+  time_t mtime;
+} cache_entry;
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  time_t ta = ((const cache_entry*)a)->mtime;
+  time_t tb = ((const cache_entry*)b)->mtime;
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Removes the least recently used entries until the cache fits its
+   maximum size. Other processes can remove the same entries at the
+   same time, which is harmless. The processes that have fetched an
+   entry have their own copy of it. */
+static void
+evict_entries (void)
+{
+  char path[POCL_FILENAME_LENGTH];
+  cache_entry *entries = NULL, *grown;
+  size_t num_entries = 0, max_entries = 0, i;
+  off_t total_size = 0;
+  struct dirent *de;
+  struct stat st;
+  time_t now = time (NULL);
+  DIR *dir;
+
+  dir = opendir (cache_dir);
+  if (dir == NULL)
+    return;
+
+  while ((de = readdir (dir)) != NULL)
+    {
+      if (de->d_name[0] == '.')
+        continue;
+      snprintf (path, POCL_FILENAME_LENGTH, "%s/%s", cache_dir, de->d_name);
+      if (stat (path, &st) != 0 || !S_ISREG (st.st_mode))
+        continue;
+
+      if (strstr (de->d_name, ".tmp.") != NULL)
+        {
+          if (now - st.st_mtime > STALE_TEMP_FILE_AGE)
+            unlink (path);
+          continue;
+        }
+
+      if (num_entries == max_entries)
+        {
+          max_entries = max_entries ? 2 * max_entries : 64;
+          grown = (cache_entry*) realloc (entries,
+                                          max_entries * sizeof (cache_entry));
+          if (grown == NULL)
+            break;
+          entries = grown;
+        }
+      entries[num_entries].name = strdup (de->d_name);
+      entries[num_entries].size = st.st_size;
+      entries[num_entries].mtime = st.st_mtime;
+      total_size += st.st_size;
+      ++num_entries;
+    }
+  closedir (dir);
+
+  if (total_size > cache_max_size)
+    {
+      qsort (entries, num_entries, sizeof (cache_entry), compare_entries);
+      for (i = 0; i < num_entries && total_size > cache_max_size; ++i)
+        {
+          snprintf (path, POCL_FILENAME_LENGTH, "%s/%s", cache_dir,
+                    entries[i].name);
+          unlink (path);
+          total_size -= entries[i].size;
+        }
+    }
+
+  for (i = 0; i < num_entries; ++i)
+    free (entries[i].name);
+  free (entries);
+}
+
+void
+pocl_cache_insert (const char *key, const char *suffix, const char *src)
+{
+  char path[POCL_FILENAME_LENGTH];
+
+  if (!pocl_cache_enabled ())
+    return;
+
+  entry_path (path, key, suffix);
+  if (access (path, F_OK) == 0)
+    return;
+
+  if (copy_file (src, path) == 0)
+    evict_entries ();
+}
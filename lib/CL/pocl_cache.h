@@ -0,0 +1,88 @@
+/* OpenCL runtime library: persistent kernel compilation cache
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/* The compilation results are stored in a cache directory shared by
+   all the processes of the user, so a restarted application does not
+   have to compile its kernels again.
+
+   The entries are files named by the SHA-1 hash of everything that
+   affects their contents (the key) and a suffix telling the kind of
+   the file. The entries are written to a temporary file first and then
+   renamed, so the other processes see either a complete entry or
+   none. The least recently used entries are removed when the cache
+   grows over its maximum size. */
+
+#ifndef POCL_CACHE_H
+#define POCL_CACHE_H
+
+#include "pocl_cl.h"
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Returns non-zero if the cache is enabled and its directory could be
+   created. */
+int pocl_cache_enabled (void);
+
+/* Computes the key of the program bitcode built for the device from
+   the source or binary input with the build options. */
+void pocl_cache_program_key (cl_device_id device, const char *options,
+                             const void *input, size_t input_size,
+                             char key[POCL_CACHE_KEY_LENGTH]);
+
+/* Computes the key of the work-group function of the kernel for the
+   local size from the key of the program build. */
+void pocl_cache_workgroup_key (const char *program_key,
+                               const char *function_name,
+                               size_t local_x, size_t local_y,
+                               size_t local_z,
+                               char key[POCL_CACHE_KEY_LENGTH]);
+
+/* Computes the key of the precompiled kernel headers found in the
+   include_dir for the device and the frontend options. */
+void pocl_cache_header_key (cl_device_id device, const char *options,
+                            const char *include_dir,
+                            char key[POCL_CACHE_KEY_LENGTH]);
+
+/* Makes the entry with the key and the suffix available as the file
+   dest. Returns non-zero if the entry was found. */
+int pocl_cache_fetch (const char *key, const char *suffix, const char *dest);
+
+/* Like pocl_cache_fetch, but dest may share the storage with the entry,
+   so it must not be modified in place. */
+int pocl_cache_fetch_shared (const char *key, const char *suffix,
+                             const char *dest);
+
+/* Stores a copy of the file src to the cache as the entry with the key
+   and the suffix. */
+void pocl_cache_insert (const char *key, const char *suffix,
+                        const char *src);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
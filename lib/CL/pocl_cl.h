@@ -38,6 +38,8 @@
 #include "pocl.h"
 
 #define POCL_FILENAME_LENGTH 1024
+/* A SHA-1 digest in hex with the terminating zero. */
+#define POCL_CACHE_KEY_LENGTH 41
 
 #define POCL_BUILD "pocl-build"
 #define POCL_KERNEL "pocl-kernel"
@@ -107,20 +109,27 @@ typedef pthread_mutex_t pocl_lock_t;
 #define POCL_LOCK_OBJ(__OBJ__) POCL_LOCK((__OBJ__)->pocl_lock)
 #define POCL_UNLOCK_OBJ(__OBJ__) POCL_UNLOCK((__OBJ__)->pocl_lock)
 
+/* The objects can be retained and released concurrently by the
+   application threads and the command queue dispatchers. */
 #define POCL_RELEASE_OBJECT(__OBJ__, __NEW_REFCOUNT__)  \
   do {                                                  \
+    POCL_LOCK_OBJ (__OBJ__);                            \
     __NEW_REFCOUNT__ = --(__OBJ__)->pocl_refcount;      \
+    POCL_UNLOCK_OBJ (__OBJ__);                          \
   } while (0)                          
 
 #define POCL_RETAIN_OBJECT(__OBJ__)             \
   do {                                          \
+    POCL_LOCK_OBJ (__OBJ__);                    \
     (__OBJ__)->pocl_refcount++;                   \
+    POCL_UNLOCK_OBJ (__OBJ__);                  \
   } while (0)
 
 /* The reference counter is initialized to 1,
    when it goes to 0 object can be freed. */
 #define POCL_INIT_OBJECT_NO_ICD(__OBJ__)         \
   do {                                           \
+    POCL_INIT_LOCK ((__OBJ__)->pocl_lock);       \
     (__OBJ__)->pocl_refcount = 1;                  \
   } while (0)
 
@@ -239,6 +248,17 @@ void (*fill_rect) (void *data,
                    void *fill_pixel,
                    size_t pixel_size);
 
+  /* Fills 'size' bytes of device global memory at device_ptr with the
+     pattern repeated. If NULL, the runtime writes a filled host buffer. */
+  void (*fill) (void *data, void *device_ptr, size_t size,
+                const void *pattern, size_t pattern_size);
+
+  /* Moves the memory objects to the memory close to the device, or to
+     the host with CL_MIGRATE_MEM_OBJECT_HOST. The devices sharing their
+     global memory with the host can leave this NULL. */
+  void (*migrate) (cl_device_id device, cl_mem *mem_objects,
+                   cl_uint num_mem_objects, cl_mem_migration_flags flags);
+
   /* Maps 'size' bytes of device global memory at buf_ptr + offset to 
      host-accessible memory. This might or might not involve copying 
      the block from the device. */
@@ -246,6 +266,9 @@ void (*fill_rect) (void *data,
   void* (*unmap_mem) (void *data, void *host_ptr, void *device_start_ptr, size_t size);
   
   void (*compile_submitted_kernels) (_cl_command_node* cmd);
+  /* Forgets the work-group functions the device has loaded for the
+     program, which is being released. May be NULL. */
+  void (*free_program) (cl_device_id device, cl_program program);
   void (*run) (void *data, _cl_command_node* cmd);
   void (*run_native) (void *data, _cl_command_node* cmd);
 
@@ -347,6 +370,14 @@ struct _cl_device_id {
   int dev_id;
   int global_mem_id; /* identifier for device global memory */
   int has_64bit_long;  /* Does the device have 64bit longs */
+  /* Does the device fill in the local size of the pocl_context, that is,
+     can it run the work-group functions generated for a dynamic local
+     size */
+  int dynamic_local_size;
+  /* Does the device pass a scratch buffer of the size the work-group
+     function asks for in the pocl_context, that is, can the kernel
+     compiler move the context arrays off the stack */
+  int context_scratch;
 
   struct pocl_device_ops *ops; /* Device operations, shared amongst same devices */
 };
@@ -364,6 +395,10 @@ struct _cl_context {
   /* implementation */
   unsigned num_devices;
   unsigned num_properties;
+  /* The page size of the large buffers and whether to pre-fault the
+     buffers, see CL_CONTEXT_PAGE_SIZE_POCL and CL_CONTEXT_PREFAULT_POCL. */
+  size_t page_size;
+  cl_bool prefault;
   /* some OpenCL apps (AMD OpenCL SDK at least) use a trial-error 
      approach for creating a context with a device type, and call 
      clReleaseContext for the result regardless if it failed or not. 
@@ -380,6 +415,16 @@ struct _cl_command_queue {
   cl_command_queue_properties properties;
   /* implementation */
   _cl_command_node *root;
+  /* The commands taken to execution from root. */
+  _cl_command_node *running;
+  /* The background threads executing the commands and their state, 
+     see pocl_queue_util.h. Protected by the lock in pocl_queue_util.c. */
+  pthread_t *dispatchers;
+  unsigned num_dispatchers;
+  unsigned num_alive_dispatchers;
+  pthread_cond_t wakeup_cond;
+  pthread_cond_t finish_cond;
+  int exit;
 };
 
 /* memory identifier: id to point the global memory where memory resides 
@@ -448,10 +493,45 @@ struct _cl_program {
   unsigned char **binaries; 
   /* Temp directory (relative to CWD) where the kernel files reside. */
   char *temp_dir;
+  /* Identifies the program uniquely during the process lifetime, unlike
+     its address which can be reused for a new program. */
+  unsigned long id;
   /* implementation */
   cl_kernel kernels;
   /* Used to store the llvm IR of the build to save disk I/O. */
   void **llvm_irs;
+  /* The keys of the builds for each device in the kernel cache. */
+  char (*cache_keys)[POCL_CACHE_KEY_LENGTH];
+};
+
+/* A work-group function of a kernel that has been generated and loaded
+   for a device and a local size. Lets the repeated launches skip the
+   file system checks of the compilation. */
+typedef struct pocl_wg_cache_item pocl_wg_cache_item;
+struct pocl_wg_cache_item
+{
+  cl_device_id device;
+  size_t local_x;
+  size_t local_y;
+  size_t local_z;
+  char *tmp_dir;
+  pocl_workgroup wg;
+  pocl_workgroup_range wg_range;
+  size_t context_scratch_size;
+  pocl_wg_cache_item *next;
+};
+
+/* The number of launches of a kernel with a local size not having a
+   specialized work-group function yet. */
+typedef struct pocl_local_size_count pocl_local_size_count;
+struct pocl_local_size_count
+{
+  cl_device_id device;
+  size_t local_x;
+  size_t local_y;
+  size_t local_z;
+  unsigned launches;
+  pocl_local_size_count *next;
 };
 
 struct _cl_kernel {
@@ -469,11 +549,23 @@ struct _cl_kernel {
   cl_int *arg_is_local;
   cl_int *arg_is_image;
   cl_int *arg_is_sampler;
+  /* The image arguments declared read_only. */
+  cl_int *arg_is_read_only;
   cl_uint num_locals;
   int *reqd_wg_size;
   /* The kernel arguments that are set with clSetKernelArg().
      These are copied to the command queue command at enqueue. */
   struct pocl_argument *dyn_arguments;
+  /* The work-group functions already generated for this kernel.
+     Protected by the kernel lock. */
+  pocl_wg_cache_item *wg_cache;
+  /* The launches executed with the dynamic local size work-group
+     function. Protected by the kernel lock. */
+  pocl_local_size_count *local_size_counts;
+  /* The kernel extracted from the llvm IR of the program build, 
+     indexed with the dev_id of the device. */
+  void **llvm_irs;
+  unsigned num_llvm_irs;
   struct _cl_kernel *next;
 };
 
@@ -486,6 +578,14 @@ struct event_callback_item
   void *next;
 };
 
+/* A command queue to wake up when an event completes. */
+typedef struct queue_notify_item queue_notify_item;
+struct queue_notify_item
+{
+  cl_command_queue queue;
+  queue_notify_item *next;
+};
+
 typedef struct _cl_event _cl_event;
 struct _cl_event {
   POCL_ICD_OBJECT
@@ -498,6 +598,12 @@ struct _cl_event {
 
   /* The execution status of the command this event is monitoring. */
   cl_int status;
+  /* Broadcast when the status changes to CL_COMPLETE. Used with the
+     object lock. */
+  pthread_cond_t completion_cond;
+  /* The queues that have commands waiting for this event. Protected
+     by the lock in pocl_queue_util.c. */
+  queue_notify_item *notify_list;
 
   /* Profiling data: time stamps of the different phases of execution. */
   cl_ulong time_queue;  /* the enqueue time */
@@ -557,10 +663,13 @@ struct _cl_sampler {
     if ((__event) != NULL && (*(__event)) != NULL)                      \
       {                                                                 \
         assert((*(__event))->status == CL_RUNNING);                     \
-        (*(__event))->status = CL_COMPLETE;                             \
         if ((__cq)->properties & CL_QUEUE_PROFILING_ENABLE)             \
           (*(__event))->time_end =                                      \
             (__cq)->device->ops->get_timer_value((__cq)->device->data);      \
+        POCL_LOCK_OBJ (*(__event));                                     \
+        (*(__event))->status = CL_COMPLETE;                             \
+        pthread_cond_broadcast (&(*(__event))->completion_cond);        \
+        POCL_UNLOCK_OBJ (*(__event));                                   \
       }                                                                 \
   } while (0)                                                           \
 
@@ -151,9 +151,9 @@ struct _cl_icd_dispatch {
   NULL, /* &POclLinkProgram,             */ \
   NULL, /* &POclUnloadPlatformCompiler,  */ \
   NULL, /* &POclGetKernelArgInfo,        */ \
-  NULL, /* &POclEnqueueFillBuffer,        */ \
+  &POclEnqueueFillBuffer,        \
   &POclEnqueueFillImage,         \
-  NULL, /* &POclEnqueueMigrateMemObjects, */ \
+  &POclEnqueueMigrateMemObjects, \
   &POclEnqueueMarkerWithWaitList,  \
   NULL, /* &POclEnqueueBarrierWithWaitList, */ \
   NULL, /* &POclGetExtensionFunctionAddressForPlatform, */ \
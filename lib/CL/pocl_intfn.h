@@ -67,6 +67,8 @@ POdeclsym(clEnqueueWriteBuffer)
 POdeclsym(clEnqueueWriteBufferRect)
 POdeclsym(clEnqueueWriteImage)
 POdeclsym(clEnqueueFillImage)
+POdeclsym(clEnqueueFillBuffer)
+POdeclsym(clEnqueueMigrateMemObjects)
 POdeclsym(clFinish)
 POdeclsym(clFlush)
 POdeclsym(clGetCommandQueueInfo)
@@ -0,0 +1,213 @@
+/* OpenCL runtime library: large page backing of the buffers
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pocl_large_pages.h"
+#include "pocl_util.h"
+
+#if !defined MAP_ANONYMOUS && defined MAP_ANON
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* The transparent huge pages are used in this size. */
+#define DEFAULT_HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+/* The allocations are kept in a hash table by their address, as the
+   device free functions only get the pointer. */
+#define MAPPING_BUCKETS 64
+
+typedef struct large_mapping large_mapping;
+struct large_mapping
+{
+  void *ptr;
+  size_t size;
+  large_mapping *next;
+};
+
+static large_mapping *mappings[MAPPING_BUCKETS];
+static unsigned num_mappings = 0;
+static pocl_lock_t mappings_lock = POCL_LOCK_INITIALIZER;
+
+static unsigned
+mapping_bucket (void *ptr)
+{
+  /* The mappings are aligned to the huge pages. */
+  return ((uintptr_t)ptr / DEFAULT_HUGE_PAGE_SIZE) % MAPPING_BUCKETS;
+}
+
+#ifdef MAP_ANONYMOUS
+
+/* Maps size bytes aligned to the alignment with the normal pages. */
+static void *
+map_aligned (size_t size, size_t alignment)
+{
+  char *p = (char*) mmap (NULL, size + alignment, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  char *aligned;
+  if (p == MAP_FAILED)
+    return NULL;
+
+  /* Unmap the parts before and after the aligned area. */
+  aligned = (char*)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+  if (aligned > p)
+    munmap (p, aligned - p);
+  munmap (aligned + size, p + alignment - aligned);
+  return aligned;
+}
+
+#endif
+
+void *
+pocl_large_pages_alloc (cl_context context, size_t size)
+{
+#ifdef MAP_ANONYMOUS
+  size_t page_size = context->page_size;
+  size_t small_page_size = (size_t)sysconf (_SC_PAGESIZE);
+  size_t alignment = page_size ? page_size : DEFAULT_HUGE_PAGE_SIZE;
+  size_t length;
+  large_mapping *m;
+  void *p = NULL;
+
+  if (page_size != 0 && page_size <= small_page_size)
+    return NULL;
+  if (size < POCL_LARGE_BUFFER_SIZE || size < alignment)
+    return NULL;
+
+  m = (large_mapping*) malloc (sizeof (large_mapping));
+  if (m == NULL)
+    return NULL;
+  length = (size + alignment - 1) & ~(alignment - 1);
+
+# ifdef MAP_HUGETLB
+  /* An explicit page size gets the pages from the huge page pool of
+     the system. If the pool is empty, fall back to the transparent
+     huge pages. */
+  if (page_size != 0)
+    {
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#  ifdef MAP_HUGE_SHIFT
+      int log2_size = 0;
+      while (((size_t)1 << log2_size) < page_size)
+        ++log2_size;
+      flags |= log2_size << MAP_HUGE_SHIFT;
+#  endif
+      p = mmap (NULL, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (p == MAP_FAILED)
+        p = NULL;
+    }
+# endif
+
+  if (p == NULL)
+    {
+      p = map_aligned (length, alignment);
+      if (p == NULL)
+        {
+          free (m);
+          return NULL;
+        }
+# ifdef MADV_HUGEPAGE
+      madvise (p, length, MADV_HUGEPAGE);
+# endif
+    }
+
+  m->ptr = p;
+  m->size = length;
+  POCL_LOCK (mappings_lock);
+  m->next = mappings[mapping_bucket (p)];
+  mappings[mapping_bucket (p)] = m;
+  ++num_mappings;
+  POCL_UNLOCK (mappings_lock);
+  return p;
+#else
+  return NULL;
+#endif
+}
+
+int
+pocl_large_pages_free (void *ptr)
+{
+  large_mapping **mp, *m = NULL;
+
+  /* The buffer being freed was registered before it was handed out,
+     so no mappings means it is not one of them. */
+  if (num_mappings == 0 || ptr == NULL)
+    return 1;
+
+  POCL_LOCK (mappings_lock);
+  for (mp = &mappings[mapping_bucket (ptr)]; *mp != NULL; mp = &(*mp)->next)
+    {
+      if ((*mp)->ptr == ptr)
+        {
+          m = *mp;
+          *mp = m->next;
+          --num_mappings;
+          break;
+        }
+    }
+  POCL_UNLOCK (mappings_lock);
+
+  if (m == NULL)
+    return 1;
+#ifdef MAP_ANONYMOUS
+  munmap (m->ptr, m->size);
+#endif
+  free (m);
+  return 0;
+}
+
+void
+pocl_prefault_buffer (cl_context context, void *ptr, size_t size)
+{
+  size_t step = (size_t)sysconf (_SC_PAGESIZE);
+  size_t offset;
+
+  if (!context->prefault)
+    return;
+
+  /* Writing makes the kernel allocate the page, reading could map the
+     shared zero page only. */
+  for (offset = 0; offset < size; offset += step)
+    ((volatile char*)ptr)[offset] = 0;
+}
+
+void *
+pocl_alloc_host_buffer (cl_context context, size_t size)
+{
+  void *p = pocl_large_pages_alloc (context, size);
+  if (p != NULL)
+    return p;
+  /* pocl_aligned_malloc wants the size in multiples of the alignment. */
+  size = (size + MAX_EXTENDED_ALIGNMENT - 1) & ~(MAX_EXTENDED_ALIGNMENT - 1);
+  return pocl_aligned_malloc (MAX_EXTENDED_ALIGNMENT, size);
+}
+
+void
+pocl_free_host_buffer (void *ptr)
+{
+  if (pocl_large_pages_free (ptr) != 0)
+    pocl_aligned_free (ptr);
+}
@@ -0,0 +1,68 @@
+/* OpenCL runtime library: large page backing of the buffers
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/* The large buffers in the host memory are mapped with huge pages to
+   reduce the TLB misses and the page faults when they are accessed.
+   The page size and the pre-faulting are set per context with the
+   CL_CONTEXT_PAGE_SIZE_POCL and CL_CONTEXT_PREFAULT_POCL properties. */
+
+#ifndef POCL_LARGE_PAGES_H
+#define POCL_LARGE_PAGES_H
+
+#include "pocl_cl.h"
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The smallest buffer allocated with the large pages. */
+#define POCL_LARGE_BUFFER_SIZE ((size_t)2 * 1024 * 1024)
+
+/* Allocates the memory of a buffer of the context with the large pages.
+   Returns NULL if the buffer is too small for them, the context disables
+   them, or the allocation fails, in which case the caller should use its
+   usual allocator. The memory is aligned to MAX_EXTENDED_ALIGNMENT at
+   least. */
+void *pocl_large_pages_alloc (cl_context context, size_t size);
+
+/* Frees the memory if it was allocated with pocl_large_pages_alloc.
+   Returns non-zero if it was not. */
+int pocl_large_pages_free (void *ptr);
+
+/* Faults in the pages of a new buffer if the context pre-faults the
+   buffers. The contents of the buffer are overwritten. */
+void pocl_prefault_buffer (cl_context context, void *ptr, size_t size);
+
+/* Allocates and frees the host memory of a CL_MEM_ALLOC_HOST_PTR
+   buffer, which the devices in the host address space use as their
+   storage of the buffer, so mapping it never copies. */
+void *pocl_alloc_host_buffer (cl_context context, size_t size);
+void pocl_free_host_buffer (void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
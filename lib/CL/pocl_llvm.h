@@ -29,6 +29,11 @@
 extern "C" {
 #endif
 
+/* The build option that sets the vectorization width of the work-item
+   loops, e.g. -cl-pocl-vector-width=8. Zero or no option chooses the
+   width for the target of the device. */
+#define POCL_VECTOR_WIDTH_OPTION "-cl-pocl-vector-width="
+
 /* Compiles an .cl file into LLVM IR.
  */
 int pocl_llvm_build_program
@@ -61,9 +66,12 @@ int pocl_llvm_get_kernel_metadata
  * Output is a LLVM bitcode file that contains a work-group function
  * and its associated launchers. 
  *
- * TODO: this is not thread-safe, it changes the LLVM global options to
- * control the compilation. We should enforce only one compilations is done
- * at a time or control the options through thread safe methods.
+ * If the local size is zero in all the dimensions, the work-group
+ * function reads the local size of each launch from the pocl_context
+ * instead, up to the maximum work-group size of the device.
+ *
+ * Can be called from several threads at the same time, each compilation
+ * runs in an LLVM context of its own.
  */
 int pocl_llvm_generate_workgroup_function
 (cl_device_id device,
@@ -72,6 +80,55 @@ int pocl_llvm_generate_workgroup_function
  const char* parallel_filename,
  const char* kernel_filename);
 
+/**
+ * Generates the machine code of the work-group function produced with
+ * pocl_llvm_generate_workgroup_function to the memory of this process
+ * and returns a pointer to it. The function executing a range of work
+ * groups is returned in wg_range and the size of the scratch buffer
+ * they need in the context in context_scratch_size.
+ *
+ * Returns NULL if the device cannot execute code generated for the host
+ * or the code generation failed, in which case the caller should fall
+ * back to building a shared library with the external tools.
+ */
+pocl_workgroup pocl_llvm_jit_workgroup_function
+(cl_device_id device,
+ cl_kernel kernel,
+ const char* parallel_filename,
+ pocl_workgroup_range *wg_range,
+ size_t *context_scratch_size);
+
+/**
+ * Returns nonzero if the work-group functions for the device are
+ * generated in-process with pocl_llvm_jit_workgroup_function.
+ */
+int pocl_llvm_jit_enabled (cl_device_id device);
+
+/**
+ * Frees the work-group functions generated in-process for the kernels
+ * of the program. Called when the program is released.
+ */
+void pocl_llvm_release_workgroup_functions (cl_program program);
+
+/**
+ * Writes the path of the built-in function library bitcode of the
+ * device to path, which has room for POCL_FILENAME_LENGTH characters.
+ */
+void pocl_llvm_get_kernel_library_path (cl_device_id device, char *path);
+
+/**
+ * Writes the bitcode of the program built for the device_i:th device
+ * of the program to the file.
+ */
+void pocl_llvm_write_program_binary (cl_program program, int device_i,
+                                     const char *filename);
+
+/**
+ * Free the per-kernel LLVM IR the kernel compiler has stored to the
+ * kernel.
+ */
+void pocl_llvm_release_kernel (cl_kernel kernel);
+
 /**
  * Refresh the on binary representation of the program, update the
  * data in the program object. 
@@ -28,12 +28,19 @@
 #include "clang/CodeGen/CodeGenAction.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/TextDiagnosticBuffer.h"
 #include "llvm/LinkAllPasses.h"
 #include "llvm/Linker.h"
 #include "llvm/PassManager.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#ifndef LLVM_3_2
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#endif
 
 #ifdef LLVM_3_2
 #include "llvm/Function.h"
@@ -50,8 +57,11 @@
 #endif
 
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
-//#include "llvm/Support/MutexGuard.h"
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+#include "llvm/Support/Threading.h"
+#endif
 #include "llvm/Support/raw_os_ostream.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
@@ -62,16 +72,23 @@
 #include "llvm/MC/SubtargetFeature.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <vector>
+#include <set>
 #include <sstream>
 #include <string>
 
 // Note - LLVM/Clang uses symbols defined in Khronos' headers in macros, 
 // causing compilation error if they are included before the LLVM headers.
 #include "pocl_llvm.h"
+#include "pocl_cache.h"
 #include "pocl_runtime_config.h"
 #include "install-paths.h"
 #include "LLVMUtils.h"
@@ -109,39 +126,236 @@ using llvm::sys::fs::F_Binary;
 #endif
 
 
+/* The symbol index of a Module: the global values each global value
+   of the Module refers to directly. */
+typedef std::map<const llvm::GlobalValue*,
+                 std::set<const llvm::GlobalValue*> > symbol_index;
+
 /**
- * Use one global LLVMContext across all LLVM bitcodes. This is because
- * we want to cache the bitcode IR libraries and reuse them when linking
- * new kernels. The CloneModule etc. seem to assume we are linking
- * bitcodes with a same LLVMContext. Unfortunately, this requires serializing
- * all calls to the LLVM APIs with mutex.
- * Freeing/deleting the context crashes LLVM 3.2 (at program exit), as a
- * work-around, allocate this from heap.
+ * The LLVM state of one kernel compilation: an LLVMContext and the
+ * kernel libraries and the kernel compiler passes created in it.
+ *
+ * An LLVMContext and everything created in it can be used by only one
+ * thread at a time, so each compilation running in parallel takes a
+ * slot of its own. The slots are created on demand up to
+ * POCL_MAX_PARALLEL_COMPILATIONS and never freed, as the Modules of the
+ * programs built in them are kept. Freeing/deleting the context crashes
+ * LLVM 3.2 (at program exit) anyhow.
  */
-static LLVMContext *globalContext=NULL;
-
-/* The LLVM API interface functions are not at the moment not thread safe,
-   ensure only one thread is using this layer at the time with a mutex. */
-//static pocl_lock_t kernel_compiler_lock = POCL_LOCK_INITIALIZER;
+struct compiler_slot
+{
+  LLVMContext *context;
+  std::map<cl_device_id, llvm::Module*> kernel_libraries;
+  std::map<cl_device_id, symbol_index> kernel_library_indices;
+  std::map<cl_device_id, PassManager*> kernel_compiler_passes;
+  bool busy;
+};
 
-//static llvm::sys::Mutex kernelCompilerLock;
+static std::vector<compiler_slot*> compiler_slots;
+static pocl_lock_t compiler_slots_lock = POCL_LOCK_INITIALIZER;
+static pthread_cond_t compiler_slot_released = PTHREAD_COND_INITIALIZER;
 
 //#define DEBUG_POCL_LLVM_API
 
+/* The work-group function modules generated in this process, by the 
+   name of the parallel bitcode file written of them. The in-process
+   code generation consumes these instead of parsing the file. The
+   modules not consumed are freed with their program. */
+struct workgroup_module
+{
+  llvm::Module *module;
+  cl_program program;
+};
+static std::map<std::string, workgroup_module> workgroup_modules;
+/* Generation and code generation run in different threads. Protects
+   also workgroup_engines. */
+static pocl_lock_t workgroup_modules_lock = POCL_LOCK_INITIALIZER;
+
+/* The execution engines owning the machine code of the loaded 
+   work-group functions, by their program. The devices cache the
+   functions by the program, thus they are freed with the program. */
+struct workgroup_engine
+{
+  llvm::ExecutionEngine *engine;
+  llvm::LLVMContext *context;
+};
+static std::multimap<cl_program, workgroup_engine> workgroup_engines;
+
+static pthread_once_t llvm_initialized = PTHREAD_ONCE_INIT;
+
+/* The global LLVM initialization shared by all the compiler slots. */
+static void
+initialize_llvm()
+{
+#if defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4
+  llvm_start_multithreaded();
+#endif
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeScalarOpts(Registry);
+  initializeVectorization(Registry);
+  initializeIPO(Registry);
+  initializeAnalysis(Registry);
+  initializeIPA(Registry);
+  initializeTransformUtils(Registry);
+  initializeInstCombine(Registry);
+  initializeInstrumentation(Registry);
+  initializeTarget(Registry);
+}
+
+/**
+ * Take a free compiler slot for a compilation, preferring the slot
+ * owning the given context (which may be NULL). A new slot is created
+ * if all of them are busy and the maximum has not been reached,
+ * otherwise waits for one to be released.
+ */
+static compiler_slot *
+lock_compiler(LLVMContext *preferred)
+{
+  pthread_once(&llvm_initialized, initialize_llvm);
+
+  static const unsigned max_slots =
+    std::max(1, pocl_get_int_option("POCL_MAX_PARALLEL_COMPILATIONS",
+                                    sysconf(_SC_NPROCESSORS_ONLN)));
+
+  POCL_LOCK(compiler_slots_lock);
+  compiler_slot *slot = NULL;
+  while (slot == NULL)
+    {
+      for (size_t i = 0; i < compiler_slots.size(); ++i)
+        {
+          compiler_slot *s = compiler_slots[i];
+          if (s->busy)
+            continue;
+          if (slot == NULL || s->context == preferred)
+            slot = s;
+        }
+      if (slot == NULL && compiler_slots.size() < max_slots)
+        {
+          slot = new compiler_slot;
+          slot->context = new LLVMContext();
+          slot->busy = false;
+          compiler_slots.push_back(slot);
+        }
+      if (slot == NULL)
+        pthread_cond_wait(&compiler_slot_released, &compiler_slots_lock);
+    }
+  slot->busy = true;
+  POCL_UNLOCK(compiler_slots_lock);
+  return slot;
+}
+
+/**
+ * Take the compiler slot owning the context, waiting for it to be
+ * released. Needed for accessing the Modules created in the context.
+ */
+static compiler_slot *
+lock_compiler_context(LLVMContext *context)
+{
+  POCL_LOCK(compiler_slots_lock);
+  compiler_slot *slot = NULL;
+  for (size_t i = 0; i < compiler_slots.size(); ++i)
+    if (compiler_slots[i]->context == context)
+      slot = compiler_slots[i];
+  assert (slot != NULL && "The context does not belong to any slot.");
+  while (slot->busy)
+    pthread_cond_wait(&compiler_slot_released, &compiler_slots_lock);
+  slot->busy = true;
+  POCL_UNLOCK(compiler_slots_lock);
+  return slot;
+}
+
+static void
+unlock_compiler(compiler_slot *slot)
+{
+  POCL_LOCK(compiler_slots_lock);
+  slot->busy = false;
+  pthread_cond_broadcast(&compiler_slot_released);
+  POCL_UNLOCK(compiler_slots_lock);
+}
+
 // Write a kernel compilation intermediate result
 // to file on disk, if user has requested with environment
 // variable
 // TODO: what to do on errors?
+// The file is written under a temporary name and then renamed so
+// the parallel compilations of the same file never see a partial one.
 static inline void
 write_temporary_file( const llvm::Module *mod,
                       const char *filename )
 {
+  static unsigned serial = 0;
+  std::stringstream tmp;
+  tmp << filename << "." << getpid() << "."
+      << __sync_fetch_and_add(&serial, 1) << ".tmp";
+
   std::string ErrorInfo;
   tool_output_file *Out;
-  Out = new tool_output_file(filename, ErrorInfo, F_Binary);
+  Out = new tool_output_file(tmp.str().c_str(), ErrorInfo, F_Binary);
   WriteBitcodeToFile(mod, Out->os());
   Out->keep();
   delete Out;
+  rename(tmp.str().c_str(), filename);
+}
+
+/**
+ * Find or generate the precompiled header of the kernel headers for
+ * the compiler invocation, to the path pch.
+ *
+ * The header is compiled with a copy of the invocation of the program
+ * so the language options match. The result is stored in the kernel
+ * cache by the options, thus only the first build with each set of
+ * options parses the headers. Returns false if the precompiled header
+ * is not available.
+ */
+static bool
+kernel_header_pch(CompilerInvocation &program_build,
+                  cl_device_id device,
+                  const std::string &options,
+                  const std::string &include_dir,
+                  const char *device_tmpdir,
+                  std::string &pch)
+{
+  if (device_tmpdir == NULL || !pocl_cache_enabled() ||
+      !pocl_get_bool_option("POCL_USE_PCH", 1))
+    return false;
+
+  char key[POCL_CACHE_KEY_LENGTH];
+  pocl_cache_header_key(device, options.c_str(), include_dir.c_str(), key);
+
+  pch = device_tmpdir;
+  pch += "/_kernel.h.pch";
+  if (pocl_cache_fetch_shared(key, "pch", pch.c_str()))
+    return true;
+
+  CompilerInstance CI;
+  CompilerInvocation *pch_build = new CompilerInvocation(program_build);
+  pch_build->getPreprocessorOpts().Includes.clear();
+
+  FrontendOptions &fe = pch_build->getFrontendOpts();
+  fe.Inputs.clear();
+  fe.Inputs.push_back
+    (FrontendInputFile(include_dir + "/_kernel.h", clang::IK_OpenCL));
+  fe.OutputFile = pch;
+
+  CI.setInvocation(pch_build);
+#ifdef LLVM_3_2
+  CI.createDiagnostics(0, NULL);
+#else
+  CI.createDiagnostics();
+#endif
+
+  clang::GeneratePCHAction action;
+  if (!CI.ExecuteAction(action) || CI.getDiagnostics().hasErrorOccurred())
+    return false;
+
+  pocl_cache_insert(key, "pch", pch.c_str());
+  return true;
 }
 
 // Read input source to clang::FrontendOptions.
@@ -176,21 +390,17 @@ load_source( FrontendOptions &fe,
   return 0;
 }
 
-int pocl_llvm_build_program(cl_program program, 
-                            cl_device_id device, 
-                            int device_i,     
-                            const char* temp_dir,
-                            const char* binary_file_name,
-                            const char* device_tmpdir,
-                            const char* user_options)
+static int
+build_program(compiler_slot *slot,
+              cl_program program, 
+              cl_device_id device, 
+              int device_i,     
+              const char* temp_dir,
+              const char* binary_file_name,
+              const char* device_tmpdir,
+              const char* user_options)
 
 { 
-  //llvm::MutexGuard lockHolder(kernelCompilerLock);
-
-  /* TODO: This should be in a initialization function somewhere. */
-  if (globalContext==NULL)
-		globalContext = new LLVMContext();
-
   // Use CompilerInvocation::CreateFromArgs to initialize
   // CompilerInvocation. This way we can reuse the Clang's
   // command line parsing.
@@ -259,7 +469,10 @@ int pocl_llvm_build_program(cl_program program,
   std::vector<std::string> itemstrs;
   while (i != end) 
     {
-      itemstrs.push_back(*i);
+      // pocl's own options are for the kernel compiler, not the frontend.
+      if (i->compare(0, strlen(POCL_VECTOR_WIDTH_OPTION),
+                     POCL_VECTOR_WIDTH_OPTION) != 0)
+        itemstrs.push_back(*i);
       ++i;
     }
   for (unsigned idx=0; idx<itemstrs.size(); idx++)
@@ -322,18 +535,17 @@ int pocl_llvm_build_program(cl_program program,
 
   po.addMacroDef("__OPENCL_VERSION__=120"); // -D__OPENCL_VERSION_=120
 
-  std::string kernelh;
+  std::string include_dir;
   if (pocl_get_bool_option("POCL_BUILDING", 0))
     { 
-      kernelh  = SRCDIR;
-      kernelh += "/include/_kernel.h";
+      include_dir  = SRCDIR;
+      include_dir += "/include";
     }
   else
     {
-      kernelh = PKGDATADIR;
-      kernelh += "/include/_kernel.h";
+      include_dir = PKGDATADIR;
+      include_dir += "/include";
     }
-  po.Includes.push_back(kernelh);
 
   // TODO: user_options (clBuildProgram options) are not passed
 
@@ -349,6 +561,21 @@ int pocl_llvm_build_program(cl_program program,
     //printf("%s ", *it);
   //printf("\n");
 
+  // The invocation is complete apart from the input, use the precompiled
+  // kernel headers if possible. The strict checking of the compilation
+  // flags is disabled as the key of the cached header covers them.
+  std::string pch;
+  std::stringstream pch_options;
+  pch_options << ss.str() << " long:" << device->has_64bit_long;
+  if (kernel_header_pch(pocl_build, device, pch_options.str(), include_dir,
+                        device_tmpdir, pch))
+    {
+      po.ImplicitPCHInclude = pch;
+      po.DisablePCHValidation = true;
+    }
+  else
+    po.Includes.push_back(include_dir + "/_kernel.h");
+
   // FIXME: print out any diagnostics to stdout for now. These should go to a buffer for the user
   // to dig out. (and probably to stdout too, overridable with environment variables) 
 #ifdef LLVM_3_2
@@ -367,25 +594,31 @@ int pocl_llvm_build_program(cl_program program,
   cg.EmitOpenCLArgMetadata = true;
   cg.StackRealignment = true;
 
-  // TODO: use pch: it is possible to disable the strict checking for
-  // the compilation flags used to compile it and the current translation
-  // unit via the preprocessor options directly.
-
   bool success = true;
   clang::CodeGenAction *action = NULL;
   CI.setInvocation(&pocl_build);
-  action = new clang::EmitLLVMOnlyAction(globalContext);
+  action = new clang::EmitLLVMOnlyAction(slot->context);
   success |= CI.ExecuteAction(*action);
   // FIXME: memleak, see FIXME below
   if (!success) return CL_BUILD_PROGRAM_FAILURE;
 
-  llvm::Module **mod = (llvm::Module **)&program->llvm_irs[device_i];
-  if (*mod != NULL)
-    delete (llvm::Module*)*mod;
-  *mod = action->takeModule();
+  llvm::Module *mod = action->takeModule();
+  program->llvm_irs[device_i] = mod;
 
   if (!pocl_get_bool_option("POCL_LEAVE_TEMP_DIRS", 1))
-    write_temporary_file(*mod, binary_file_name);
+    write_temporary_file(mod, binary_file_name);
+
+  // Keep the bitcode also in memory: the work-group functions can then
+  // be generated in the other compiler slots while this one is busy.
+  std::string bitcode;
+  raw_string_ostream os(bitcode);
+  WriteBitcodeToFile(mod, os);
+  os.flush();
+  program->binaries[device_i] = (unsigned char *)malloc(bitcode.size());
+  if (program->binaries[device_i] == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  memcpy(program->binaries[device_i], bitcode.data(), bitcode.size());
+  program->binary_sizes[device_i] = bitcode.size();
 
   // FIXME: cannot delete action as it contains something the llvm::Module
   // refers to. We should create it globally, at compiler initialization time.
@@ -394,6 +627,30 @@ int pocl_llvm_build_program(cl_program program,
   return CL_SUCCESS;
 }
 
+int pocl_llvm_build_program(cl_program program, 
+                            cl_device_id device, 
+                            int device_i,     
+                            const char* temp_dir,
+                            const char* binary_file_name,
+                            const char* device_tmpdir,
+                            const char* user_options)
+{
+  llvm::Module *old = (llvm::Module *)program->llvm_irs[device_i];
+  if (old != NULL)
+    {
+      compiler_slot *owner = lock_compiler_context(&old->getContext());
+      delete old;
+      unlock_compiler(owner);
+      program->llvm_irs[device_i] = NULL;
+    }
+
+  compiler_slot *slot = lock_compiler(NULL);
+  int error = build_program(slot, program, device, device_i, temp_dir,
+                            binary_file_name, device_tmpdir, user_options);
+  unlock_compiler(slot);
+  return error;
+}
+
 int pocl_llvm_get_kernel_metadata(cl_program program, 
                                   cl_kernel kernel,
                                   int device_i,     
@@ -414,11 +671,8 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
   assert(program->devices[device_i]->llvm_target_triplet && 
          "Device has no target triple set"); 
 
-  /* TODO: This should be in a initialization function somewhere. */
-  if (globalContext==NULL)
-		globalContext = new LLVMContext();
-
-  LLVMContext *context = NULL;
+  compiler_slot *slot = NULL;
+  bool parsed = false;
 
   if (program->llvm_irs != NULL &&
       program->llvm_irs[device_i] != NULL)
@@ -427,7 +681,7 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
 #ifdef DEBUG_POCL_LLVM_API
       printf("### use a saved llvm::Module\n");
 #endif
-      context = globalContext;
+      slot = lock_compiler_context(&input->getContext());
     }
 
   snprintf (tmpdir, POCL_FILENAME_LENGTH, "%s/%s", 
@@ -455,8 +709,9 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
         return CL_OUT_OF_HOST_MEMORY;
       fclose(binary_file); 
 
-      context = globalContext;
-      input = ParseIRFile(binary_filename, Err, *context);
+      slot = lock_compiler(NULL);
+      input = ParseIRFile(binary_filename, Err, *slot->context);
+      parsed = true;
       if (!input) 
         {
           // TODO:
@@ -530,6 +785,7 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
   kernel->arg_is_local = (cl_int*)malloc( sizeof(cl_int)*kernel->num_args );
   kernel->arg_is_image = (cl_int*)malloc( sizeof(cl_int)*kernel->num_args );
   kernel->arg_is_sampler = (cl_int*)malloc( sizeof(cl_int)*kernel->num_args );
+  kernel->arg_is_read_only = (cl_int*)malloc( sizeof(cl_int)*kernel->num_args );
 
   i = 0;
   for( llvm::Function::const_arg_iterator ii = arglist.begin(), 
@@ -540,6 +796,7 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
   
     kernel->arg_is_image[i] = false;
     kernel->arg_is_sampler[i] = false;
+    kernel->arg_is_read_only[i] = false;
  
     const PointerType *p = dyn_cast<PointerType>(t);
     if (p && !ii->hasByValAttr()) {
@@ -577,6 +834,28 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
       }
     i++;  
   }
+
+  // The images declared read_only are not written by the kernel. Without
+  // the access qualifiers in the metadata all images are assumed written.
+  llvm::NamedMDNode *kernels_md = input->getNamedMetadata("opencl.kernels");
+  for (unsigned k = 0; kernels_md && k < kernels_md->getNumOperands(); ++k) {
+    llvm::MDNode *kernel_md = kernels_md->getOperand(k);
+    if (kernel_md->getOperand(0) != kernel_function)
+      continue;
+    for (unsigned j = 1; j < kernel_md->getNumOperands(); ++j) {
+      llvm::MDNode *arg_md = dyn_cast_or_null<MDNode>(kernel_md->getOperand(j));
+      if (arg_md == NULL || arg_md->getNumOperands() != kernel->num_args + 1)
+        continue;
+      llvm::MDString *md_name = dyn_cast_or_null<MDString>(arg_md->getOperand(0));
+      if (md_name == NULL || md_name->getString() != "kernel_arg_access_qual")
+        continue;
+      for (unsigned a = 0; a < kernel->num_args; ++a) {
+        llvm::MDString *qual = dyn_cast_or_null<MDString>(arg_md->getOperand(a + 1));
+        kernel->arg_is_read_only[a] = kernel->arg_is_image[a] && qual != NULL &&
+          qual->getString() == "read_only";
+      }
+    }
+  }
   
   // fill 'kernel->reqd_wg_size'
   kernel->reqd_wg_size = (int*)malloc(3*sizeof(int));
@@ -601,6 +880,11 @@ int pocl_llvm_get_kernel_metadata(cl_program program,
   kernel->reqd_wg_size[0] = reqdx;
   kernel->reqd_wg_size[1] = reqdy;
   kernel->reqd_wg_size[2] = reqdz;
+
+  delete TD;
+  if (parsed)
+    delete input;
+  unlock_compiler(slot);
   
   // Generate the kernel_obj.c file. This should be optional
   // and generated only for the heterogeneous devices which need
@@ -716,17 +1000,25 @@ static TargetMachine* GetTargetMachine
 
 /* helpers copied from LLVM opt END */
 
+/* The LLVM command line options are global, the first pass manager
+   created sets them. */
+static bool kernel_compiler_options_set = false;
+static pocl_lock_t kernel_compiler_options_lock = POCL_LOCK_INITIALIZER;
+
 /**
  * Prepare the kernel compiler passes.
  *
- * The passes are created only once per program run per device.
- * The returned pass manager should not be modified, only the Module
- * should be optimized using it.
+ * The passes are created only once per program run per device and
+ * compiler slot, as a pass instance must not be run by two threads at
+ * the same time. The returned pass manager should not be modified, only
+ * the Module should be optimized using it. The compiler options of the
+ * kernel are read from the Module.
  */
 static PassManager& kernel_compiler_passes
-(cl_device_id device, std::string module_data_layout)
+(compiler_slot *slot, cl_device_id device, std::string module_data_layout)
 {
-  static std::map<cl_device_id, PassManager*> kernel_compiler_passes;
+  std::map<cl_device_id, PassManager*> &kernel_compiler_passes =
+    slot->kernel_compiler_passes;
 
   if (kernel_compiler_passes.find(device) != 
       kernel_compiler_passes.end())
@@ -737,7 +1029,9 @@ static PassManager& kernel_compiler_passes
   Triple triple(device->llvm_target_triplet);
   PassRegistry &Registry = *PassRegistry::getPassRegistry();
 
-  const bool first_initialization_call = kernel_compiler_passes.size() == 0;
+  POCL_LOCK(kernel_compiler_options_lock);
+  const bool first_initialization_call = !kernel_compiler_options_set;
+  kernel_compiler_options_set = true;
 
 #if !(defined LLVM_3_2 || defined LLVM_3_3 || defined LLVM_3_4)
         // Scalarizer is in LLVM upstream since 3.4.
@@ -746,35 +1040,6 @@ static PassManager& kernel_compiler_passes
       const bool SCALARIZE = false;
 #endif
 
-  if (first_initialization_call) 
-    {
-      // We have not initialized any pass managers for any device yet.
-      // Run the global LLVM pass initialization functions.
-      InitializeAllTargets();
-      InitializeAllTargetMCs();
-
-      // TODO: do this globally, and just once per program
-      initializeCore(Registry);
-      initializeScalarOpts(Registry);
-      initializeVectorization(Registry);
-      initializeIPO(Registry);
-      initializeAnalysis(Registry);
-      initializeIPA(Registry);
-      initializeTransformUtils(Registry);
-      initializeInstCombine(Registry);
-      initializeInstrumentation(Registry);
-      initializeTarget(Registry);
-
-      //Make sure we are registering the passes in this folder
-/*
-      const char *Name = "Finds the best way to handle work-items to produce a multi-WG function.";
-      PassInfo *PI = new PassInfo(Name, "workitem-handler-chooser",
-                                  &pocl::WorkitemHandlerChooser::ID,
-                                  0, false, false);
-      Registry.registerPass(*PI, true);
-*/
-    }
-
 #ifndef LLVM_3_2
   StringMap<llvm::cl::Option*> opts;
   llvm::cl::getRegisteredOptions(opts);
@@ -871,7 +1136,7 @@ static PassManager& kernel_compiler_passes
           passes.push_back("scalarizer");
         }
 
-      if (kernel_compiler_passes.size() == 0) 
+      if (first_initialization_call) 
         {
           // Set the options only once. TODO: fix it so that each
           // device can reset their own options. Now one cannot compile
@@ -881,14 +1146,8 @@ static PassManager& kernel_compiler_passes
           assert(O && "could not find LLVM option 'vectorizer-min-trip-count'");
           O->addOccurrence(1, StringRef("vectorizer-min-trip-count"), StringRef("2"), false); 
 
-          //add force vector width for testing
-          O = opts["force-vector-width"];
-          assert(O && "could not find LLVM option 'force-vector-width'");
-          O->addOccurrence(1, StringRef("force-vector-width"), StringRef("4"), false); 
-          //add other opts for debugging
-          O = opts["debug-pass"];
-          assert(O && "could not find LLVM option 'debug-pass'");
-          O->addOccurrence(1, StringRef("debug-pass"), StringRef("Arguments"), false); 
+          // The vector width is chosen per kernel by the work-item loop
+          // generation (see WorkitemLoops::VectorWidthHint).
 
           if (SCALARIZE) 
             {
@@ -1040,13 +1299,11 @@ static PassManager& kernel_compiler_passes
       llvm::cl::Option *O = opts["unroll-count"];
  //     assert(O && "could not find LLVM option 'unroll-count'");
   //    O->addOccurrence(1, StringRef("unroll-count"), StringRef("0"), false); 
-          //add other opts for debugging
-          O = opts["debug-pass"];
-          assert(O && "could not find LLVM option 'debug-pass'");
-          O->addOccurrence(1, StringRef("debug-pass"), StringRef("Arguments"), false); 
     }
 #endif
 
+  POCL_UNLOCK(kernel_compiler_options_lock);
+
   if(wg_method!= "spmd")
     passes.push_back("STANDARD_OPTS");
   passes.push_back("instcombine");
@@ -1144,32 +1401,15 @@ static PassManager& kernel_compiler_passes
   return *Passes;
 }
 
-/* This is used to communicate the work-group dimensions command-line parameter to the 
-   workitem loop. */
-namespace pocl {
-extern llvm::cl::list<int> LocalSize;
-} 
-
 /**
- * Return the OpenCL C built-in function library bitcode
+ * Return the path of the OpenCL C built-in function library bitcode
  * for the given device.
  */
-static llvm::Module*
-kernel_library
-(cl_device_id device, llvm::Module* root)
+static std::string
+kernel_library_path(cl_device_id device)
 {
-  //llvm::MutexGuard lockHolder(kernelCompilerLock);
-
-  static std::map<cl_device_id, llvm::Module*> libs;
-
   Triple triple(device->llvm_target_triplet);
 
-  if (libs.find(device) != libs.end())
-    {
-      return libs[device];
-    }
-
-  // TODO sync with Nat Ferrus' indexed linking
   std::string kernellib;
   if (pocl_get_bool_option("POCL_BUILDING", 0))
     {
@@ -1201,17 +1441,355 @@ kernel_library
       kernellib += device->llvm_target_triplet;
       kernellib += ".bc";
     }
+  return kernellib;
+}
+
+void
+pocl_llvm_get_kernel_library_path(cl_device_id device, char *path)
+{
+  snprintf(path, POCL_FILENAME_LENGTH, "%s", 
+           kernel_library_path(device).c_str());
+}
+
+/**
+ * Add the global values the value refers to, directly or through
+ * constant expressions, to refs.
+ */
+static void
+collect_global_refs
+(const llvm::Value *v, std::set<const llvm::GlobalValue*> &refs,
+ std::set<const llvm::Constant*> &visited)
+{
+  if (const llvm::GlobalValue *gv = dyn_cast<llvm::GlobalValue>(v))
+    {
+      refs.insert(gv);
+      return;
+    }
+  const llvm::Constant *c = dyn_cast<llvm::Constant>(v);
+  if (c == NULL || !visited.insert(c).second)
+    return;
+  for (User::const_op_iterator i = c->op_begin(), e = c->op_end(); 
+       i != e; ++i)
+    collect_global_refs(*i, refs, visited);
+}
+
+/**
+ * Add the global values the global value refers to directly to refs.
+ */
+static void
+direct_global_refs
+(const llvm::GlobalValue *gv, std::set<const llvm::GlobalValue*> &refs)
+{
+  std::set<const llvm::Constant*> visited;
+  if (const llvm::Function *f = dyn_cast<llvm::Function>(gv))
+    {
+      for (llvm::Function::const_iterator bb = f->begin(), bbe = f->end();
+           bb != bbe; ++bb)
+        for (llvm::BasicBlock::const_iterator i = bb->begin(), 
+               ie = bb->end(); i != ie; ++i)
+          for (User::const_op_iterator op = i->op_begin(), 
+                 ope = i->op_end(); op != ope; ++op)
+            collect_global_refs(*op, refs, visited);
+    }
+  else if (const GlobalVariable *g = dyn_cast<GlobalVariable>(gv))
+    {
+      if (g->hasInitializer())
+        collect_global_refs(g->getInitializer(), refs, visited);
+    }
+  else if (const GlobalAlias *a = dyn_cast<GlobalAlias>(gv))
+    {
+      if (a->getAliasee() != NULL)
+        collect_global_refs(a->getAliasee(), refs, visited);
+    }
+}
+
+/**
+ * Index the references between the global values of the library.
+ */
+static void
+index_kernel_library(const llvm::Module *lib, symbol_index &index)
+{
+  for (llvm::Module::const_iterator f = lib->begin(), fe = lib->end();
+       f != fe; ++f)
+    direct_global_refs(f, index[f]);
+  for (llvm::Module::const_global_iterator g = lib->global_begin(),
+         ge = lib->global_end(); g != ge; ++g)
+    direct_global_refs(g, index[g]);
+  for (llvm::Module::const_alias_iterator a = lib->alias_begin(),
+         ae = lib->alias_end(); a != ae; ++a)
+    direct_global_refs(a, index[a]);
+}
+
+/**
+ * Return the OpenCL C built-in function library bitcode
+ * for the given device in the context of the compiler slot.
+ */
+static llvm::Module*
+kernel_library
+(compiler_slot *slot, cl_device_id device)
+{
+  std::map<cl_device_id, llvm::Module*> &libs = slot->kernel_libraries;
+
+  if (libs.find(device) != libs.end())
+    {
+      return libs[device];
+    }
 
   SMDiagnostic Err;
-  llvm::Module *lib = ParseIRFile(kernellib, Err, *globalContext);
+  llvm::Module *lib = 
+    ParseIRFile(kernel_library_path(device), Err, *slot->context);
   assert (lib != NULL);
   libs[device] = lib;
+  index_kernel_library(lib, slot->kernel_library_indices[device]);
 
   return lib;
 }
 
-/* This is used to control the kernel we want to process in the kernel compilation. */
-extern cl::opt<std::string> KernelName;
+/**
+ * Return a new Module with the given global values of the Module lib
+ * and the ones they refer to, transitively. The references are looked
+ * up from the index if given.
+ *
+ * This is CloneModule() limited to the needed global values. The named
+ * metadata nodes referring to the global values left out are dropped.
+ */
+static llvm::Module*
+extract_globals
+(const llvm::Module *lib, std::vector<const llvm::GlobalValue*> pending,
+ const symbol_index *index)
+{
+  std::set<const llvm::GlobalValue*> needed;
+
+  while (!pending.empty())
+    {
+      const llvm::GlobalValue *gv = pending.back();
+      pending.pop_back();
+      if (gv == NULL || !needed.insert(gv).second)
+        continue;
+      std::set<const llvm::GlobalValue*> direct_refs;
+      const std::set<const llvm::GlobalValue*> *refs = &direct_refs;
+      if (index != NULL)
+        {
+          symbol_index::const_iterator i = index->find(gv);
+          if (i == index->end())
+            continue;
+          refs = &i->second;
+        }
+      else
+        direct_global_refs(gv, direct_refs);
+      pending.insert(pending.end(), refs->begin(), refs->end());
+    }
+
+  llvm::Module *subset = 
+    new llvm::Module(lib->getModuleIdentifier(), lib->getContext());
+  subset->setDataLayout(lib->getDataLayout());
+  subset->setTargetTriple(lib->getTargetTriple());
+  subset->setModuleInlineAsm(lib->getModuleInlineAsm());
+
+  ValueToValueMapTy VMap;
+  for (llvm::Module::const_global_iterator g = lib->global_begin(),
+         ge = lib->global_end(); g != ge; ++g)
+    {
+      if (needed.count(g) == 0)
+        continue;
+      GlobalVariable *ng = 
+        new GlobalVariable(*subset, g->getType()->getElementType(),
+                           g->isConstant(), g->getLinkage(), (Constant*) 0,
+                           g->getName(), (GlobalVariable*) 0,
+                           g->getThreadLocalMode(),
+                           g->getType()->getAddressSpace());
+      ng->copyAttributesFrom(g);
+      VMap[g] = ng;
+    }
+
+  for (llvm::Module::const_iterator f = lib->begin(), fe = lib->end();
+       f != fe; ++f)
+    {
+      if (needed.count(f) == 0)
+        continue;
+      llvm::Function *nf = 
+        llvm::Function::Create
+        (cast<llvm::FunctionType>(f->getType()->getElementType()),
+         f->getLinkage(), f->getName(), subset);
+      nf->copyAttributesFrom(f);
+      VMap[f] = nf;
+    }
+
+  for (llvm::Module::const_alias_iterator a = lib->alias_begin(),
+         ae = lib->alias_end(); a != ae; ++a)
+    {
+      if (needed.count(a) == 0)
+        continue;
+      GlobalAlias *na = 
+        new GlobalAlias(a->getType(), a->getLinkage(), a->getName(), 
+                        NULL, subset);
+      na->copyAttributesFrom(a);
+      VMap[a] = na;
+    }
+
+  for (llvm::Module::const_global_iterator g = lib->global_begin(),
+         ge = lib->global_end(); g != ge; ++g)
+    {
+      if (needed.count(g) == 0 || !g->hasInitializer())
+        continue;
+      cast<GlobalVariable>(VMap[g])->setInitializer
+        (MapValue(g->getInitializer(), VMap));
+    }
+
+  for (llvm::Module::const_iterator f = lib->begin(), fe = lib->end();
+       f != fe; ++f)
+    {
+      if (needed.count(f) == 0 || f->isDeclaration())
+        continue;
+      llvm::Function *nf = cast<llvm::Function>(VMap[f]);
+      llvm::Function::arg_iterator arg = nf->arg_begin();
+      for (llvm::Function::const_arg_iterator j = f->arg_begin(), 
+             je = f->arg_end(); j != je; ++j, ++arg)
+        {
+          arg->setName(j->getName());
+          VMap[j] = arg;
+        }
+      SmallVector<ReturnInst*, 8> returns;
+      CloneFunctionInto(nf, f, VMap, /*ModuleLevelChanges=*/true, returns);
+    }
+
+  for (llvm::Module::const_alias_iterator a = lib->alias_begin(),
+         ae = lib->alias_end(); a != ae; ++a)
+    {
+      if (needed.count(a) == 0 || a->getAliasee() == NULL)
+        continue;
+      cast<GlobalAlias>(VMap[a])->setAliasee
+        (MapValue(a->getAliasee(), VMap));
+    }
+
+  for (llvm::Module::const_named_metadata_iterator 
+         nmd = lib->named_metadata_begin(), 
+         nmde = lib->named_metadata_end(); nmd != nmde; ++nmd)
+    {
+      llvm::NamedMDNode *nnmd = NULL;
+      for (unsigned i = 0, e = nmd->getNumOperands(); i != e; ++i)
+        {
+          llvm::MDNode *node = nmd->getOperand(i);
+          bool dropped = false;
+          for (unsigned j = 0, je = node->getNumOperands(); j != je; ++j)
+            {
+              const llvm::GlobalValue *gv = 
+                dyn_cast_or_null<llvm::GlobalValue>(node->getOperand(j));
+              if (gv != NULL && needed.count(gv) == 0)
+                dropped = true;
+            }
+          if (dropped)
+            continue;
+          if (nnmd == NULL)
+            nnmd = subset->getOrInsertNamedMetadata(nmd->getName());
+          nnmd->addOperand(MapValue(node, VMap));
+        }
+    }
+
+  return subset;
+}
+
+/**
+ * Return a new Module with the parts of the kernel library the input
+ * Module refers to, transitively. 
+ *
+ * Linking only these instead of the whole library makes the linking
+ * and the kernel compiler passes scale with the size of the kernel.
+ */
+static llvm::Module*
+kernel_library_subset
+(const llvm::Module *lib, const symbol_index &index, 
+ const llvm::Module *input)
+{
+  std::vector<const llvm::GlobalValue*> roots;
+  for (llvm::Module::const_iterator f = input->begin(), fe = input->end();
+       f != fe; ++f)
+    if (f->isDeclaration())
+      roots.push_back(lib->getNamedValue(f->getName()));
+  for (llvm::Module::const_global_iterator g = input->global_begin(),
+         ge = input->global_end(); g != ge; ++g)
+    if (g->isDeclaration())
+      roots.push_back(lib->getNamedValue(g->getName()));
+
+  return extract_globals(lib, roots, &index);
+}
+
+/**
+ * Return a Module with the kernel and the functions and variables it
+ * refers to, extracted from the program built for the device, in the
+ * context of the compiler slot. The in-memory bitcode of the program
+ * is used if its Module was created in another slot.
+ *
+ * The first extraction is stored to the kernel, so the work-group
+ * functions of the kernel for the other local sizes start from it
+ * instead of the whole program.
+ */
+static llvm::Module*
+kernel_module
+(compiler_slot *slot, cl_kernel kernel, cl_device_id device,
+ const char* kernel_filename)
+{
+  unsigned dev = device->dev_id;
+  cl_program program = kernel->program;
+
+  POCL_LOCK_OBJ (kernel);
+  llvm::Module *extracted = (llvm::Module*)kernel->llvm_irs[dev];
+  POCL_UNLOCK_OBJ (kernel);
+  if (extracted != NULL && &extracted->getContext() == slot->context)
+    return llvm::CloneModule(extracted);
+
+  SMDiagnostic Err;
+  llvm::Module *built = NULL;
+  llvm::Module *parsed = NULL;
+  if (program->llvm_irs != NULL)
+    built = (llvm::Module*)program->llvm_irs[dev];
+
+  if (built == NULL || &built->getContext() != slot->context)
+    {
+      if (program->binaries != NULL && program->binaries[dev] != NULL)
+        {
+          llvm::MemoryBuffer *buf = llvm::MemoryBuffer::getMemBufferCopy
+            (StringRef((const char*)program->binaries[dev],
+                       program->binary_sizes[dev]));
+          parsed = ParseIR(buf, Err, *slot->context);
+        }
+      else
+        parsed = ParseIRFile(kernel_filename, Err, *slot->context);
+      assert (parsed != NULL);
+      built = parsed;
+    }
+
+  std::vector<const llvm::GlobalValue*> roots;
+  roots.push_back(built->getFunction(kernel->name));
+  assert (roots[0] != NULL);
+  extracted = extract_globals(built, roots, NULL);
+  delete parsed;
+
+  POCL_LOCK_OBJ (kernel);
+  bool keep = kernel->llvm_irs[dev] == NULL;
+  if (keep)
+    kernel->llvm_irs[dev] = extracted;
+  POCL_UNLOCK_OBJ (kernel);
+
+  if (keep)
+    return llvm::CloneModule(extracted);
+  return extracted;
+}
+
+void
+pocl_llvm_release_kernel(cl_kernel kernel)
+{
+  for (unsigned dev = 0; dev < kernel->num_llvm_irs; ++dev)
+    {
+      llvm::Module *mod = (llvm::Module*)kernel->llvm_irs[dev];
+      if (mod == NULL)
+        continue;
+      compiler_slot *slot = lock_compiler_context(&mod->getContext());
+      delete mod;
+      unlock_compiler(slot);
+      kernel->llvm_irs[dev] = NULL;
+    }
+}
 
 int pocl_llvm_generate_workgroup_function(cl_device_id device,
                                           cl_kernel kernel,
@@ -1219,8 +1797,6 @@ int pocl_llvm_generate_workgroup_function(cl_device_id device,
                                           const char* parallel_filename,
                                           const char* kernel_filename)
 {
-  //llvm::MutexGuard lockHolder(kernelCompilerLock);
-
 #ifdef DEBUG_POCL_LLVM_API        
   printf("### calling the kernel compiler for kernel %s local_x %u "
          "local_y %u local_z %u parallel_filename: %s\n",
@@ -1229,70 +1805,280 @@ int pocl_llvm_generate_workgroup_function(cl_device_id device,
 
   Triple triple(device->llvm_target_triplet);
 
-
-  LLVMContext *Context = globalContext;
-  SMDiagnostic Err;
   std::string errmsg;
 
+  // Prefer the slot of the earlier extraction of the kernel, or of the
+  // program.
+  POCL_LOCK_OBJ (kernel);
+  llvm::Module *built = (llvm::Module*)kernel->llvm_irs[device->dev_id];
+  POCL_UNLOCK_OBJ (kernel);
+  if (built == NULL && kernel->program->llvm_irs != NULL)
+    built = (llvm::Module*)kernel->program->llvm_irs[device->dev_id];
+  compiler_slot *slot = lock_compiler(built ? &built->getContext() : NULL);
+
   // Link the kernel and runtime library
-  llvm::Module *input = NULL;
-  if (kernel->program->llvm_irs != NULL && 
-      kernel->program->llvm_irs[device->dev_id] != NULL) 
-    {
-      input = 
-        llvm::CloneModule
-        ((llvm::Module*)kernel->program->llvm_irs[device->dev_id]);
-    }
-  else
-    {
-      input = ParseIRFile(kernel_filename, Err, *Context);
-    }
+  llvm::Module *input = 
+    kernel_module(slot, kernel, device, kernel_filename);
+  assert (input != NULL);
 
-  // Later this should be replaced with indexed linking of source code
-  // and/or bitcode for each kernel.
-  llvm::Module *libmodule = kernel_library(device, input);
+  llvm::Module *libmodule = kernel_library(slot, device);
   assert (libmodule != NULL);
+  llvm::Module *libsubset = 
+    kernel_library_subset(libmodule, slot->kernel_library_indices[device],
+                          input);
 #ifdef LLVM_3_2
   Linker TheLinker("pocl", input, Linker::PreserveSource);
-  Linker::LinkModules(input, libmodule, Linker::PreserveSource, &errmsg);
+  Linker::LinkModules(input, libsubset, Linker::DestroySource, &errmsg);
 #else
   Linker TheLinker(input);
-  TheLinker.linkInModule(libmodule, Linker::PreserveSource, &errmsg);
+  TheLinker.linkInModule(libsubset, Linker::DestroySource, &errmsg);
 #endif
+  delete libsubset;
   llvm::Module *linked_bc = TheLinker.getModule();
 
   assert (linked_bc != NULL);
 
   /* Now finally run the set of passes assembled above */
 
-  // TODO pass these as parameters instead, this is not thread safe!
-  pocl::LocalSize.clear();
-  pocl::LocalSize.addValue(local_x);
-  pocl::LocalSize.addValue(local_y);
-  pocl::LocalSize.addValue(local_z);
-  KernelName = kernel->name;
+  int context_scratch = device->context_scratch ?
+    pocl_get_int_option("POCL_CONTEXT_SCRATCH_THRESHOLD", 65536) : 0;
+  // Zero lets the work-item loops choose the width for the target.
+  int vector_width = 0;
+  const char *width_option = kernel->program->compiler_options ?
+    strstr(kernel->program->compiler_options, POCL_VECTOR_WIDTH_OPTION) :
+    NULL;
+  if (width_option != NULL)
+    vector_width = atoi(width_option + strlen(POCL_VECTOR_WIDTH_OPTION));
+  if (local_x == 0 && local_y == 0 && local_z == 0)
+    pocl::setKernelCompilerOptions(*linked_bc, kernel->name, 1, 1, 1,
+                                   device->max_work_group_size,
+                                   context_scratch, vector_width);
+  else
+    pocl::setKernelCompilerOptions(*linked_bc, kernel->name,
+                                   local_x, local_y, local_z, 0,
+                                   context_scratch, vector_width);
 
   //printf("start kernel_compiler_passes\n");
-  kernel_compiler_passes(device, linked_bc->getDataLayout()).run(*linked_bc);
+  kernel_compiler_passes(slot, device, linked_bc->getDataLayout())
+    .run(*linked_bc);
   //printf("finished kernel_compiler_passes\n");
 
-  // TODO: don't write this once LLC is called via API, not system()
+  std::string savings_kernel;
+  unsigned rematerialized;
+  uint64_t bytes_saved;
+  if (pocl_get_bool_option("POCL_DEBUG", 0) &&
+      pocl::getContextSavings(*linked_bc, savings_kernel, rematerialized,
+                              bytes_saved))
+    fprintf(stderr, "pocl: %s (local size %zu-%zu-%zu): rematerialized %u "
+            "values, saved %lu bytes of context arrays\n",
+            savings_kernel.c_str(), local_x, local_y, local_z,
+            rematerialized, (unsigned long)bytes_saved);
+
+  // The file is the cache of the work-group functions across the
+  // launches and processes. The in-process code generation uses the
+  // module directly.
   write_temporary_file(linked_bc, parallel_filename);
 
-#ifndef LLVM_3_2
+#ifdef LLVM_3_2
   // In LLVM 3.2 the Linker object deletes the associated Modules.
   // If we delete here, it will crash.
-  /* OPTIMIZE: store the fully linked work-group function llvm::Module 
-     and pass it to code generation without writing to disk. */
-  delete linked_bc;
+  llvm::Module *wg_module = llvm::CloneModule(linked_bc);
+#else
+  llvm::Module *wg_module = linked_bc;
 #endif
 
+  // Another thread might have generated the same function meanwhile.
+  // Its module is kept as it may live in a slot that is busy now.
+  // Without the in-process code generation nobody consumes the module.
+  if (pocl_llvm_jit_enabled(device))
+    {
+      POCL_LOCK(workgroup_modules_lock);
+      if (workgroup_modules.find(parallel_filename) == 
+          workgroup_modules.end())
+        {
+          workgroup_modules[parallel_filename].module = wg_module;
+          workgroup_modules[parallel_filename].program = kernel->program;
+          wg_module = NULL;
+        }
+      POCL_UNLOCK(workgroup_modules_lock);
+    }
+  delete wg_module;
+
+  unlock_compiler(slot);
   return 0;
 }
 
-void pocl_llvm_update_binaries (cl_program program) {
+int
+pocl_llvm_jit_enabled(cl_device_id device)
+{
+#ifdef LLVM_3_2
+  // MCJIT lacks the default memory manager.
+  return 0;
+#else
+  const char *wg_method = 
+    pocl_get_string_option("POCL_WORK_GROUP_METHOD", "loopvec");
+  if (!pocl_get_bool_option("POCL_KERNEL_JIT", 1) ||
+      pocl_get_bool_option("POCL_CROSS_COMPILE", 0) ||
+      strcmp(wg_method, "spmd") == 0)
+    return 0;
+
+  // Only code for the host can be loaded to this process.
+  Triple triple(device->llvm_target_triplet);
+  Triple host(sys::getDefaultTargetTriple());
+  return triple.getArch() == host.getArch();
+#endif
+}
 
-  //llvm::MutexGuard lockHolder(kernelCompilerLock);
+pocl_workgroup
+pocl_llvm_jit_workgroup_function(cl_device_id device,
+                                 cl_kernel kernel,
+                                 const char* parallel_filename,
+                                 pocl_workgroup_range *wg_range,
+                                 size_t *context_scratch_size)
+{
+#ifdef LLVM_3_2
+  return NULL;
+#else
+  if (!pocl_llvm_jit_enabled(device))
+    return NULL;
+
+  llvm::Module *mod = NULL;
+  POCL_LOCK(workgroup_modules_lock);
+  std::map<std::string, workgroup_module>::iterator i =
+    workgroup_modules.find(parallel_filename);
+  if (i != workgroup_modules.end())
+    {
+      mod = i->second.module;
+      workgroup_modules.erase(i);
+    }
+  POCL_UNLOCK(workgroup_modules_lock);
+
+  compiler_slot *slot;
+  if (mod != NULL)
+    slot = lock_compiler_context(&mod->getContext());
+  else
+    {
+      // Generated by an earlier process.
+      slot = lock_compiler(NULL);
+      SMDiagnostic Err;
+      mod = ParseIRFile(parallel_filename, Err, *slot->context);
+      if (mod == NULL)
+        {
+          unlock_compiler(slot);
+          return NULL;
+        }
+    }
+
+  std::string errmsg;
+  EngineBuilder builder(mod);
+  builder.setEngineKind(EngineKind::JIT);
+  builder.setUseMCJIT(true);
+#ifdef LLVM_3_3
+  builder.setJITMemoryManager(new SectionMemoryManager());
+#else
+  builder.setMCJITMemoryManager(new SectionMemoryManager());
+#endif
+  builder.setOptLevel(CodeGenOpt::Aggressive);
+  builder.setErrorStr(&errmsg);
+  if (device->llvm_cpu != NULL)
+    builder.setMCPU(device->llvm_cpu);
+
+  llvm::ExecutionEngine *engine = builder.create();
+  if (engine == NULL)
+    {
+      std::cerr << "pocl: in-process code generation failed: " 
+                << errmsg << std::endl;
+      delete mod;
+      unlock_compiler(slot);
+      return NULL;
+    }
+
+  std::string wg_name = 
+    std::string("_") + kernel->function_name + "_workgroup";
+  llvm::Function *wg = mod->getFunction(wg_name);
+  if (wg == NULL)
+    {
+      delete engine;
+      unlock_compiler(slot);
+      return NULL;
+    }
+
+  llvm::Function *range = mod->getFunction(wg_name + "_range");
+  llvm::GlobalVariable *scratch_size = 
+    mod->getGlobalVariable(std::string("_") + kernel->function_name +
+                           "_context_scratch_size");
+  *context_scratch_size = scratch_size != NULL ?
+    llvm::cast<ConstantInt>(scratch_size->getInitializer())->getZExtValue() : 0;
+
+  engine->finalizeObject();
+  void *code = engine->getPointerToFunction(wg);
+  *wg_range = range != NULL ?
+    (pocl_workgroup_range)engine->getPointerToFunction(range) : NULL;
+  workgroup_engine owned = { engine, slot->context };
+  unlock_compiler(slot);
+
+  POCL_LOCK(workgroup_modules_lock);
+  workgroup_engines.insert(std::make_pair(kernel->program, owned));
+  POCL_UNLOCK(workgroup_modules_lock);
+  return (pocl_workgroup)code;
+#endif
+}
+
+void
+pocl_llvm_release_workgroup_functions(cl_program program)
+{
+  std::vector<llvm::Module*> modules;
+  std::vector<workgroup_engine> engines;
+
+  // The slots are taken only after releasing the lock, as the
+  // generation takes the lock while holding a slot.
+  POCL_LOCK(workgroup_modules_lock);
+  std::map<std::string, workgroup_module>::iterator i =
+    workgroup_modules.begin();
+  while (i != workgroup_modules.end())
+    {
+      if (i->second.program == program)
+        {
+          modules.push_back(i->second.module);
+          workgroup_modules.erase(i++);
+        }
+      else
+        ++i;
+    }
+  std::pair<std::multimap<cl_program, workgroup_engine>::iterator,
+            std::multimap<cl_program, workgroup_engine>::iterator> range =
+    workgroup_engines.equal_range(program);
+  for (std::multimap<cl_program, workgroup_engine>::iterator e = range.first;
+       e != range.second; ++e)
+    engines.push_back(e->second);
+  workgroup_engines.erase(range.first, range.second);
+  POCL_UNLOCK(workgroup_modules_lock);
+
+  for (size_t m = 0; m < modules.size(); ++m)
+    {
+      compiler_slot *slot = lock_compiler_context(&modules[m]->getContext());
+      delete modules[m];
+      unlock_compiler(slot);
+    }
+  // The engines own their modules.
+  for (size_t e = 0; e < engines.size(); ++e)
+    {
+      compiler_slot *slot = lock_compiler_context(engines[e].context);
+      delete engines[e].engine;
+      unlock_compiler(slot);
+    }
+}
+
+void pocl_llvm_write_program_binary (cl_program program, int device_i,
+                                     const char *filename)
+{
+  llvm::Module *mod = (llvm::Module*)program->llvm_irs[device_i];
+  compiler_slot *slot = lock_compiler_context(&mod->getContext());
+  write_temporary_file(mod, filename);
+  unlock_compiler(slot);
+}
+
+void pocl_llvm_update_binaries (cl_program program) {
 
   // Dump the LLVM IR Modules to memory buffers. 
   assert (program->llvm_irs != NULL);
@@ -1302,15 +2088,20 @@ void pocl_llvm_update_binaries (cl_program program) {
 
    for (size_t i = 0; i < program->num_devices; ++i)
     {
-      assert (program->llvm_irs[i] != NULL);
+      // Loaded from the kernel cache as bitcode.
+      if (program->llvm_irs[i] == NULL)
+        continue;
+
+      // Stored already by the build. The Module is not changed after it.
+      if (program->binaries[i] != NULL)
+        continue;
 
       std::string binary_filename =
         std::string(program->temp_dir) + "/" + 
         program->devices[i]->short_name + "/" +
         POCL_PROGRAM_BC_FILENAME;
 
-      write_temporary_file((llvm::Module*)program->llvm_irs[i],
-                           binary_filename.c_str()); 
+      pocl_llvm_write_program_binary(program, i, binary_filename.c_str());
 
       FILE *binary_file = fopen(binary_filename.c_str(), "r");
       if (binary_file == NULL)        
@@ -1342,11 +2133,10 @@ void pocl_llvm_update_binaries (cl_program program) {
 int
 pocl_llvm_get_kernel_names( cl_program program, const char **knames, unsigned max_num_krn )
 {
-  //llvm::MutexGuard lockHolder(kernelCompilerLock);
-
   // TODO: is it safe to assume every device (i.e. the index 0 here)
   // has the same set of programs & kernels?
   llvm::Module *mod = (llvm::Module *) program->llvm_irs[0];
+  compiler_slot *slot = lock_compiler_context(&mod->getContext());
   llvm::NamedMDNode *md = mod->getNamedMetadata("opencl.kernels");
   assert(md);
 
@@ -1357,6 +2147,7 @@ pocl_llvm_get_kernel_names( cl_program program, const char **knames, unsigned ma
     if (i<max_num_krn)
       knames[i]= k->getName().data();
   }
+  unlock_compiler(slot);
   return i;
 }
 
@@ -21,74 +21,209 @@
    THE SOFTWARE.
 */
 
+#include <stddef.h>
+#include <stdlib.h>
+
 #include "pocl_mem_management.h"
 #include "pocl.h"
-#include "utlist.h"
 
-typedef struct _mem_manager
+/* The number of objects moved between a thread cache and the depot
+   at a time. A thread cache holds at most twice this many. */
+#define POOL_BATCH_SIZE 32
+/* The number of objects allocated at once when the depot is empty. */
+#define POOL_SLAB_SIZE 128
+
+typedef struct pool_thread_cache
 {
-  //pocl_lock_t event_lock;
-  //pocl_lock_t cmd_lock;
-  cl_event event_list;
-  _cl_command_node *volatile cmd_list;
-} pocl_mem_manager;
+  pocl_object_pool *pool;
+  void *objects;
+  unsigned count;
+} pool_thread_cache;
 
+#define NEXT_OBJECT(__POOL__, __OBJ__) \
+  (*(void**)((char*)(__OBJ__) + (__POOL__)->next_offset))
 
-static pocl_mem_manager *mm = NULL;
+/* Moves count objects from the head of *list to the head of *dest. */
+static void
+move_objects (pocl_object_pool *pool, void **list, void **dest, 
+              unsigned count)
+{
+  void *obj;
+  while (count-- > 0)
+    {
+      obj = *list;
+      *list = NEXT_OBJECT (pool, obj);
+      NEXT_OBJECT (pool, obj) = *dest;
+      *dest = obj;
+    }
+}
 
-void pocl_init_mem_manager (void)
+/* Returns the cached objects of an exiting thread to the depot. */
+static void
+release_thread_cache (void *data)
+{
+  pool_thread_cache *cache = (pool_thread_cache*) data;
+  pocl_object_pool *pool = cache->pool;
+
+  POCL_LOCK (pool->lock);
+  pool->depot_count += cache->count;
+  move_objects (pool, &cache->objects, &pool->depot, cache->count);
+  POCL_UNLOCK (pool->lock);
+  free (cache);
+}
+
+void
+pocl_object_pool_init (pocl_object_pool *pool, size_t object_size,
+                       size_t next_offset, void (*init_object) (void *object))
 {
-  if (!mm)
+  pool->object_size = object_size;
+  pool->next_offset = next_offset;
+  pool->init_object = init_object;
+  pool->depot = NULL;
+  pool->depot_count = 0;
+  POCL_INIT_LOCK (pool->lock);
+  pthread_key_create (&pool->cache_key, release_thread_cache);
+}
+
+/* Allocates a new slab of objects to the depot. Must be called with the
+   pool lock held. */
+static int
+allocate_slab (pocl_object_pool *pool)
+{
+  unsigned i;
+  char *slab = (char*) calloc (POOL_SLAB_SIZE, pool->object_size);
+  if (slab == NULL)
+    return 0;
+
+  for (i = 0; i < POOL_SLAB_SIZE; ++i)
     {
-      mm = calloc (1, sizeof (pocl_mem_manager));
-      //POCL_INIT_LOCK (mm->event_lock);
-      //POCL_INIT_LOCK (mm->cmd_lock);
+      void *obj = slab + i * pool->object_size;
+      if (pool->init_object)
+        pool->init_object (obj);
+      NEXT_OBJECT (pool, obj) = pool->depot;
+      pool->depot = obj;
     }
+  pool->depot_count += POOL_SLAB_SIZE;
+  return 1;
 }
 
-cl_event pocl_mem_manager_new_event ()
+void *
+pocl_object_pool_alloc (pocl_object_pool *pool)
+{
+  void *obj;
+  unsigned count;
+  pool_thread_cache *cache = 
+    (pool_thread_cache*) pthread_getspecific (pool->cache_key);
+
+  if (cache == NULL)
+    {
+      cache = (pool_thread_cache*) calloc (1, sizeof (pool_thread_cache));
+      if (cache == NULL)
+        return NULL;
+      cache->pool = pool;
+      pthread_setspecific (pool->cache_key, cache);
+    }
+
+  if (cache->count == 0)
+    {
+      POCL_LOCK (pool->lock);
+      if (pool->depot_count == 0 && !allocate_slab (pool))
+        {
+          POCL_UNLOCK (pool->lock);
+          return NULL;
+        }
+      count = min (pool->depot_count, POOL_BATCH_SIZE);
+      move_objects (pool, &pool->depot, &cache->objects, count);
+      pool->depot_count -= count;
+      POCL_UNLOCK (pool->lock);
+      cache->count = count;
+    }
+
+  obj = cache->objects;
+  cache->objects = NEXT_OBJECT (pool, obj);
+  --cache->count;
+  return obj;
+}
+
+void
+pocl_object_pool_free (pocl_object_pool *pool, void *object)
 {
-  cl_event ev = NULL;
-  //POCL_LOCK (mm->event_lock);
-  if (ev = mm->event_list)
+  pool_thread_cache *cache = 
+    (pool_thread_cache*) pthread_getspecific (pool->cache_key);
+
+  if (cache == NULL)
     {
-      LL_DELETE (mm->event_list, ev);
-      //POCL_UNLOCK (mm->event_lock);
-      ev->pocl_refcount = 2; /* no need to lock because event is not in use */
-      return ev;
+      /* A thread that did not allocate from the pool. */
+      POCL_LOCK (pool->lock);
+      NEXT_OBJECT (pool, object) = pool->depot;
+      pool->depot = object;
+      ++pool->depot_count;
+      POCL_UNLOCK (pool->lock);
+      return;
     }
-  //POCL_UNLOCK (mm->event_lock);
-    
-  ev = calloc (1, sizeof (struct _cl_event));
-  POCL_INIT_OBJECT(ev);
-  ev->pocl_refcount = 2;
+
+  NEXT_OBJECT (pool, object) = cache->objects;
+  cache->objects = object;
+  if (++cache->count < 2 * POOL_BATCH_SIZE)
+    return;
+
+  /* E.g. the dispatcher threads free the commands allocated by the 
+     application threads. Return the surplus to them via the depot. */
+  POCL_LOCK (pool->lock);
+  move_objects (pool, &cache->objects, &pool->depot, POOL_BATCH_SIZE);
+  pool->depot_count += POOL_BATCH_SIZE;
+  POCL_UNLOCK (pool->lock);
+  cache->count -= POOL_BATCH_SIZE;
+}
+
+static pocl_object_pool event_pool;
+static pocl_object_pool command_pool;
+static pthread_once_t mem_manager_once = PTHREAD_ONCE_INIT;
+
+/* The lock and the condition variable of an event persist over its
+   reuse. */
+static void
+init_event (void *object)
+{
+  cl_event ev = (cl_event) object;
+  POCL_INIT_OBJECT (ev);
+  pthread_cond_init (&ev->completion_cond, NULL);
+}
+
+static void
+init_mem_manager (void)
+{
+  pocl_object_pool_init (&event_pool, sizeof (struct _cl_event),
+                         offsetof (struct _cl_event, next), init_event);
+  pocl_object_pool_init (&command_pool, sizeof (_cl_command_node),
+                         offsetof (_cl_command_node, next), NULL);
+}
+
+void pocl_init_mem_manager (void)
+{
+  pthread_once (&mem_manager_once, init_mem_manager);
+}
+
+cl_event pocl_mem_manager_new_event ()
+{
+  cl_event ev = (cl_event) pocl_object_pool_alloc (&event_pool);
+  if (ev == NULL)
+    return NULL;
+  ev->pocl_refcount = 2; /* no need to lock because event is not in use */
   return ev;
 }
 
 void pocl_mem_manager_free_event (cl_event event)
 {
-  //POCL_LOCK (mm->event_lock);
-  LL_PREPEND (mm->event_list, event);
-  //POCL_UNLOCK(mm->event_lock);
+  pocl_object_pool_free (&event_pool, event);
 }
 
 _cl_command_node* pocl_mem_manager_new_command ()
 {
-  _cl_command_node *cmd = NULL;
-  //POCL_LOCK (mm->cmd_lock);
-  if (cmd = mm->cmd_list)
-    LL_DELETE (mm->cmd_list, cmd);
-  //POCL_UNLOCK (mm->cmd_lock);
-  
-  if (cmd)
-    return cmd;
-  
-  return calloc (1, sizeof (_cl_command_node));
+  return (_cl_command_node*) pocl_object_pool_alloc (&command_pool);
 }
 
 void pocl_mem_manager_free_command ( _cl_command_node *cmd_ptr)
 {
-  //POCL_LOCK (mm->cmd_lock);
-  LL_PREPEND (mm->cmd_list, cmd_ptr);
-  //POCL_UNLOCK(mm->cmd_lock);
+  pocl_object_pool_free (&command_pool, cmd_ptr);
 }
@@ -1,17 +1,17 @@
 /* pocl_cl.h - local runtime library declarations.
 
    Copyright (c) 2014 Ville Korhonen
-   
+
    Permission is hereby granted, free of charge, to any person obtaining a copy
    of this software and associated documentation files (the "Software"), to deal
    in the Software without restriction, including without limitation the rights
    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
    copies of the Software, and to permit persons to whom the Software is
    furnished to do so, subject to the following conditions:
-   
+
    The above copyright notice and this permission notice shall be included in
    all copies or substantial portions of the Software.
-   
+
    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
@@ -21,8 +21,42 @@
    THE SOFTWARE.
 */
 
+#ifndef POCL_MEM_MANAGEMENT_H
+#define POCL_MEM_MANAGEMENT_H
+
 #include "pocl_cl.h"
 
+/* A pool of fixed size objects shared by all threads. Each thread
+   keeps a small cache of free objects, so allocating and freeing does
+   not synchronize with the other threads in the common case. The
+   caches are refilled from and flushed to a shared depot in batches.
+   Empty depots are refilled by allocating a slab of objects at once.
+
+   The freed objects are linked through a pointer field inside them,
+   the rest of their contents are preserved while they are in the
+   pool. */
+typedef struct pocl_object_pool pocl_object_pool;
+struct pocl_object_pool
+{
+  size_t object_size;
+  /* The offset of the void* used for linking the free objects. */
+  size_t next_offset;
+  /* Called once for every object when its slab is allocated. */
+  void (*init_object) (void *object);
+  pthread_key_t cache_key;
+  pocl_lock_t lock;
+  /* The free objects not cached by any thread. */
+  void *depot;
+  unsigned depot_count;
+};
+
+void pocl_object_pool_init (pocl_object_pool *pool, size_t object_size,
+                            size_t next_offset,
+                            void (*init_object) (void *object));
+
+void *pocl_object_pool_alloc (pocl_object_pool *pool);
+
+void pocl_object_pool_free (pocl_object_pool *pool, void *object);
 
 void pocl_init_mem_manager (void);
 
@@ -33,3 +67,5 @@ void pocl_mem_manager_free_event (cl_event event);
 _cl_command_node* pocl_mem_manager_new_command (void);
 
 void pocl_mem_manager_free_command (_cl_command_node *cmd_ptr);
+
+#endif
@@ -0,0 +1,660 @@
+/* OpenCL runtime library: command queue execution
+
+   Copyright (c) 2011 Erik Schnetter
+                 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pocl_queue_util.h"
+#include "pocl_util.h"
+#include "pocl_image_util.h"
+#include "pocl_mem_management.h"
+#include "pocl_runtime_config.h"
+#include "utlist.h"
+#include "clEnqueueMapBuffer.h"
+
+/* Protects the command lists and the execution state of all the
+   command queues, as well as the lists of queues to notify on the
+   completion of events. */
+static pocl_lock_t queue_lock = POCL_LOCK_INITIALIZER;
+
+/* The values of the exit flag of a queue. */
+#define QUEUE_RUNNING 0
+#define QUEUE_EXIT 1
+/* The last dispatcher to exit must free the queue. */
+#define QUEUE_EXIT_AND_FREE 2
+
+/* The number of dispatcher threads executing the commands of an
+   out-of-order queue concurrently. */
+#define OOO_QUEUE_THREADS_ENV "POCL_OOO_QUEUE_THREADS"
+#define DEFAULT_OOO_QUEUE_THREADS 4
+
+/* The bytes written at a time by the fill of a device without a fill
+   operation. */
+#define FILL_STAGING_SIZE (64 * 1024)
+
+static void *queue_dispatcher (void *data);
+
+cl_int
+pocl_queue_init (cl_command_queue command_queue)
+{
+  unsigned i, num_threads = 1;
+
+  if (command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+    num_threads = max (1, pocl_get_int_option (OOO_QUEUE_THREADS_ENV, 
+                                               DEFAULT_OOO_QUEUE_THREADS));
+
+  command_queue->root = NULL;
+  command_queue->running = NULL;
+  command_queue->exit = QUEUE_RUNNING;
+  command_queue->dispatchers = 
+    (pthread_t*) malloc (num_threads * sizeof (pthread_t));
+  if (command_queue->dispatchers == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  pthread_cond_init (&command_queue->wakeup_cond, NULL);
+  pthread_cond_init (&command_queue->finish_cond, NULL);
+
+  POCL_LOCK (queue_lock);
+  for (i = 0; i < num_threads; ++i)
+    {
+      if (pthread_create (&command_queue->dispatchers[i], NULL, 
+                          queue_dispatcher, command_queue) != 0)
+        break;
+    }
+  command_queue->num_dispatchers = command_queue->num_alive_dispatchers = i;
+  POCL_UNLOCK (queue_lock);
+
+  if (i == 0)
+    {
+      free (command_queue->dispatchers);
+      return CL_OUT_OF_HOST_MEMORY;
+    }
+  return CL_SUCCESS;
+}
+
+int
+pocl_queue_destroy (cl_command_queue command_queue)
+{
+  unsigned i;
+  /* The last reference is dropped by a dispatcher itself when it
+     releases the event of the last command of the queue. */
+  int in_dispatcher = 0;
+  for (i = 0; i < command_queue->num_dispatchers; ++i)
+    in_dispatcher |= 
+      pthread_equal (pthread_self (), command_queue->dispatchers[i]);
+
+  POCL_LOCK (queue_lock);
+  assert (command_queue->root == NULL && command_queue->running == NULL);
+  command_queue->exit = in_dispatcher ? QUEUE_EXIT_AND_FREE : QUEUE_EXIT;
+  pthread_cond_broadcast (&command_queue->wakeup_cond);
+  POCL_UNLOCK (queue_lock);
+
+  if (in_dispatcher)
+    {
+      for (i = 0; i < command_queue->num_dispatchers; ++i)
+        pthread_detach (command_queue->dispatchers[i]);
+      return 0;
+    }
+
+  for (i = 0; i < command_queue->num_dispatchers; ++i)
+    pthread_join (command_queue->dispatchers[i], NULL);
+  free (command_queue->dispatchers);
+  pthread_cond_destroy (&command_queue->wakeup_cond);
+  pthread_cond_destroy (&command_queue->finish_cond);
+  return 1;
+}
+
+/* Makes the dispatchers of the queue wake up when the event of another
+   queue completes. The event cannot complete in between the status
+   check and the registration, since the dispatcher completing it
+   takes the queue lock before processing the list. Must be called
+   with the queue lock held. */
+static void
+notify_on_completion (cl_event event, cl_command_queue command_queue)
+{
+  queue_notify_item *item;
+
+  if (event->queue == command_queue || event->status == CL_COMPLETE)
+    return;
+
+  LL_FOREACH (event->notify_list, item)
+    {
+      if (item->queue == command_queue)
+        return;
+    }
+  item = (queue_notify_item*) malloc (sizeof (queue_notify_item));
+  item->queue = command_queue;
+  LL_PREPEND (event->notify_list, item);
+}
+
+void
+pocl_queue_enqueue (cl_command_queue command_queue, _cl_command_node *node)
+{
+  int i;
+
+  POCL_LOCK (queue_lock);
+  /* In an in-order queue the command depends on the previous one.
+     The commands that have already been taken to execution are run by
+     the same dispatcher, thus they complete before this one starts. */
+  if (!(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+      && command_queue->root != NULL)
+    {
+      _cl_command_node *prev_command;
+      cl_event *wait_list = (cl_event*)node->event_wait_list;
+      for (prev_command = command_queue->root; prev_command->next != NULL;
+           prev_command = prev_command->next){}
+      /* pocl_create_command() reserved space for this. */
+      wait_list[node->num_events_in_wait_list++] = prev_command->event;
+      POname(clRetainEvent) (prev_command->event);
+    }
+  for (i = 0; i < node->num_events_in_wait_list; ++i)
+    notify_on_completion (node->event_wait_list[i], command_queue);
+  POCL_UPDATE_EVENT_QUEUED (&node->event, command_queue);
+  LL_APPEND (command_queue->root, node);
+  pthread_cond_signal (&command_queue->wakeup_cond);
+  POCL_UNLOCK (queue_lock);
+}
+
+void
+pocl_queue_flush (cl_command_queue command_queue)
+{
+  /* The dispatcher is always running. */
+  POCL_LOCK (queue_lock);
+  pthread_cond_signal (&command_queue->wakeup_cond);
+  POCL_UNLOCK (queue_lock);
+}
+
+void
+pocl_queue_finish (cl_command_queue command_queue)
+{
+  POCL_LOCK (queue_lock);
+  while (command_queue->root != NULL || command_queue->running != NULL)
+    pthread_cond_wait (&command_queue->finish_cond, &queue_lock);
+  POCL_UNLOCK (queue_lock);
+}
+
+/* Returns non-zero if all the events the command waits for have
+   completed. Must be called with the queue lock held. */
+static int
+command_ready (_cl_command_node *node)
+{
+  int i;
+  for (i = 0; i < node->num_events_in_wait_list; ++i)
+    {
+      if (node->event_wait_list[i]->status != CL_COMPLETE)
+        return 0;
+    }
+  return 1;
+}
+
+/* Returns the i:th memory object accessed by the command in *mem, and
+   whether the command might modify it in *write. Returns 0 if the
+   command accesses less than i + 1 memory objects. */
+static int
+command_mem_access (_cl_command_node *node, int i, cl_mem *mem, int *write)
+{
+  *write = 1;
+  switch (node->type)
+    {
+    case CL_COMMAND_READ_BUFFER:
+      *mem = node->command.read.buffer;
+      *write = 0;
+      return i == 0;
+    case CL_COMMAND_WRITE_BUFFER:
+      *mem = node->command.write.buffer;
+      return i == 0;
+    case CL_COMMAND_COPY_BUFFER:
+      *mem = i == 0 ? node->command.copy.dst_buffer :
+        node->command.copy.src_buffer;
+      *write = i == 0;
+      return i < 2;
+    case CL_COMMAND_MAP_BUFFER:
+    case CL_COMMAND_MAP_IMAGE:
+      /* The host modifies the buffer only after the map and before
+         the unmap command. */
+      *mem = node->command.map.buffer;
+      *write = 0;
+      return i == 0;
+    case CL_COMMAND_UNMAP_MEM_OBJECT:
+      *mem = node->command.unmap.memobj;
+      return i == 0;
+    case CL_COMMAND_READ_IMAGE:
+      *mem = node->command.rw_image.buffer;
+      *write = 0;
+      return i == 0;
+    case CL_COMMAND_WRITE_IMAGE:
+      *mem = node->command.rw_image.buffer;
+      return i == 0;
+    case CL_COMMAND_NDRANGE_KERNEL:
+      if (i >= node->command.run.arg_buffer_count)
+        return 0;
+      *mem = node->command.run.arg_buffers[i];
+      if (*mem != NULL)
+        *write = node->command.run.arg_buffer_writes[i] &&
+          !((*mem)->flags & CL_MEM_READ_ONLY);
+      return 1;
+    case CL_COMMAND_NATIVE_KERNEL:
+      if (i >= node->command.native.num_mem_objects)
+        return 0;
+      *mem = node->command.native.mem_list[i];
+      return 1;
+    case CL_COMMAND_FILL_BUFFER:
+      *mem = node->command.fill.buffer;
+      return i == 0;
+    case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+      /* The migration can move the pages of the objects. */
+      if (i >= node->command.migrate.num_mem_objects)
+        return 0;
+      *mem = node->command.migrate.mem_objects[i];
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+/* The commands that are ordered with respect to all the commands
+   enqueued before them. The fill command does not record the image
+   it writes to, thus it is serialized conservatively. */
+static int
+waits_for_all_earlier (_cl_command_node *node)
+{
+  return node->type == CL_COMMAND_BARRIER ||
+    node->type == CL_COMMAND_FILL_IMAGE ||
+    (node->type == CL_COMMAND_MARKER && node->num_events_in_wait_list == 0);
+}
+
+/* The commands that all the commands enqueued after them wait for. */
+static int
+blocks_all_later (_cl_command_node *node)
+{
+  return node->type == CL_COMMAND_BARRIER ||
+    node->type == CL_COMMAND_FILL_IMAGE;
+}
+
+static cl_mem
+root_mem_object (cl_mem mem)
+{
+  return mem->parent != NULL ? mem->parent : mem;
+}
+
+/* Returns non-zero if the later command of an out-of-order queue
+   cannot start before the earlier one has completed due to
+   an implicit data dependency. */
+static int
+commands_conflict (_cl_command_node *earlier, _cl_command_node *later)
+{
+  cl_mem a, b;
+  int a_write, b_write;
+  int i, j;
+
+  if (waits_for_all_earlier (later) || blocks_all_later (earlier))
+    return 1;
+
+  for (i = 0; command_mem_access (earlier, i, &a, &a_write); ++i)
+    {
+      if (a == NULL)
+        continue;
+      for (j = 0; command_mem_access (later, j, &b, &b_write); ++j)
+        {
+          if (b != NULL && (a_write || b_write) &&
+              root_mem_object (a) == root_mem_object (b))
+            return 1;
+        }
+    }
+  return 0;
+}
+
+/* Returns the next command of the queue that can be started, or NULL.
+   In an out-of-order queue, the commands form a DAG defined by their
+   wait lists and the read-after-write, write-after-read and
+   write-after-write dependencies on the memory objects they access.
+   Must be called with the queue lock held. */
+static _cl_command_node *
+next_ready_command (cl_command_queue command_queue)
+{
+  _cl_command_node *node, *prev;
+
+  if (!(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+    {
+      node = command_queue->root;
+      return node != NULL && command_ready (node) ? node : NULL;
+    }
+
+  LL_FOREACH (command_queue->root, node)
+    {
+      int blocked = !command_ready (node);
+      for (prev = command_queue->running; prev != NULL && !blocked; 
+           prev = prev->next)
+        blocked = commands_conflict (prev, node);
+      for (prev = command_queue->root; prev != node && !blocked; 
+           prev = prev->next)
+        blocked = commands_conflict (prev, node);
+      if (!blocked)
+        return node;
+    }
+  return NULL;
+}
+
+static void *
+queue_dispatcher (void *data)
+{
+  cl_command_queue command_queue = (cl_command_queue) data;
+  queue_notify_item *item, *tmp;
+  _cl_command_node *node;
+  cl_event event;
+  int free_queue;
+
+  POCL_LOCK (queue_lock);
+  while (!command_queue->exit)
+    {
+      node = next_ready_command (command_queue);
+      if (node == NULL)
+        {
+          /* Wait for new commands or for completion of commands of this
+             or other queues. */
+          pthread_cond_wait (&command_queue->wakeup_cond, &queue_lock);
+          continue;
+        }
+
+      LL_DELETE (command_queue->root, node);
+      LL_PREPEND (command_queue->running, node);
+      POCL_UPDATE_EVENT_SUBMITTED (&node->event, command_queue);
+      POCL_UNLOCK (queue_lock);
+
+      event = node->event;
+      pocl_exec_command (node);
+
+      POCL_LOCK (queue_lock);
+      LL_DELETE (command_queue->running, node);
+      /* Wake up the queues with commands waiting for this one. */
+      LL_FOREACH_SAFE (event->notify_list, item, tmp)
+        {
+          pthread_cond_broadcast (&item->queue->wakeup_cond);
+          free (item);
+        }
+      event->notify_list = NULL;
+      /* The other dispatchers of an out-of-order queue. */
+      if (command_queue->root != NULL && command_queue->num_dispatchers > 1)
+        pthread_cond_broadcast (&command_queue->wakeup_cond);
+      if (command_queue->root == NULL && command_queue->running == NULL)
+        pthread_cond_broadcast (&command_queue->finish_cond);
+      POCL_UNLOCK (queue_lock);
+
+      pocl_mem_manager_free_command (node);
+      /* This can release the last reference to the queue, in which
+         case the exit flag gets set. */
+      POname(clReleaseEvent) (event);
+
+      POCL_LOCK (queue_lock);
+    }
+  free_queue = --command_queue->num_alive_dispatchers == 0 &&
+    command_queue->exit == QUEUE_EXIT_AND_FREE;
+  POCL_UNLOCK (queue_lock);
+
+  if (free_queue)
+    {
+      free (command_queue->dispatchers);
+      pthread_cond_destroy (&command_queue->wakeup_cond);
+      pthread_cond_destroy (&command_queue->finish_cond);
+      free (command_queue);
+    }
+  return NULL;
+}
+
+/* Fills a buffer with the fill operation of the device, or by writing
+   a host buffer holding the pattern repeated. */
+static void
+fill_buffer_cmd (_cl_command_node *node)
+{
+  _cl_command_fill *fill = &node->command.fill;
+  char *staging;
+  size_t staging_size, filled, offset;
+
+  if (node->device->ops->fill != NULL)
+    {
+      node->device->ops->fill (fill->data, fill->device_ptr, fill->size,
+                               fill->pattern, fill->pattern_size);
+      return;
+    }
+
+  /* The pattern size is a power of two of at most 128 bytes, so the
+     chunks written start at the beginning of the pattern. */
+  staging_size = min (fill->size, FILL_STAGING_SIZE);
+  staging = (char*) malloc (staging_size);
+  if (staging == NULL)
+    POCL_ABORT ("Out of memory in a buffer fill.\n");
+  memcpy (staging, fill->pattern, fill->pattern_size);
+  for (filled = fill->pattern_size; filled < staging_size; filled *= 2)
+    memcpy (staging + filled, staging, min (filled, staging_size - filled));
+
+  for (offset = 0; offset < fill->size; offset += staging_size)
+    node->device->ops->write
+      (fill->data, staging, (char*)fill->device_ptr + offset,
+       min (staging_size, fill->size - offset));
+  free (staging);
+}
+
+void
+pocl_exec_command (_cl_command_node *node)
+{
+  int i;
+  cl_event *event = &(node->event);
+  cl_command_queue command_queue = node->event->queue;
+  event_callback_item* cb_ptr;
+
+  if (node->device->ops->compile_submitted_kernels)
+    node->device->ops->compile_submitted_kernels (node);
+
+  switch (node->type)
+    {
+    case CL_COMMAND_READ_BUFFER:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->read
+        (node->device->data,
+         node->command.read.host_ptr,
+         node->command.read.device_ptr,
+         node->command.read.cb);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      POname(clReleaseMemObject) (node->command.read.buffer);
+      break;
+    case CL_COMMAND_WRITE_BUFFER:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->write
+        (node->device->data,
+         node->command.write.host_ptr,
+         node->command.write.device_ptr,
+         node->command.write.cb);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      POname(clReleaseMemObject) (node->command.write.buffer);
+      break;
+    case CL_COMMAND_COPY_BUFFER:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->copy
+        (node->command.copy.data,
+         node->command.copy.src_ptr,
+         node->command.copy.dst_ptr,
+         node->command.copy.cb);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      POname(clReleaseMemObject) (node->command.copy.src_buffer);
+      POname(clReleaseMemObject) (node->command.copy.dst_buffer);
+      break;
+    case CL_COMMAND_MAP_IMAGE:
+    case CL_COMMAND_MAP_BUFFER:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      pocl_map_mem_cmd (node->device, node->command.map.buffer,
+                        node->command.map.mapping);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      break;
+    case CL_COMMAND_WRITE_IMAGE:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->write_rect
+        (node->device->data, node->command.rw_image.host_ptr,
+         node->command.rw_image.device_ptr, node->command.rw_image.origin,
+         node->command.rw_image.origin, node->command.rw_image.region,
+         node->command.rw_image.rowpitch,
+         node->command.rw_image.slicepitch,
+         node->command.rw_image.rowpitch,
+         node->command.rw_image.slicepitch);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      break;
+    case CL_COMMAND_READ_IMAGE:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->read_rect
+        (node->device->data, node->command.rw_image.host_ptr,
+         node->command.rw_image.device_ptr, node->command.rw_image.origin,
+         node->command.rw_image.origin, node->command.rw_image.region,
+         node->command.rw_image.rowpitch,
+         node->command.rw_image.slicepitch,
+         node->command.rw_image.rowpitch,
+         node->command.rw_image.slicepitch);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      break;
+    case CL_COMMAND_UNMAP_MEM_OBJECT:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      if ((node->command.unmap.memobj)->flags &
+          (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR))
+        {
+          /* TODO: should we ensure the device global region is updated from
+             the host memory? How does the specs define it,
+             can the host_ptr be assumed to point to the host and the
+             device accessible memory or just point there until the
+             kernel(s) get executed or similar? */
+          /* Assume the region is automatically up to date. */
+        } else
+        {
+          /* TODO: fixme. The offset computation must be done at the device
+             driver. */
+          if (node->device->ops->unmap_mem != NULL)
+            node->device->ops->unmap_mem
+              (node->device->data,
+               (node->command.unmap.mapping)->host_ptr,
+               (node->command.unmap.memobj)->device_ptrs[node->device->dev_id].mem_ptr,
+               (node->command.unmap.mapping)->size);
+        }
+      /* The application thread appends to the mappings while the
+         commands of the object run in the dispatchers. */
+      POCL_LOCK_OBJ (node->command.unmap.memobj);
+      DL_DELETE((node->command.unmap.memobj)->mappings,
+                node->command.unmap.mapping);
+      (node->command.unmap.memobj)->map_count--;
+      POCL_UNLOCK_OBJ (node->command.unmap.memobj);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      break;
+    case CL_COMMAND_NDRANGE_KERNEL:
+      assert (*event == node->event);
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->run(node->command.run.data, node);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      for (i = 0; i < node->command.run.arg_buffer_count; ++i)
+        {
+          cl_mem buf = node->command.run.arg_buffers[i];
+          if (buf == NULL) continue;
+          /*printf ("### releasing arg %d - the buffer %x of kernel %s\n", i,
+            buf,  node->command.run.kernel->function_name); */
+          POname(clReleaseMemObject) (buf);
+        }
+
+      free (node->command.run.arg_buffers);
+      free (node->command.run.arg_buffer_writes);
+      free (node->command.run.tmp_dir);
+      for (i = 0; i < node->command.run.kernel->num_args +
+             node->command.run.kernel->num_locals; ++i)
+        {
+          pocl_aligned_free (node->command.run.arguments[i].value);
+        }
+      free (node->command.run.arguments);
+
+      POname(clReleaseKernel)(node->command.run.kernel);
+      break;
+    case CL_COMMAND_NATIVE_KERNEL:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->run_native(node->command.native.data, node);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      for (i = 0; i < node->command.native.num_mem_objects; ++i)
+        {
+          cl_mem buf = node->command.native.mem_list[i];
+          if (buf == NULL) continue;
+          POname(clReleaseMemObject) (buf);
+        }
+      free (node->command.native.mem_list);
+      free (node->command.native.args);
+      break;
+    case CL_COMMAND_FILL_IMAGE:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      node->device->ops->fill_rect
+        (node->command.fill_image.data,
+         node->command.fill_image.device_ptr,
+         node->command.fill_image.buffer_origin,
+         node->command.fill_image.region,
+         node->command.fill_image.rowpitch,
+         node->command.fill_image.slicepitch,
+         node->command.fill_image.fill_pixel,
+         node->command.fill_image.pixel_size);
+      free(node->command.fill_image.fill_pixel);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      break;
+    case CL_COMMAND_FILL_BUFFER:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      fill_buffer_cmd (node);
+      free (node->command.fill.pattern);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      POname(clReleaseMemObject) (node->command.fill.buffer);
+      break;
+    case CL_COMMAND_MIGRATE_MEM_OBJECTS:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      if (node->device->ops->migrate != NULL)
+        node->device->ops->migrate
+          (node->device,
+           node->command.migrate.mem_objects,
+           node->command.migrate.num_mem_objects,
+           node->command.migrate.flags);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      for (i = 0; i < node->command.migrate.num_mem_objects; ++i)
+        POname(clReleaseMemObject) (node->command.migrate.mem_objects[i]);
+      free (node->command.migrate.mem_objects);
+      break;
+    case CL_COMMAND_MARKER:
+    case CL_COMMAND_BARRIER:
+      POCL_UPDATE_EVENT_RUNNING(event, command_queue);
+      POCL_UPDATE_EVENT_COMPLETE(event, command_queue);
+      break;
+    default:
+      POCL_ABORT_UNIMPLEMENTED();
+      break;
+    }
+
+  /* event callback handling
+     just call functions in the same order they were added */
+  for (cb_ptr = (*event)->callback_list; cb_ptr; cb_ptr = cb_ptr->next)
+    {
+      cb_ptr->callback_function ((*event), cb_ptr->trigger_status,
+                                 cb_ptr->user_data);
+    }
+
+  for (i = 0; i < node->num_events_in_wait_list; ++i)
+    POname(clReleaseEvent) (node->event_wait_list[i]);
+  free ((cl_event*)node->event_wait_list);
+  node->event_wait_list = NULL;
+  node->num_events_in_wait_list = 0;
+}
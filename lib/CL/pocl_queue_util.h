@@ -0,0 +1,70 @@
+/* OpenCL runtime library: command queue execution
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+/* Each command queue has a dispatcher thread which executes the
+   commands of the queue in the background as soon as the events in
+   their wait lists have completed. The host thread only appends the
+   commands to the queue. */
+
+#ifndef POCL_QUEUE_UTIL_H
+#define POCL_QUEUE_UTIL_H
+
+#include "pocl_cl.h"
+
+#pragma GCC visibility push(hidden)
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializes the execution state of a new command queue and starts
+   its dispatcher thread. Returns CL_OUT_OF_HOST_MEMORY if the thread
+   could not be created. */
+cl_int pocl_queue_init (cl_command_queue command_queue);
+
+/* Stops the dispatcher of a command queue which is not referred to
+   anymore. Returns non-zero if the caller should free the queue, zero
+   if the dispatcher thread itself released the last reference and
+   frees the queue once it is done. */
+int pocl_queue_destroy (cl_command_queue command_queue);
+
+/* Appends the command to the queue and notifies the dispatcher. */
+void pocl_queue_enqueue (cl_command_queue command_queue,
+                         _cl_command_node *node);
+
+/* Ensures the commands in the queue are being executed. */
+void pocl_queue_flush (cl_command_queue command_queue);
+
+/* Blocks until all the commands in the queue have completed. */
+void pocl_queue_finish (cl_command_queue command_queue);
+
+/* Executes a single command whose wait list has completed, updates
+   its event, runs the event callbacks and releases the resources
+   held by the command. */
+void pocl_exec_command (_cl_command_node *node);
+
+#ifdef __cplusplus
+}
+#endif
+#pragma GCC visibility pop
+
+#endif
@@ -31,6 +31,7 @@
 #include "pocl_cl.h"
 #include "utlist.h"
 #include "pocl_mem_management.h"
+#include "pocl_queue_util.h"
 
 #define TEMP_DIR_PATH_CHARS 16
 
@@ -74,6 +75,13 @@ pocl_create_temp_dir()
   return path_name;
 }
 
+unsigned long
+pocl_unique_id (void)
+{
+  static unsigned long last_id = 0;
+  return __sync_add_and_fetch (&last_id, 1);
+}
+
 uint32_t
 byteswap_uint32_t (uint32_t word, char should_swap) 
 {
@@ -206,13 +214,14 @@ cl_int pocl_create_event (cl_event *event, cl_command_queue command_queue,
   if (event != NULL)
     {
       *event = pocl_mem_manager_new_event ();
-      if (event == NULL)
+      if (*event == NULL)
         return CL_OUT_OF_HOST_MEMORY;
       
       (*event)->queue = command_queue;
       POname(clRetainCommandQueue) (command_queue);
       (*event)->command_type = command_type;
       (*event)->callback_list = NULL;
+      (*event)->notify_list = NULL;
       (*event)->next = NULL;
     }
   return CL_SUCCESS;
@@ -227,6 +236,8 @@ cl_int pocl_create_command (_cl_command_node **cmd,
   int err;
   cl_event *event = NULL;
 
+  /* The command is NULL if it could not be created. */
+  *cmd = NULL;
   if ((wait_list == NULL && num_events != 0) ||
       (wait_list != NULL && num_events == 0))
     return CL_INVALID_EVENT_WAIT_LIST;
@@ -247,39 +258,29 @@ cl_int pocl_create_command (_cl_command_node **cmd,
   err = pocl_create_event(event, command_queue, command_type);
   if (err != CL_SUCCESS)
     {
-      free (*cmd);
+      pocl_mem_manager_free_command (*cmd);
+      *cmd = NULL;
       return err;
     }
   if (event_p)
     *event_p = *event;
-  
-  /* if in-order command queue and queue is not empty, add event from 
-     previous command to new commands event_waitlist */
-  if (!(command_queue->properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) 
-      && command_queue->root != NULL)
-    {
-      _cl_command_node *prev_command;
-      for (prev_command = command_queue->root; prev_command->next != NULL;
-           prev_command = prev_command->next){}
-      //printf("create_command: prev_com=%d prev_com->event = %d \n",prev_command, prev_command->event);
-      cl_event *new_wl = (cl_event*)malloc ((num_events +1)*sizeof (cl_event));
-      for (i = 0; i < num_events; ++i)
-        {
-          new_wl[i] = wait_list[i];
-        }
-      new_wl[i] = prev_command->event;
-      (*cmd)->event_wait_list = new_wl;
-      (*cmd)->num_events_in_wait_list = num_events + 1;
-      for (i = 0; i < num_events + 1; ++i)
-        {
-          //printf("create-command: new_wl[%i]=%d\n", i, new_wl[i]);
-        }
-    }
   else
+    /* Only the command refers to the event. It is released after
+       the command has been executed. */
+    POCL_RELEASE_OBJECT (*event, i);
+  
+  /* The command is executed asynchronously, thus keep a copy of the
+     wait list and the events in it alive until then. Leave space for
+     the event of the previous command of an in-order queue, which is
+     added in pocl_command_enqueue. */
+  cl_event *new_wl = (cl_event*)malloc ((num_events + 1)*sizeof (cl_event));
+  for (i = 0; i < num_events; ++i)
     {
-      (*cmd)->event_wait_list = wait_list;  
-      (*cmd)->num_events_in_wait_list = num_events;
+      new_wl[i] = wait_list[i];
+      POname(clRetainEvent) (wait_list[i]);
     }
+  (*cmd)->event_wait_list = new_wl;
+  (*cmd)->num_events_in_wait_list = num_events;
   (*cmd)->type = command_type;
   (*cmd)->next = NULL;
   (*cmd)->device = command_queue->device;
@@ -293,6 +294,86 @@ cl_int pocl_create_command (_cl_command_node **cmd,
 void pocl_command_enqueue(cl_command_queue command_queue, 
                           _cl_command_node *node)
 {
-  POCL_UPDATE_EVENT_QUEUED (&node->event, command_queue);
-  LL_APPEND (command_queue->root, node);
+  pocl_queue_enqueue (command_queue, node);
+}
+
+pocl_wg_cache_item *
+pocl_kernel_find_wg (cl_kernel kernel, cl_device_id device,
+                     size_t local_x, size_t local_y, size_t local_z)
+{
+  pocl_wg_cache_item *item;
+  POCL_LOCK_OBJ (kernel);
+  LL_FOREACH (kernel->wg_cache, item)
+    {
+      if (item->device == device && item->local_x == local_x &&
+          item->local_y == local_y && item->local_z == local_z)
+        break;
+    }
+  POCL_UNLOCK_OBJ (kernel);
+  return item;
+}
+
+void
+pocl_kernel_add_wg (cl_kernel kernel, cl_device_id device,
+                    size_t local_x, size_t local_y, size_t local_z,
+                    const char *tmp_dir, pocl_workgroup wg,
+                    pocl_workgroup_range wg_range,
+                    size_t context_scratch_size)
+{
+  pocl_wg_cache_item *item;
+
+  if (pocl_kernel_find_wg (kernel, device, local_x, local_y, local_z) != NULL)
+    return;
+
+  item = (pocl_wg_cache_item*) malloc (sizeof (pocl_wg_cache_item));
+  if (item == NULL)
+    return;
+  item->device = device;
+  item->local_x = local_x;
+  item->local_y = local_y;
+  item->local_z = local_z;
+  item->tmp_dir = strdup (tmp_dir);
+  item->wg = wg;
+  item->wg_range = wg_range;
+  item->context_scratch_size = context_scratch_size;
+
+  /* The items are never removed while the kernel is alive, thus a
+     concurrent duplicate add is harmless, the first one is found. */
+  POCL_LOCK_OBJ (kernel);
+  LL_APPEND (kernel->wg_cache, item);
+  POCL_UNLOCK_OBJ (kernel);
+}
+
+unsigned
+pocl_kernel_count_launch (cl_kernel kernel, cl_device_id device,
+                          size_t local_x, size_t local_y, size_t local_z)
+{
+  pocl_local_size_count *count;
+  unsigned launches;
+
+  POCL_LOCK_OBJ (kernel);
+  LL_FOREACH (kernel->local_size_counts, count)
+    {
+      if (count->device == device && count->local_x == local_x &&
+          count->local_y == local_y && count->local_z == local_z)
+        break;
+    }
+  if (count == NULL)
+    {
+      count = (pocl_local_size_count*) malloc (sizeof (pocl_local_size_count));
+      if (count == NULL)
+        {
+          POCL_UNLOCK_OBJ (kernel);
+          return 1;
+        }
+      count->device = device;
+      count->local_x = local_x;
+      count->local_y = local_y;
+      count->local_z = local_z;
+      count->launches = 0;
+      LL_PREPEND (kernel->local_size_counts, count);
+    }
+  launches = ++count->launches;
+  POCL_UNLOCK_OBJ (kernel);
+  return launches;
 }
@@ -44,6 +44,9 @@ void remove_directory (const char *path_name);
 uint32_t byteswap_uint32_t (uint32_t word, char should_swap);
 float byteswap_float (float word, char should_swap);
 
+/* Returns a new non-zero number at each call. Thread safe. */
+unsigned long pocl_unique_id (void);
+
 /* Finds the next highest power of two of the given value. */
 size_t pocl_size_ceil2(size_t x);
 
@@ -100,4 +103,26 @@ cl_int pocl_create_command (_cl_command_node **cmd,
 void pocl_command_enqueue(cl_command_queue command_queue, 
                           _cl_command_node *node);
 
+/* Returns the work-group function of the kernel generated for the
+   device and the local size, NULL if it has not been generated yet. */
+pocl_wg_cache_item *pocl_kernel_find_wg (cl_kernel kernel,
+                                         cl_device_id device,
+                                         size_t local_x, size_t local_y,
+                                         size_t local_z);
+
+/* Remembers the work-group function generated for the kernel, the device
+   and the local size (in the tmp_dir) for the later launches. */
+void pocl_kernel_add_wg (cl_kernel kernel, cl_device_id device,
+                         size_t local_x, size_t local_y, size_t local_z,
+                         const char *tmp_dir, pocl_workgroup wg,
+                         pocl_workgroup_range wg_range,
+                         size_t context_scratch_size);
+
+/* Counts a launch of the kernel on the device with the local size.
+   Returns the number of the launches counted so far, including this
+   one. */
+unsigned pocl_kernel_count_launch (cl_kernel kernel, cl_device_id device,
+                                   size_t local_x, size_t local_y,
+                                   size_t local_z);
+
 #endif
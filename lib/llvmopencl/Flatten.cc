@@ -38,8 +38,6 @@
 using namespace llvm;
 using namespace pocl;
 
-extern cl::opt<std::string> KernelName;
-
 char Flatten::ID = 0;
 static RegisterPass<Flatten> X("flatten", "Kernel function flattening pass");
 
@@ -53,12 +51,13 @@ bool
 Flatten::runOnModule(Module &M)
 {
   bool changed = false;
+  std::string kernelName = pocl::Workgroup::kernelNameToProcess(M);
   for (llvm::Module::iterator i = M.begin(), e = M.end(); i != e; ++i)
     {
       llvm::Function *f = i;
       if (f->isDeclaration()) continue;
-      if (KernelName == f->getName() || 
-          (KernelName == "" && pocl::Workgroup::isKernelToProcess(*f)))
+      if (kernelName == f->getName() || 
+          (kernelName == "" && pocl::Workgroup::isKernelToProcess(*f)))
         {
 #ifdef LLVM_3_1
           f->removeFnAttr(Attribute::AlwaysInline);
@@ -28,11 +28,16 @@
 #ifdef LLVM_3_2
 #include <llvm/Module.h>
 #include <llvm/Metadata.h>
+#include <llvm/Constants.h>
 #else
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Metadata.h>
+#include <llvm/IR/Constants.h>
 #endif
 
+#define KERNEL_COMPILER_OPTIONS_MD "pocl.kernel_compiler_options"
+#define CONTEXT_SAVINGS_MD "pocl.context_savings"
+
 using namespace llvm;
 
 namespace pocl {
@@ -91,5 +96,83 @@ regenerate_kernel_metadata(llvm::Module &M, FunctionMapping &kernels)
   }
 }
 
+void
+setKernelCompilerOptions(llvm::Module &M, const std::string &kernelName,
+                         int localSizeX, int localSizeY, int localSizeZ,
+                         int dynamicLocalSize, int contextScratch,
+                         int vectorWidth)
+{
+  NamedMDNode *nmd = M.getNamedMetadata(KERNEL_COMPILER_OPTIONS_MD);
+  if (nmd)
+    M.eraseNamedMetadata(nmd);
+
+  LLVMContext &C = M.getContext();
+  Type *i32 = Type::getInt32Ty(C);
+  SmallVector<Value*, 7> operands;
+  operands.push_back(MDString::get(C, kernelName));
+  operands.push_back(ConstantInt::get(i32, localSizeX));
+  operands.push_back(ConstantInt::get(i32, localSizeY));
+  operands.push_back(ConstantInt::get(i32, localSizeZ));
+  operands.push_back(ConstantInt::get(i32, dynamicLocalSize));
+  operands.push_back(ConstantInt::get(i32, contextScratch));
+  operands.push_back(ConstantInt::get(i32, vectorWidth));
+
+  nmd = M.getOrInsertNamedMetadata(KERNEL_COMPILER_OPTIONS_MD);
+  nmd->addOperand(MDNode::get(C, operands));
+}
+
+bool
+getKernelCompilerOptions(const llvm::Module &M, std::string &kernelName,
+                         int localSize[3], int &dynamicLocalSize,
+                         int &contextScratch, int &vectorWidth)
+{
+  NamedMDNode *nmd = M.getNamedMetadata(KERNEL_COMPILER_OPTIONS_MD);
+  if (nmd == NULL || nmd->getNumOperands() == 0)
+    return false;
+
+  MDNode *md = nmd->getOperand(0);
+  kernelName = cast<MDString>(md->getOperand(0))->getString().str();
+  for (int i = 0; i < 3; ++i)
+    localSize[i] = cast<ConstantInt>(md->getOperand(1 + i))->getZExtValue();
+  dynamicLocalSize = cast<ConstantInt>(md->getOperand(4))->getZExtValue();
+  contextScratch = cast<ConstantInt>(md->getOperand(5))->getZExtValue();
+  vectorWidth = cast<ConstantInt>(md->getOperand(6))->getZExtValue();
+  return true;
+}
+
+void
+setContextSavings(llvm::Module &M, const std::string &kernelName,
+                  unsigned rematerializedValues, uint64_t bytesSaved)
+{
+  NamedMDNode *nmd = M.getNamedMetadata(CONTEXT_SAVINGS_MD);
+  if (nmd)
+    M.eraseNamedMetadata(nmd);
+
+  LLVMContext &C = M.getContext();
+  SmallVector<Value*, 3> operands;
+  operands.push_back(MDString::get(C, kernelName));
+  operands.push_back(ConstantInt::get(Type::getInt32Ty(C),
+                                      rematerializedValues));
+  operands.push_back(ConstantInt::get(Type::getInt64Ty(C), bytesSaved));
+
+  nmd = M.getOrInsertNamedMetadata(CONTEXT_SAVINGS_MD);
+  nmd->addOperand(MDNode::get(C, operands));
+}
+
+bool
+getContextSavings(const llvm::Module &M, std::string &kernelName,
+                  unsigned &rematerializedValues, uint64_t &bytesSaved)
+{
+  NamedMDNode *nmd = M.getNamedMetadata(CONTEXT_SAVINGS_MD);
+  if (nmd == NULL || nmd->getNumOperands() == 0)
+    return false;
+
+  MDNode *md = nmd->getOperand(0);
+  kernelName = cast<MDString>(md->getOperand(0))->getString().str();
+  rematerializedValues = 
+    cast<ConstantInt>(md->getOperand(1))->getZExtValue();
+  bytesSaved = cast<ConstantInt>(md->getOperand(2))->getZExtValue();
+  return true;
 }
 
+}
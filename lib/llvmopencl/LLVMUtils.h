@@ -52,6 +52,34 @@ typedef std::map<llvm::Function*, llvm::Function*> FunctionMapping;
 void
 regenerate_kernel_metadata(llvm::Module &M, FunctionMapping &kernels);
 
+/* The options of a single kernel compilation are stored in the Module,
+   thus several kernels can be compiled in parallel with their own 
+   options. The passes use the command line options (-kernel, -local-size,
+   -dynamic-local-size, -context-scratch and -wiloops-vector-width) in
+   case the Module has none. */
+void
+setKernelCompilerOptions(llvm::Module &M, const std::string &kernelName,
+                         int localSizeX, int localSizeY, int localSizeZ,
+                         int dynamicLocalSize, int contextScratch,
+                         int vectorWidth);
+
+bool
+getKernelCompilerOptions(const llvm::Module &M, std::string &kernelName,
+                         int localSize[3], int &dynamicLocalSize,
+                         int &contextScratch, int &vectorWidth);
+
+/* The context array savings of the work-item loops of the kernel: the
+   number of values rematerialized instead of stored to a context array
+   and the bytes of context arrays saved by it. Stored in the Module so
+   the runtime can report them also in the release builds. */
+void
+setContextSavings(llvm::Module &M, const std::string &kernelName,
+                  unsigned rematerializedValues, uint64_t bytesSaved);
+
+bool
+getContextSavings(const llvm::Module &M, std::string &kernelName,
+                  unsigned &rematerializedValues, uint64_t &bytesSaved);
+
 inline bool
 is_automatic_local(const std::string& funcName, llvm::GlobalVariable &var) 
 {
@@ -38,6 +38,8 @@
 #endif
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
 
 #include <set>
 #include <sstream>
@@ -63,7 +65,7 @@ ParallelRegion::ParallelRegion(int forcedRegionId) :
   exitIndex_(0), entryIndex_(0), pRegionId(forcedRegionId)
 {
   if (forcedRegionId == -1)
-    pRegionId = idGen++;
+    pRegionId = __sync_fetch_and_add(&idGen, 1);
 }
 
 /**
@@ -111,8 +113,11 @@ ParallelRegion::replicate(ValueToValueMapTy &map,
      by LLVM). This causes the variable references to become
      broken. This hack ensures the BB suffixes are unique
      before cloning so each path gets their own value
-     names. Split points can be such paths.*/
+     names. Split points can be such paths.
+     The counts are shared by the parallel kernel compilations. */
   static std::map<std::string, int> cloneCounts;
+  static llvm::sys::Mutex cloneCountsLock;
+  llvm::MutexGuard cloneCountsGuard(cloneCountsLock);
 
   for (iterator i = begin(), e = end(); i != e; ++i) {
     BasicBlock *block = *i;
@@ -64,6 +64,7 @@
 #include <iostream>
 
 #include "pocl.h"
+#include "LLVMUtils.h"
 
 #define STRING_LENGTH 32
 
@@ -75,6 +76,7 @@ static Function *createLauncher(Module &M, Function *F);
 static void privatizeContext(Module &M, Function *F);
 static void createWorkgroup(Module &M, Function *F);
 static void createWorkgroupFast(Module &M, Function *F);
+static void createWorkgroupRange(Module &M, Function *F);
 
 // extern cl::opt<string> Header;
 // extern cl::list<int> LocalSize;
@@ -100,6 +102,8 @@ namespace llvm {
              TypeBuilder<types::i<64>[3], xcompile>::get(Context),
              TypeBuilder<types::i<64>[3], xcompile>::get(Context),
              TypeBuilder<types::i<64>[3], xcompile>::get(Context),
+             TypeBuilder<types::i<64>[3], xcompile>::get(Context),
+             TypeBuilder<types::i<8>*, xcompile>::get(Context),
              NULL);
         }
       else if (size_t_width == 32)
@@ -109,6 +113,8 @@ namespace llvm {
              TypeBuilder<types::i<32>[3], xcompile>::get(Context),
              TypeBuilder<types::i<32>[3], xcompile>::get(Context),
              TypeBuilder<types::i<32>[3], xcompile>::get(Context),
+             TypeBuilder<types::i<32>[3], xcompile>::get(Context),
+             TypeBuilder<types::i<8>*, xcompile>::get(Context),
              NULL);
         }
       else
@@ -123,9 +129,8 @@ namespace llvm {
      * type that depends on the pointer type. 
      *
      * This should be set when the correct type is known. This is a hack
-     * until a better way is found. It's not thread safe, e.g. if one
-     * compiles multiple Modules for multiple different pointer widths in
-     * a same process with multiple threads. */
+     * until a better way is found. The width is per thread as the Modules
+     * for different pointer widths can be compiled in parallel. */
     static void setSizeTWidth(int width) {
       size_t_width = width;
     }    
@@ -134,15 +139,17 @@ namespace llvm {
       WORK_DIM,
       NUM_GROUPS,
       GROUP_ID,
-      GLOBAL_OFFSET
+      GLOBAL_OFFSET,
+      LOCAL_SIZE,
+      CONTEXT_SCRATCH
     };
   private:
-    static int size_t_width;
+    static __thread int size_t_width;
     
   };  
 
   template<bool xcompile>  
-  int TypeBuilder<PoclContext, xcompile>::size_t_width = 0;
+  __thread int TypeBuilder<PoclContext, xcompile>::size_t_width = 0;
 
 }  // namespace llvm
   
@@ -185,6 +192,7 @@ Workgroup::runOnModule(Module &M)
 
     createWorkgroup(M, L);
     createWorkgroupFast(M, L);
+    createWorkgroupRange(M, L);
   }
 
   Function *barrier = cast<Function> 
@@ -303,6 +311,35 @@ createLauncher(Module &M, Function *F)
     }
   }
 
+  /* Used only by the work-group functions generated for a dynamic local
+     size. The others store the constant local size at the kernel entry. */
+  ptr = builder.CreateStructGEP(ai,
+				TypeBuilder<PoclContext, true>::LOCAL_SIZE);
+  for (int i = 0; i < 3; ++i) {
+    snprintf(s, STRING_LENGTH, "_local_size_%c", 'x' + i);
+    gv = M.getGlobalVariable(s);
+    if (gv != NULL) {
+      if (size_t_width == 64)
+        {
+          v = builder.CreateLoad(builder.CreateConstGEP2_64(ptr, 0, i));
+        }
+      else
+        {
+          v = builder.CreateLoad(builder.CreateConstGEP2_32(ptr, 0, i));
+        }
+      builder.CreateStore(v, gv);
+    }
+  }
+
+  /* Used only by the kernels with their context arrays in the scratch
+     buffer. */
+  gv = M.getGlobalVariable("_context_scratch");
+  if (gv != NULL) {
+    ptr = builder.CreateStructGEP
+      (ai, TypeBuilder<PoclContext, true>::CONTEXT_SCRATCH);
+    builder.CreateStore(builder.CreateLoad(ptr), gv);
+  }
+
   CallInst *c = builder.CreateCall(F, ArrayRef<Value*>(arguments));
   builder.CreateRetVoid();
 
@@ -422,6 +459,19 @@ privatizeContext(Module &M, Function *F)
     }
   }
   
+  // Privatize _context_scratch
+  gv[0] = M.getGlobalVariable("_context_scratch");
+  if (gv[0] != NULL) {
+    ai[0] = builder.CreateAlloca(gv[0]->getType()->getElementType(),
+                                 0, "_context_scratch");
+    for (Function::iterator i = F->begin(), e = F->end(); i != e; ++i) {
+      for (BasicBlock::iterator ii = i->begin(), ee = i->end();
+           ii != ee; ++ii) {
+        ii->replaceUsesOfWith(gv[0], ai[0]);
+      }
+    }
+  }
+
   // Privatize _global_offset
   for (int i = 0; i < 3; ++i) {
     snprintf(s, STRING_LENGTH, "_global_offset_%c", 'x' + i);
@@ -445,37 +495,21 @@ privatizeContext(Module &M, Function *F)
 }
 
 /**
- * Creates a work group launcher function (called KERNELNAME_workgroup)
- * that assumes kernel pointer arguments are stored as pointers to the
- * actual buffers and that scalar data is loaded from the default memory.
+ * Loads the arguments of the launcher F from the argument array args
+ * where pointer arguments are stored as pointers to the actual buffers
+ * and scalar data in the default memory. The value loaded for the
+ * context argument is to be replaced by the caller.
  */
 static void
-createWorkgroup(Module &M, Function *F)
+loadArguments(Module &M, Function *F, IRBuilder<> &builder, Value *args,
+              SmallVectorImpl<Value*> &arguments)
 {
-  IRBuilder<> builder(M.getContext());
-
-  FunctionType *ft =
-    TypeBuilder<void(types::i<8>*[],
-		     PoclContext*), true>::get(M.getContext());
-
-  std::string funcName = "";
-  funcName = F->getName().str();
-
-  Function *workgroup =
-    dyn_cast<Function>(M.getOrInsertFunction(funcName + "_workgroup", ft));
-  assert(workgroup != NULL);
-
-  builder.SetInsertPoint(BasicBlock::Create(M.getContext(), "", workgroup));
-
-  Function::arg_iterator ai = workgroup->arg_begin();
-
-  SmallVector<Value*, 8> arguments;
   int i = 0;
   for (Function::const_arg_iterator ii = F->arg_begin(), ee = F->arg_end();
        ii != ee; ++ii) {
     Type *t = ii->getType();
 
-    Value *gep = builder.CreateGEP(ai,
+    Value *gep = builder.CreateGEP(args,
             ConstantInt::get(IntegerType::get(M.getContext(), 32), i));
     Value *pointer = builder.CreateLoad(gep);
 
@@ -500,6 +534,35 @@ createWorkgroup(Module &M, Function *F)
     arguments.push_back(value);
     ++i;
   }
+}
+
+/**
+ * Creates a work group launcher function (called KERNELNAME_workgroup)
+ * that assumes kernel pointer arguments are stored as pointers to the
+ * actual buffers and that scalar data is loaded from the default memory.
+ */
+static void
+createWorkgroup(Module &M, Function *F)
+{
+  IRBuilder<> builder(M.getContext());
+
+  FunctionType *ft =
+    TypeBuilder<void(types::i<8>*[],
+		     PoclContext*), true>::get(M.getContext());
+
+  std::string funcName = "";
+  funcName = F->getName().str();
+
+  Function *workgroup =
+    dyn_cast<Function>(M.getOrInsertFunction(funcName + "_workgroup", ft));
+  assert(workgroup != NULL);
+
+  builder.SetInsertPoint(BasicBlock::Create(M.getContext(), "", workgroup));
+
+  Function::arg_iterator ai = workgroup->arg_begin();
+
+  SmallVector<Value*, 8> arguments;
+  loadArguments(M, F, builder, ai, arguments);
 
   arguments.back() = ++ai;
   
@@ -587,6 +650,114 @@ createWorkgroupFast(Module &M, Function *F)
 }
 
 
+/**
+ * Creates a launcher executing a range of work groups (called
+ * KERNELNAME_workgroup_range) with the arguments passed like to
+ * KERNELNAME_workgroup.
+ *
+ * The groups from first to last, inclusive, are numbered linearly with
+ * x changing the fastest. The launcher of a single group is inlined to
+ * the loop over the range and given a private copy of the context, so
+ * the arguments and the uniform context fields are loaded only once and
+ * the group ids stay in registers.
+ */
+static void
+createWorkgroupRange(Module &M, Function *F)
+{
+  LLVMContext &C = M.getContext();
+  IRBuilder<> builder(C);
+
+  int size_t_width = 32;
+  if (M.getPointerSize() == llvm::Module::Pointer64)
+    size_t_width = 64;
+  IntegerType *size_t_type = IntegerType::get(C, size_t_width);
+
+  SmallVector<Type *, 4> sv;
+  sv.push_back(TypeBuilder<types::i<8>**, true>::get(C));
+  sv.push_back(TypeBuilder<PoclContext*, true>::get(C));
+  sv.push_back(size_t_type);
+  sv.push_back(size_t_type);
+  FunctionType *ft = FunctionType::get(Type::getVoidTy(C),
+                                       ArrayRef<Type *>(sv), false);
+
+  std::string funcName = "";
+  funcName = F->getName().str();
+  Function *workgroup =
+    dyn_cast<Function>(M.getOrInsertFunction(funcName + "_workgroup_range",
+                                             ft));
+  assert(workgroup != NULL);
+
+  BasicBlock *entry = BasicBlock::Create(C, "", workgroup);
+  BasicBlock *loop = BasicBlock::Create(C, "group.loop", workgroup);
+  BasicBlock *exit = BasicBlock::Create(C, "group.exit", workgroup);
+
+  Function::arg_iterator ai = workgroup->arg_begin();
+  Value *args = ai++;
+  Value *pc = ai++;
+  Value *first = ai++;
+  Value *last = ai;
+
+  builder.SetInsertPoint(entry);
+
+  SmallVector<Value*, 8> arguments;
+  loadArguments(M, F, builder, args, arguments);
+
+  /* The context of the caller is shared by the threads, the group ids
+     are written to a copy that does not escape. */
+  Value *ctx = builder.CreateAlloca
+    (TypeBuilder<PoclContext, true>::get(C), 0, "ctx");
+  builder.CreateStore(builder.CreateLoad(pc), ctx);
+  arguments.back() = ctx;
+
+  Value *ptr = builder.CreateStructGEP
+    (ctx, TypeBuilder<PoclContext, true>::NUM_GROUPS);
+  Value *numGroupsX = builder.CreateLoad(builder.CreateConstGEP2_32(ptr, 0, 0));
+  Value *numGroupsY = builder.CreateLoad(builder.CreateConstGEP2_32(ptr, 0, 1));
+  Value *groupId = builder.CreateStructGEP
+    (ctx, TypeBuilder<PoclContext, true>::GROUP_ID);
+  builder.CreateBr(loop);
+
+  builder.SetInsertPoint(loop);
+  PHINode *g = builder.CreatePHI(size_t_type, 2, "group");
+  g->addIncoming(first, entry);
+
+  Value *yz = builder.CreateUDiv(g, numGroupsX);
+  builder.CreateStore(builder.CreateURem(g, numGroupsX),
+                      builder.CreateConstGEP2_32(groupId, 0, 0));
+  builder.CreateStore(builder.CreateURem(yz, numGroupsY),
+                      builder.CreateConstGEP2_32(groupId, 0, 1));
+  builder.CreateStore(builder.CreateUDiv(yz, numGroupsY),
+                      builder.CreateConstGEP2_32(groupId, 0, 2));
+
+  CallInst *c = builder.CreateCall(F, ArrayRef<Value*>(arguments));
+
+  Value *next = builder.CreateAdd(g, ConstantInt::get(size_t_type, 1));
+  g->addIncoming(next, loop);
+  builder.CreateCondBr(builder.CreateICmpEQ(g, last), exit, loop);
+
+  builder.SetInsertPoint(exit);
+  builder.CreateRetVoid();
+
+  InlineFunctionInfo IFI;
+  InlineFunction(c, IFI);
+}
+
+
+/**
+ * Returns the name of the kernel to process in this compilation, an
+ * empty string to process all of them.
+ */
+std::string
+Workgroup::kernelNameToProcess(const Module &M)
+{
+  std::string kernelName;
+  int localSize[3], dynamicLocalSize, contextScratch, vectorWidth;
+  if (getKernelCompilerOptions(M, kernelName, localSize, dynamicLocalSize,
+                               contextScratch, vectorWidth))
+    return kernelName;
+  return KernelName;
+}
+
 /**
  * Returns true in case the given function is a kernel that
  * should be processed by the kernel compiler.
@@ -598,9 +769,10 @@ Workgroup::isKernelToProcess(const Function &F)
 
   NamedMDNode *kernels = m->getNamedMetadata("opencl.kernels");
   if (kernels == NULL) {
-    if (KernelName == "")
+    std::string kernelName = kernelNameToProcess(*m);
+    if (kernelName == "")
       return true;
-    if (F.getName() == KernelName)
+    if (F.getName() == kernelName)
       return true;
 
     return false;
@@ -30,6 +30,7 @@
 #include "llvm/IR/Module.h"
 #endif
 #include "llvm/Pass.h"
+#include <string>
 
 namespace pocl {
   class Workgroup : public llvm::ModulePass {  
@@ -41,6 +42,7 @@ namespace pocl {
     virtual bool runOnModule(llvm::Module &M);
 
     static bool isKernelToProcess(const llvm::Function &F);
+    static std::string kernelNameToProcess(const llvm::Module &M);
 
   };
 }
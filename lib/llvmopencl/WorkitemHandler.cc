@@ -42,6 +42,7 @@
 #include "llvm/Support/CommandLine.h"
 #include "WorkitemHandler.h"
 #include "Kernel.h"
+#include "LLVMUtils.h"
 
 //#define DEBUG_REFERENCE_FIXING
 
@@ -54,6 +55,23 @@ LocalSize("local-size",
           llvm::cl::desc("Local size (x y z)"),
           llvm::cl::multi_val(3));
 
+/* A non-zero value generates a work-group function for any local size
+   of at most the given number of work-items. The local size is then
+   read from the context at run time instead of -local-size. */
+llvm::cl::opt<int>
+DynamicLocalSize("dynamic-local-size", llvm::cl::init(0), llvm::cl::Hidden,
+                 llvm::cl::desc("Read the local size at run time, up to N work-items"));
+
+/* Keeps the stack usage of the work-group functions bounded with large
+   local sizes. */
+llvm::cl::opt<int>
+ContextScratch("context-scratch", llvm::cl::init(0), llvm::cl::Hidden,
+               llvm::cl::desc("Place the context arrays to the scratch buffer of the context if they take at least N bytes"));
+
+llvm::cl::opt<int>
+VectorWidth("wiloops-vector-width", llvm::cl::init(0), llvm::cl::Hidden,
+            llvm::cl::desc("The vectorization width of the work-item loops, 0 for automatic"));
+
 cl::opt<bool>
 AddWIMetadata("add-wi-metadata", cl::init(false), cl::Hidden,
   cl::desc("Adds a work item identifier to each of the instruction in work items."));
@@ -74,9 +92,25 @@ WorkitemHandler::Initialize(Kernel *K)
 {
   llvm::Module *M = K->getParent();
   
-  LocalSizeX = LocalSize[0];
-  LocalSizeY = LocalSize[1];
-  LocalSizeZ = LocalSize[2];
+  std::string kernelName;
+  int localSize[3];
+  if (getKernelCompilerOptions(*M, kernelName, localSize, MaxWorkItems,
+                               ContextScratchThreshold, LoopVectorWidth))
+    {
+      LocalSizeX = localSize[0];
+      LocalSizeY = localSize[1];
+      LocalSizeZ = localSize[2];
+    }
+  else
+    {
+      LocalSizeX = LocalSize[0];
+      LocalSizeY = LocalSize[1];
+      LocalSizeZ = LocalSize[2];
+      MaxWorkItems = DynamicLocalSize;
+      ContextScratchThreshold = ContextScratch;
+      LoopVectorWidth = VectorWidth;
+    }
+  DynamicSize = MaxWorkItems > 0;
   
   llvm::NamedMDNode *size_info = M->getNamedMetadata("opencl.kernel_wg_size_info");
   if (size_info) {
@@ -86,6 +120,8 @@ WorkitemHandler::Initialize(Kernel *K)
         LocalSizeX = (llvm::cast<ConstantInt>(KernelSizeInfo->getOperand(1)))->getLimitedValue();
         LocalSizeY = (llvm::cast<ConstantInt>(KernelSizeInfo->getOperand(2)))->getLimitedValue();
         LocalSizeZ = (llvm::cast<ConstantInt>(KernelSizeInfo->getOperand(3)))->getLimitedValue();
+        /* The required size is always known at compile time. */
+        DynamicSize = false;
       }
     }
   }
@@ -60,6 +60,21 @@ namespace pocl {
 
     int LocalSizeX, LocalSizeY, LocalSizeZ;
 
+    /* True if the local size is read from the context at run time. The
+       work-group then has at most MaxWorkItems work-items and LocalSizeX,
+       LocalSizeY and LocalSizeZ are meaningless. */
+    bool DynamicSize;
+    int MaxWorkItems;
+
+    /* The context arrays taking at least this many bytes in total are
+       placed in the scratch buffer passed in the context instead of the
+       stack. Zero keeps them always in the stack. */
+    int ContextScratchThreshold;
+
+    /* The vectorization width to suggest for the work-item loops, zero
+       to choose it by the target and the data types. */
+    int LoopVectorWidth;
+
     unsigned size_t_width;
 
     /* The global variables that store the current local id. */
@@ -68,6 +83,9 @@ namespace pocl {
   };
 
   extern llvm::cl::opt<bool> AddWIMetadata;
+  extern llvm::cl::opt<int> DynamicLocalSize;
+  extern llvm::cl::opt<int> ContextScratch;
+  extern llvm::cl::opt<int> VectorWidth;
   extern llvm::cl::opt<int> LockStepSIMDWidth;
 }
 
@@ -66,12 +66,9 @@ WorkitemHandlerChooser::runOnFunction(Function &F)
 
   Kernel *K = cast<Kernel> (&F);
 
-  /* FIXME: this is not thread safe. We cannot compile multiple kernels at
-     the same time with the same instances of these passes as they store
-     to private attributes and use global values to pass in the dimensions.
-     In the LLVMAPI version this logic should be at higher-level when
-     constructing the passes for the kernel, or done fully inside a single
-     FunctionPass that delegates to other passes. */    
+  /* The passes store to private attributes, thus the parallel kernel
+     compilations must use their own instances of them. The dimensions
+     come with the Module. */
   Initialize(K);
 
   std::string method = "auto";
@@ -89,7 +86,13 @@ WorkitemHandlerChooser::runOnFunction(Function &F)
         }
     }
 
-  if (method == "auto") 
+  /* Only the loops can iterate over a local size unknown at compile
+     time. */
+  if (DynamicSize)
+    {
+      chosenHandler_ = POCL_WIH_LOOPS;
+    }
+  else if (method == "auto") 
     {
       int ReplThreshold = 2;
       if (getenv("POCL_FULL_REPLICATION_THRESHOLD") != NULL) 
@@ -27,10 +27,12 @@
 #include "Workgroup.h"
 #include "Barrier.h"
 #include "Kernel.h"
+#include "LLVMUtils.h"
 #include "config.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
 #ifdef LLVM_3_1
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/TypeBuilder.h"
@@ -54,10 +56,14 @@
 #include "llvm/IR/ValueSymbolTable.h"
 #endif
 #include "llvm/Analysis/PostDominators.h"
+#ifndef LLVM_3_2
+#include "llvm/Analysis/TargetTransformInfo.h"
+#endif
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 #include "WorkitemHandlerChooser.h"
 
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -73,9 +79,21 @@
 
 #define CONTEXT_ARRAY_ALIGN 64
 
+/* The maximum number of instructions to recompute a value in another
+   parallel region instead of context saving it. */
+#define MAX_REMATERIALIZED_INSTRUCTIONS 16
+
+/* The widest vectorization suggested for the work-item loops. */
+#define MAX_VECTOR_WIDTH 16
+
 using namespace llvm;
 using namespace pocl;
 
+STATISTIC(RematerializedValues,
+          "Number of values rematerialized instead of context saved");
+STATISTIC(ContextBytesSaved,
+          "Context array bytes saved by rematerialization");
+
 namespace {
   static
   RegisterPass<WorkitemLoops> X("workitemloops", 
@@ -95,6 +113,9 @@ WorkitemLoops::getAnalysisUsage(AnalysisUsage &AU) const
 #else
   AU.addRequired<DataLayout>();
 #endif
+#ifndef LLVM_3_2
+  AU.addRequired<TargetTransformInfo>();
+#endif
 
   AU.addRequired<VariableUniformityAnalysis>();
   AU.addPreserved<VariableUniformityAnalysis>();
@@ -119,6 +140,8 @@ WorkitemLoops::runOnFunction(Function &F)
   PDT = &getAnalysis<PostDominatorTree>();
 
   tempInstructionIndex = 0;
+  rematerializedValues = 0;
+  contextBytesSaved = 0;
 
 #if 0
   std::cerr << "### original:" << std::endl;
@@ -149,6 +172,13 @@ WorkitemLoops::runOnFunction(Function &F)
   contextArrays.clear();
   tempInstructionIds.clear();
 
+  DEBUG(dbgs() << F.getName() << ": rematerialized " << rematerializedValues
+        << " values, saved " << contextBytesSaved 
+        << " bytes of context arrays\n");
+  // The statistics above are compiled out of the release builds.
+  setContextSavings(*F.getParent(), F.getName().str(), rematerializedValues,
+                    contextBytesSaved);
+
   return changed;
 }
 
@@ -156,8 +186,8 @@ std::pair<llvm::BasicBlock *, llvm::BasicBlock *>
 WorkitemLoops::CreateLoopAround
 (ParallelRegion &region,
  llvm::BasicBlock *entryBB, llvm::BasicBlock *exitBB, 
- bool peeledFirst, llvm::Value *localIdVar, size_t LocalSizeForDim,
- bool addIncBlock) 
+ bool peeledFirst, llvm::Value *localIdVar, llvm::Value *localSizeVar,
+ bool addIncBlock, unsigned vectorWidth) 
 {
   assert (localIdVar != NULL);
 
@@ -196,7 +226,8 @@ WorkitemLoops::CreateLoopAround
 
     for.cond:
 
-    ; loop header, compare the id to the local size
+    ; loop header, compare the id to the local size (a load of
+    ; _local_size_x in case of a dynamic local size)
     %0 = load i32* %_local_id_x, align 4
     %cmp = icmp ult i32 %0, i32 123
     br i1 %cmp, label %for.body, label %for.end
@@ -277,12 +308,13 @@ WorkitemLoops::CreateLoopAround
     }
 
   builder.SetInsertPoint(forCondBB);
+  /* The bound is a variable in case the local size is known only at
+     run time. */
+  llvm::Value *localSize = localSizeVar;
+  if (!isa<ConstantInt>(localSizeVar))
+    localSize = builder.CreateLoad(localSizeVar);
   llvm::Value *cmpResult = 
-    builder.CreateICmpULT
-    (builder.CreateLoad(localIdVar),
-     (ConstantInt::get
-      (IntegerType::get(C, size_t_width), 
-       LocalSizeForDim)));
+    builder.CreateICmpULT(builder.CreateLoad(localIdVar), localSize);
       
   Instruction *loopBranch =
       builder.CreateCondBr(cmpResult, loopBodyEntryBB, loopEndBB);
@@ -294,7 +326,19 @@ WorkitemLoops::CreateLoopAround
   /* This creation of the identifier metadata is copied from
      LLVM's MDBuilder::createAnonymousTBAARoot(). */
   MDNode *Dummy = MDNode::getTemporary(C, ArrayRef<Value*>());
-  MDNode *Root = MDNode::get(C, Dummy);
+  SmallVector<Value*, 2> rootOperands;
+  rootOperands.push_back(Dummy);
+#if !(defined LLVM_3_2 || defined LLVM_3_3)
+  /* The loop vectorizer reads its hints from the loop identifier. */
+  if (vectorWidth > 0)
+    {
+      Value *hint[] = 
+        { MDString::get(C, "llvm.vectorizer.width"),
+          ConstantInt::get(Type::getInt32Ty(C), vectorWidth) };
+      rootOperands.push_back(MDNode::get(C, hint));
+    }
+#endif
+  MDNode *Root = MDNode::get(C, rootOperands);
   // At this point we have
   //   !0 = metadata !{}            <- dummy
   //   !1 = metadata !{metadata !0} <- root
@@ -338,7 +382,24 @@ WorkitemLoops::ProcessFunction(Function &F)
   Initialize(K);
   unsigned workItemCount = LocalSizeX*LocalSizeY*LocalSizeZ;
 
-  if (workItemCount == 1)
+  llvm::Type *sizeType = IntegerType::get(F.getContext(), size_t_width);
+  if (DynamicSize)
+    {
+      /* The launcher stores the local size of the launch from the
+         context to these. */
+      llvm::Module *M = F.getParent();
+      localSizeX = M->getOrInsertGlobal("_local_size_x", sizeType);
+      localSizeY = M->getOrInsertGlobal("_local_size_y", sizeType);
+      localSizeZ = M->getOrInsertGlobal("_local_size_z", sizeType);
+    }
+  else
+    {
+      localSizeX = ConstantInt::get(sizeType, LocalSizeX);
+      localSizeY = ConstantInt::get(sizeType, LocalSizeY);
+      localSizeZ = ConstantInt::get(sizeType, LocalSizeZ);
+    }
+
+  if (!DynamicSize && workItemCount == 1)
     {
       K->addLocalSizeInitCode(LocalSizeX, LocalSizeY, LocalSizeZ);
       ParallelRegion::insertLocalIdInit(&F.getEntryBlock(), 0, 0, 0);
@@ -465,7 +526,9 @@ WorkitemLoops::ProcessFunction(Function &F)
           }
 
         int unrollCount;
-        if (getenv("POCL_WILOOPS_MAX_UNROLL_COUNT") != NULL)
+        if (DynamicSize)
+            unrollCount = 1;
+        else if (getenv("POCL_WILOOPS_MAX_UNROLL_COUNT") != NULL)
             unrollCount = atoi(getenv("POCL_WILOOPS_MAX_UNROLL_COUNT"));
         else
             unrollCount = 1;
@@ -507,14 +570,15 @@ WorkitemLoops::ProcessFunction(Function &F)
         }
       }
 
-    if (LocalSizeX > 1)
-      l = CreateLoopAround(*original, l.first, l.second, peelFirst, localIdX, LocalSizeX, !unrolled);
+    if (DynamicSize || LocalSizeX > 1)
+      l = CreateLoopAround(*original, l.first, l.second, peelFirst, localIdX, localSizeX, !unrolled,
+                           VectorWidthHint(*original));
 
-    if (LocalSizeY > 1)
-      l = CreateLoopAround(*original, l.first, l.second, false, localIdY, LocalSizeY);
+    if (DynamicSize || LocalSizeY > 1)
+      l = CreateLoopAround(*original, l.first, l.second, false, localIdY, localSizeY);
 
-    if (LocalSizeZ > 1)
-      l = CreateLoopAround(*original, l.first, l.second, false, localIdZ, LocalSizeZ);
+    if (DynamicSize || LocalSizeZ > 1)
+      l = CreateLoopAround(*original, l.first, l.second, false, localIdZ, localSizeZ);
 
     /* Loop edges coming from another region mean B-loops which means 
        we have to fix the loop edge to jump to the beginning of the wi-loop 
@@ -551,9 +615,12 @@ WorkitemLoops::ProcessFunction(Function &F)
        localIdXFirstVar);       
   }
 
-  K->addLocalSizeInitCode(LocalSizeX, LocalSizeY, LocalSizeZ);
+  if (!DynamicSize)
+    K->addLocalSizeInitCode(LocalSizeX, LocalSizeY, LocalSizeZ);
   ParallelRegion::insertLocalIdInit(&F.getEntryBlock(), 0, 0, 0);
 
+  MoveContextArraysToScratch(F);
+
 #if 0
   F.viewCFG();
 #endif
@@ -660,17 +727,12 @@ WorkitemLoops::AddContextSave
 
   IRBuilder<> builder(definition); 
   std::vector<llvm::Value *> gepArgs;
-  gepArgs.push_back(ConstantInt::get(IntegerType::get(instruction->getContext(), size_t_width), 0));
 
-  /* Reuse the id loads earlier in the region, if possible, to
-     avoid messy output with lots of redundant loads. */
   ParallelRegion *region = RegionOfBlock(instruction->getParent());
   assert ("Adding context save outside any region produces illegal code." && 
           region != NULL);
 
-  gepArgs.push_back(region->LocalIDZLoad());
-  gepArgs.push_back(region->LocalIDYLoad());
-  gepArgs.push_back(region->LocalIDXLoad());
+  AddContextArrayIndices(region, definition, gepArgs);
 
   return builder.CreateStore(instruction, builder.CreateGEP(alloca, gepArgs));
 }
@@ -699,18 +761,12 @@ WorkitemLoops::AddContextRestore
 
   
   std::vector<llvm::Value *> gepArgs;
-  gepArgs.push_back(ConstantInt::get(IntegerType::get(val->getContext(), size_t_width), 0));
 
-  /* Reuse the id loads earlier in the region, if possible, to
-     avoid messy output with lots of redundant loads. */
   ParallelRegion *region = RegionOfBlock(before->getParent());
   assert ("Adding context save outside any region produces illegal code." && 
           region != NULL);
 
-  gepArgs.push_back(region->LocalIDZLoad());
-  gepArgs.push_back(region->LocalIDYLoad());
-  gepArgs.push_back(region->LocalIDXLoad());
-
+  AddContextArrayIndices(region, before, gepArgs);
 
   llvm::Instruction *gep = 
     dyn_cast<Instruction>(builder.CreateGEP(alloca, gepArgs));
@@ -723,6 +779,43 @@ WorkitemLoops::AddContextRestore
   return builder.CreateLoad(gep);
 }
 
+/**
+ * Appends the GEP indices of the context array element of the current
+ * work-item to gepArgs. The index computation is inserted before the
+ * given instruction.
+ */
+void
+WorkitemLoops::AddContextArrayIndices
+(ParallelRegion *region, llvm::Instruction *before,
+ std::vector<llvm::Value *> &gepArgs)
+{
+  gepArgs.push_back
+    (ConstantInt::get(IntegerType::get(before->getContext(), size_t_width), 0));
+
+  /* Reuse the id loads earlier in the region, if possible, to
+     avoid messy output with lots of redundant loads. */
+  if (!DynamicSize)
+    {
+      gepArgs.push_back(region->LocalIDZLoad());
+      gepArgs.push_back(region->LocalIDYLoad());
+      gepArgs.push_back(region->LocalIDXLoad());
+      return;
+    }
+
+  /* The context arrays are flat in case of a dynamic local size:
+     index = (z * local_size_y + y) * local_size_x + x */
+  IRBuilder<> builder(before);
+  llvm::Value *index = 
+    builder.CreateAdd
+    (builder.CreateMul(region->LocalIDZLoad(), builder.CreateLoad(localSizeY)),
+     region->LocalIDYLoad());
+  index = 
+    builder.CreateAdd
+    (builder.CreateMul(index, builder.CreateLoad(localSizeX)),
+     region->LocalIDXLoad());
+  gepArgs.push_back(index);
+}
+
 /**
  * Returns the context array (alloca) for the given Value, creates it if not
  * found.
@@ -779,13 +872,18 @@ WorkitemLoops::GetContextArray(llvm::Instruction *instruction)
       elementType = instruction->getType();
     }
 
-  /* 3D context array. */
-  llvm::Type *contextArrayType = 
-    ArrayType::get(
-        ArrayType::get(
-            ArrayType::get(
-                elementType, LocalSizeX), 
-            LocalSizeY), LocalSizeZ);
+  /* 3D context array, or a flat one large enough for the largest
+     work-group in case of a dynamic local size. */
+  llvm::Type *contextArrayType;
+  if (DynamicSize)
+    contextArrayType = ArrayType::get(elementType, MaxWorkItems);
+  else
+    contextArrayType = 
+      ArrayType::get(
+          ArrayType::get(
+              ArrayType::get(
+                  elementType, LocalSizeX), 
+              LocalSizeY), LocalSizeZ);
 
   /* Allocate the context data array for the variable. */
   llvm::AllocaInst *alloca = 
@@ -800,6 +898,70 @@ WorkitemLoops::GetContextArray(llvm::Instruction *instruction)
   return alloca;
 }
 
+/**
+ * Replaces the context arrays of the function with slices of the
+ * scratch buffer passed in the context, in case they take at least
+ * ContextScratchThreshold bytes in total. The stack usage of the
+ * work-group function then does not grow with the local size.
+ *
+ * The size of the buffer the work-group function needs is stored to
+ * the constant _KERNELNAME_context_scratch_size for the device to
+ * allocate it. The buffer is reused by the work groups executed by the
+ * same thread.
+ */
+void
+WorkitemLoops::MoveContextArraysToScratch(llvm::Function &F)
+{
+  if (ContextScratchThreshold <= 0 || contextArrays.empty())
+    return;
+
+#ifdef LLVM_3_1
+  TargetData &TD = getAnalysis<TargetData>();
+#else
+  DataLayout &TD = getAnalysis<DataLayout>();
+#endif
+
+  uint64_t size = 0;
+  for (StrInstructionMap::iterator i = contextArrays.begin(), 
+         e = contextArrays.end(); i != e; ++i)
+    {
+      AllocaInst *alloca = cast<AllocaInst>(i->second);
+      size = (size + CONTEXT_ARRAY_ALIGN - 1) & ~(CONTEXT_ARRAY_ALIGN - 1);
+      size += TD.getTypeAllocSize(alloca->getAllocatedType());
+    }
+  if (size < (uint64_t)ContextScratchThreshold)
+    return;
+
+  llvm::Module *M = F.getParent();
+  llvm::LLVMContext &C = F.getContext();
+  /* Stored from the context by the launcher like the ids. */
+  llvm::Value *scratchVar = 
+    M->getOrInsertGlobal("_context_scratch", Type::getInt8PtrTy(C));
+
+  IRBuilder<> builder(F.getEntryBlock().getFirstInsertionPt());
+  llvm::Value *scratch = builder.CreateLoad(scratchVar, "context_scratch");
+
+  uint64_t offset = 0;
+  for (StrInstructionMap::iterator i = contextArrays.begin(), 
+         e = contextArrays.end(); i != e; ++i)
+    {
+      AllocaInst *alloca = cast<AllocaInst>(i->second);
+      offset = (offset + CONTEXT_ARRAY_ALIGN - 1) & ~(CONTEXT_ARRAY_ALIGN - 1);
+      llvm::Value *slice = 
+        builder.CreateBitCast
+        (builder.CreateConstGEP1_64(scratch, offset), alloca->getType());
+      offset += TD.getTypeAllocSize(alloca->getAllocatedType());
+      slice->takeName(alloca);
+      alloca->replaceAllUsesWith(slice);
+      alloca->eraseFromParent();
+    }
+  contextArrays.clear();
+
+  llvm::Type *sizeType = IntegerType::get(C, size_t_width);
+  new GlobalVariable(*M, sizeType, true, GlobalValue::ExternalLinkage,
+                     ConstantInt::get(sizeType, size),
+                     "_" + F.getName().str() + "_context_scratch_size");
+}
 
 /**
  * Adds context save/restore code for the value produced by the
@@ -812,17 +974,42 @@ WorkitemLoops::GetContextArray(llvm::Instruction *instruction)
  * TODO: ignore work group variables completely (the iteration variables)
  * The LLVM should optimize these away but it would improve
  * the readability of the output during debugging.
- * TODO: rematerialize some values such as extended values of global 
- * variables (especially global id which is computed from local id) or kernel 
- * argument values instead of allocating stack space for them
+ *
+ * Values cheap to compute from the local id and the values uniform
+ * across the work-items, such as the global id, are rematerialized
+ * before their uses in the other regions instead.
  */
 void
 WorkitemLoops::AddContextSaveRestore
 (llvm::Instruction *instruction) {
 
-  /* Allocate the context data array for the variable. */
-  llvm::Instruction *alloca = GetContextArray(instruction);
-  llvm::Instruction *theStore = AddContextSave(instruction, alloca);
+  llvm::Instruction *alloca = NULL;
+  llvm::Instruction *theStore = NULL;
+  ParallelRegion *definingRegion = RegionOfBlock(instruction->getParent());
+
+  InstructionVec chain;
+  bool rematerialize = CanBeRematerialized(instruction, chain);
+  if (rematerialize)
+    {
+#ifdef LLVM_3_1
+      TargetData &TD = getAnalysis<TargetData>();
+#else
+      DataLayout &TD = getAnalysis<DataLayout>();
+#endif
+      uint64_t workItems = DynamicSize ? MaxWorkItems :
+        LocalSizeX * LocalSizeY * LocalSizeZ;
+      uint64_t bytes = TD.getTypeAllocSize(instruction->getType()) * workItems;
+      ++rematerializedValues;
+      ++RematerializedValues;
+      contextBytesSaved += bytes;
+      ContextBytesSaved += bytes;
+    }
+  else
+    {
+      /* Allocate the context data array for the variable. */
+      alloca = GetContextArray(instruction);
+      theStore = AddContextSave(instruction, alloca);
+    }
 
   InstructionVec uses;
   /* Restore the produced variable before each use to ensure the correct context
@@ -859,6 +1046,10 @@ WorkitemLoops::AddContextSaveRestore
          not dependent on the work item. Most likely an iteration
          variable of a for loop with a barrier. */
       if (RegionOfBlock(user->getParent()) == NULL) continue;
+      /* The rematerialized values are defined only once per work-item
+         in the defining region, its uses see the original value. */
+      if (rematerialize && RegionOfBlock(user->getParent()) == definingRegion)
+        continue;
 
       PHINode* phi = dyn_cast<PHINode>(user);
       if (phi != NULL)
@@ -896,9 +1087,14 @@ WorkitemLoops::AddContextSaveRestore
           assert (incomingBB != NULL);
           contextRestoreLocation = incomingBB->getTerminator();
         }
-      llvm::Value *loadedValue = 
-        AddContextRestore
-        (user, alloca, contextRestoreLocation, isa<AllocaInst>(instruction));
+      llvm::Value *loadedValue;
+      if (rematerialize)
+        loadedValue = 
+          AddRematerialization(instruction, chain, contextRestoreLocation);
+      else
+        loadedValue = 
+          AddContextRestore
+          (user, alloca, contextRestoreLocation, isa<AllocaInst>(instruction));
       user->replaceUsesOfWith(instruction, loadedValue);
 #ifdef DEBUG_WORK_ITEM_LOOPS
       std::cerr << "### done, the user was converted to:" << std::endl;
@@ -919,11 +1115,7 @@ WorkitemLoops::ShouldNotBeContextSaved(llvm::Instruction *instr)
     */
   if (isa<BranchInst>(instr)) return true;
 
-    llvm::LoadInst *load = dyn_cast<llvm::LoadInst>(instr);
-    if (load != NULL &&
-        (load->getPointerOperand() == localIdZ ||
-         load->getPointerOperand() == localIdY ||
-         load->getPointerOperand() == localIdX))
+    if (IsLocalIdLoad(instr))
       return true;
 
     VariableUniformityAnalysis &VUA = 
@@ -954,6 +1146,161 @@ WorkitemLoops::ShouldNotBeContextSaved(llvm::Instruction *instr)
     return false;
 }
 
+/**
+ * Returns the vectorization width to suggest for the work-item loop of
+ * the region.
+ *
+ * Unless set by the kernel compiler options, it is the number of the
+ * widest scalars loaded or stored in the region that fit in a vector
+ * register of the target. Zero leaves the choice to the vectorizer.
+ */
+unsigned
+WorkitemLoops::VectorWidthHint(ParallelRegion &region)
+{
+  if (LoopVectorWidth > 0)
+    return LoopVectorWidth;
+
+#ifdef LLVM_3_2
+  return 0;
+#else
+  unsigned registerBits = 
+    getAnalysis<TargetTransformInfo>().getRegisterBitWidth(true);
+  if (registerBits == 0)
+    return 0;
+
+  DataLayout &TD = getAnalysis<DataLayout>();
+  uint64_t widest = 0;
+  for (ParallelRegion::iterator i = region.begin();
+       i != region.end(); ++i)
+    {
+      for (llvm::BasicBlock::iterator instr = (*i)->begin();
+           instr != (*i)->end(); ++instr) 
+        {
+          llvm::Type *t;
+          if (LoadInst *load = dyn_cast<LoadInst>(instr))
+            t = load->getType();
+          else if (StoreInst *store = dyn_cast<StoreInst>(instr))
+            t = store->getValueOperand()->getType();
+          else
+            continue;
+          if (t->isVectorTy())
+            t = t->getVectorElementType();
+          if (!t->isSized())
+            continue;
+          widest = std::max(widest, TD.getTypeSizeInBits(t));
+        }
+    }
+  if (widest == 0)
+    return 0;
+
+  unsigned width = registerBits / widest;
+  if (width > MAX_VECTOR_WIDTH)
+    width = MAX_VECTOR_WIDTH;
+  /* The vectorizer does not use a width over the trip count. */
+  while (!DynamicSize && width > (unsigned)LocalSizeX)
+    width /= 2;
+  return width > 1 ? width : 0;
+#endif
+}
+
+bool
+WorkitemLoops::IsLocalIdLoad(llvm::Instruction *instr)
+{
+  llvm::LoadInst *load = dyn_cast<llvm::LoadInst>(instr);
+  return load != NULL &&
+    (load->getPointerOperand() == localIdZ ||
+     load->getPointerOperand() == localIdY ||
+     load->getPointerOperand() == localIdX);
+}
+
+/**
+ * Returns true if the value produced by the instruction can be
+ * recomputed in another parallel region with a few cheap instructions
+ * from the local id and the values uniform across the work-items.
+ *
+ * The instructions to clone for the recomputation are appended to
+ * chain, the operands before their users.
+ */
+bool
+WorkitemLoops::CanBeRematerialized
+(llvm::Instruction *instr, InstructionVec &chain)
+{
+  if (std::find(chain.begin(), chain.end(), instr) != chain.end())
+    return true;
+
+  /* The local id is reloaded from the id variable of the work-item
+     loop. Other loads might see memory written in between. */
+  if (isa<LoadInst>(instr))
+    {
+      if (!IsLocalIdLoad(instr))
+        return false;
+    }
+  else if (isa<BinaryOperator>(instr))
+    {
+      switch (instr->getOpcode())
+        {
+        case Instruction::UDiv:
+        case Instruction::SDiv:
+        case Instruction::FDiv:
+        case Instruction::URem:
+        case Instruction::SRem:
+        case Instruction::FRem:
+          return false;
+        default:
+          break;
+        }
+    }
+  else if (!isa<CastInst>(instr) && !isa<GetElementPtrInst>(instr) &&
+           !isa<CmpInst>(instr) && !isa<SelectInst>(instr))
+    {
+      return false;
+    }
+
+  VariableUniformityAnalysis &VUA = 
+    getAnalysis<VariableUniformityAnalysis>();
+
+  for (unsigned i = 0; i < instr->getNumOperands(); ++i)
+    {
+      llvm::Instruction *op = dyn_cast<Instruction>(instr->getOperand(i));
+      /* Constants, kernel arguments and the values not context saved
+         because they are the same for all the work-items can be used
+         as is. */
+      if (op == NULL) continue;
+      if (!IsLocalIdLoad(op) &&
+          !VUA.shouldBePrivatized(op->getParent()->getParent(), op))
+        continue;
+      if (!CanBeRematerialized(op, chain))
+        return false;
+    }
+
+  chain.push_back(instr);
+  return chain.size() <= MAX_REMATERIALIZED_INSTRUCTIONS;
+}
+
+/**
+ * Clones the chain of instructions computing the value produced by
+ * the instruction before the given instruction and returns the copy
+ * of the value.
+ */
+llvm::Value *
+WorkitemLoops::AddRematerialization
+(llvm::Instruction *instr, const InstructionVec &chain, 
+ llvm::Instruction *before)
+{
+  ValueToValueMapTy vmap;
+  for (InstructionVec::const_iterator i = chain.begin(); i != chain.end(); 
+       ++i)
+    {
+      llvm::Instruction *copy = (*i)->clone();
+      if ((*i)->hasName())
+        copy->setName((*i)->getName() + ".remat");
+      copy->insertBefore(before);
+      RemapInstruction(copy, vmap, RF_IgnoreMissingEntries);
+      vmap[*i] = copy;
+    }
+  return vmap[instr];
+}
+
 llvm::BasicBlock *
 WorkitemLoops::AppendIncBlock
 (llvm::BasicBlock* after, llvm::Value *localIdVar)
@@ -75,12 +75,18 @@ namespace pocl {
          llvm::Instruction *before=NULL, 
          bool isAlloca=false);
     llvm::Instruction *GetContextArray(llvm::Instruction *val);
+    void MoveContextArraysToScratch(llvm::Function &F);
+    void AddContextArrayIndices
+        (ParallelRegion *region, llvm::Instruction *before,
+         std::vector<llvm::Value *> &gepArgs);
 
     std::pair<llvm::BasicBlock *, llvm::BasicBlock *>
     CreateLoopAround
         (ParallelRegion &region, llvm::BasicBlock *entryBB, llvm::BasicBlock *exitBB, 
-         bool peeledFirst, llvm::Value *localIdVar, size_t LocalSizeForDim,
-         bool addIncBlock=true);
+         bool peeledFirst, llvm::Value *localIdVar, llvm::Value *localSizeVar,
+         bool addIncBlock=true, unsigned vectorWidth=0);
+
+    unsigned VectorWidthHint(ParallelRegion &region);
 
     llvm::BasicBlock *
       AppendIncBlock
@@ -91,12 +97,27 @@ namespace pocl {
 
     bool ShouldNotBeContextSaved(llvm::Instruction *instr);
 
+    bool IsLocalIdLoad(llvm::Instruction *instr);
+    bool CanBeRematerialized
+        (llvm::Instruction *instr, InstructionVec &chain);
+    llvm::Value *AddRematerialization
+        (llvm::Instruction *instr, const InstructionVec &chain,
+         llvm::Instruction *before);
+
     std::map<llvm::Instruction*, unsigned> tempInstructionIds;
     size_t tempInstructionIndex;
     // An alloca in the kernel which stores the first iteration to execute
     // in the inner (dimension 0) loop. This is set to 1 in an peeled iteration
     // to skip the 0, 0, 0 iteration in the loops.
     llvm::Value *localIdXFirstVar;
+    // The work-item loop bounds: constants, or the _local_size globals
+    // to load the bounds from in case of a dynamic local size.
+    llvm::Value *localSizeX, *localSizeY, *localSizeZ;
+
+    // The values of the kernel recomputed in the regions using them
+    // instead of context saving, and the context array bytes it saved.
+    unsigned rematerializedValues;
+    uint64_t contextBytesSaved;
   };
 }
 
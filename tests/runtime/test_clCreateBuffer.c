@@ -0,0 +1,151 @@
+/* Tests creating and releasing buffers of several sizes in an
+   interleaved order, so the freed space of the small and the large
+   buffers of the device allocator is reused by the later buffers.
+
+   Copyright (c) 2014 pocl developers
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#define MAX_PLATFORMS 32
+#define MAX_DEVICES   32
+#define ROUNDS        4
+
+/* Small buffers of different size classes, and large ones. */
+static const size_t sizes[] = { 128, 384, 4096, 32768, 100000, 1024 * 1024 };
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+#define MAX_SIZE  (1024 * 1024)
+
+static void
+fill(unsigned char *data, size_t size, unsigned seed)
+{
+  size_t k;
+  for (k = 0; k < size; k++)
+    data[k] = (unsigned char)(k * 13 + seed);
+}
+
+/* Writes the pattern of the seed to the buffer and reads it back.
+   Returns non-zero on failure. */
+static int
+check_buffer(cl_command_queue queue, cl_mem buf, size_t size, unsigned seed,
+             unsigned char *data, unsigned char *result)
+{
+  fill(data, size, seed);
+  memset(result, 0, size);
+  if (clEnqueueWriteBuffer(queue, buf, CL_FALSE, 0, size, data,
+                           0, NULL, NULL) != CL_SUCCESS)
+    return 1;
+  if (clEnqueueReadBuffer(queue, buf, CL_TRUE, 0, size, result,
+                          0, NULL, NULL) != CL_SUCCESS)
+    return 1;
+  if (memcmp(data, result, size) != 0)
+    {
+      printf("FAIL: buffer of %u bytes read back wrong\n", (unsigned)size);
+      return 1;
+    }
+  return 0;
+}
+
+int
+main(void)
+{
+  cl_int err;
+  cl_platform_id platforms[MAX_PLATFORMS];
+  cl_uint nplatforms;
+  cl_device_id devices[MAX_DEVICES];
+  cl_uint ndevices;
+  cl_uint i, j;
+  unsigned round, k;
+  cl_mem bufs[2 * NUM_SIZES];
+  unsigned char *data = malloc(MAX_SIZE);
+  unsigned char *result = malloc(MAX_SIZE);
+
+  if (data == NULL || result == NULL)
+    return EXIT_FAILURE;
+
+  err = clGetPlatformIDs(MAX_PLATFORMS, platforms, &nplatforms);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  for (i = 0; i < nplatforms; i++)
+    {
+      err = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, MAX_DEVICES,
+                           devices, &ndevices);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+
+      for (j = 0; j < ndevices; j++)
+        {
+          cl_context context = clCreateContext(NULL, 1, &devices[j], NULL, NULL, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+          cl_command_queue queue = clCreateCommandQueue(context, devices[j], 0, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+
+          memset(bufs, 0, sizeof(bufs));
+          for (round = 0; round < ROUNDS; round++)
+            {
+              /* Two buffers of each size, the other one of them freed
+                 at every round to leave holes for the next round. */
+              for (k = 0; k < 2 * NUM_SIZES; k++)
+                {
+                  size_t size = sizes[k % NUM_SIZES];
+                  if (bufs[k] != NULL)
+                    continue;
+                  bufs[k] = clCreateBuffer(context, CL_MEM_READ_WRITE, size,
+                                           NULL, &err);
+                  if (err != CL_SUCCESS)
+                    return EXIT_FAILURE;
+                }
+
+              for (k = 0; k < 2 * NUM_SIZES; k++)
+                {
+                  if (check_buffer(queue, bufs[k], sizes[k % NUM_SIZES],
+                                   round * 2 * NUM_SIZES + k, data, result))
+                    return EXIT_FAILURE;
+                }
+
+              for (k = 0; k < NUM_SIZES; k++)
+                {
+                  unsigned other = (round % 2) * NUM_SIZES + k;
+                  clReleaseMemObject(bufs[other]);
+                  bufs[other] = NULL;
+                }
+            }
+
+          clFinish(queue);
+          for (k = 0; k < 2 * NUM_SIZES; k++)
+            {
+              if (bufs[k] != NULL)
+                clReleaseMemObject(bufs[k]);
+            }
+          clReleaseCommandQueue(queue);
+          clReleaseContext(context);
+        }
+    }
+  free(data);
+  free(result);
+  return EXIT_SUCCESS;
+}
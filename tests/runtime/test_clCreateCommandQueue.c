@@ -0,0 +1,190 @@
+/* Tests out-of-order command queues: the commands accessing the same
+   buffers and images must be executed in the order they were enqueued
+   even without explicit event wait lists.
+
+   Copyright (c) 2014 pocl developers
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <CL/cl.h>
+
+#define MAX_PLATFORMS 32
+#define MAX_DEVICES   32
+#define BUF_SIZE      4096
+#define ROUNDS        16
+#define IMG_WIDTH     64
+#define IMG_HEIGHT    32
+
+static const char *image_source =
+  "kernel void fill_image(write_only image2d_t img, uint round)\n"
+  "{\n"
+  "  int2 coord = (int2)(get_global_id(0), get_global_id(1));\n"
+  "  write_imageui(img, coord, (uint4)(coord.x, coord.y, round, 1));\n"
+  "}\n";
+
+/* kernel writes the image -> read image chain without events. Returns
+   zero on success. */
+static int
+test_image_kernel(cl_context context, cl_device_id device,
+                  cl_command_queue queue)
+{
+  cl_int err;
+  cl_bool image_support;
+  cl_image_format format = { CL_RGBA, CL_UNSIGNED_INT32 };
+  size_t global_size[2] = { IMG_WIDTH, IMG_HEIGHT };
+  size_t origin[3] = { 0, 0, 0 };
+  size_t region[3] = { IMG_WIDTH, IMG_HEIGHT, 1 };
+  static cl_uint pixels[IMG_HEIGHT][IMG_WIDTH][4];
+  cl_uint x, y, r;
+
+  err = clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT,
+                        sizeof(image_support), &image_support, NULL);
+  if (err != CL_SUCCESS)
+    return 1;
+  if (!image_support)
+    return 0;
+
+  cl_program program =
+    clCreateProgramWithSource(context, 1, &image_source, NULL, &err);
+  if (err != CL_SUCCESS)
+    return 1;
+  if (clBuildProgram(program, 1, &device, NULL, NULL, NULL) != CL_SUCCESS)
+    return 1;
+  cl_kernel kernel = clCreateKernel(program, "fill_image", &err);
+  if (err != CL_SUCCESS)
+    return 1;
+  cl_mem image = clCreateImage2D(context, CL_MEM_READ_WRITE, &format,
+                                 IMG_WIDTH, IMG_HEIGHT, 0, NULL, &err);
+  if (err != CL_SUCCESS)
+    return 1;
+  if (clSetKernelArg(kernel, 0, sizeof(cl_mem), &image) != CL_SUCCESS)
+    return 1;
+
+  for (r = 0; r < ROUNDS; r++)
+    {
+      if (clSetKernelArg(kernel, 1, sizeof(cl_uint), &r) != CL_SUCCESS)
+        return 1;
+      if (clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global_size, NULL,
+                                 0, NULL, NULL) != CL_SUCCESS)
+        return 1;
+      if (clEnqueueReadImage(queue, image, CL_TRUE, origin, region, 0, 0,
+                             pixels, 0, NULL, NULL) != CL_SUCCESS)
+        return 1;
+
+      for (y = 0; y < IMG_HEIGHT; y++)
+        for (x = 0; x < IMG_WIDTH; x++)
+          if (pixels[y][x][0] != x || pixels[y][x][1] != y ||
+              pixels[y][x][2] != r)
+            {
+              printf("FAIL: round %u pixel (%u, %u): %u %u %u\n", r, x, y,
+                     pixels[y][x][0], pixels[y][x][1], pixels[y][x][2]);
+              return 1;
+            }
+    }
+
+  clFinish(queue);
+  clReleaseMemObject(image);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  return 0;
+}
+
+int
+main(void)
+{
+  cl_int err;
+  cl_platform_id platforms[MAX_PLATFORMS];
+  cl_uint nplatforms;
+  cl_device_id devices[MAX_DEVICES];
+  cl_uint ndevices;
+  cl_uint i, j, k, r;
+  static cl_int src[BUF_SIZE], dst[BUF_SIZE];
+
+  err = clGetPlatformIDs(MAX_PLATFORMS, platforms, &nplatforms);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  for (i = 0; i < nplatforms; i++)
+    {
+      err = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, MAX_DEVICES,
+                           devices, &ndevices);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+
+      for (j = 0; j < ndevices; j++)
+        {
+          cl_context context = clCreateContext(NULL, 1, &devices[j], NULL, NULL, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+          cl_command_queue queue =
+            clCreateCommandQueue(context, devices[j],
+                                 CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+          if (err != CL_SUCCESS)
+            {
+              printf("FAIL: could not create an out-of-order queue\n");
+              return EXIT_FAILURE;
+            }
+
+          cl_mem a = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(src), NULL, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+          cl_mem b = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(src), NULL, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+
+          for (r = 0; r < ROUNDS; r++)
+            {
+              for (k = 0; k < BUF_SIZE; k++)
+                src[k] = k + r;
+
+              /* write -> copy -> read chain without events. The blocking
+                 read must see the data of this round. */
+              if (clEnqueueWriteBuffer(queue, a, CL_FALSE, 0, sizeof(src), src,
+                                       0, NULL, NULL) != CL_SUCCESS)
+                return EXIT_FAILURE;
+              if (clEnqueueCopyBuffer(queue, a, b, 0, 0, sizeof(src),
+                                      0, NULL, NULL) != CL_SUCCESS)
+                return EXIT_FAILURE;
+              if (clEnqueueReadBuffer(queue, b, CL_TRUE, 0, sizeof(dst), dst,
+                                      0, NULL, NULL) != CL_SUCCESS)
+                return EXIT_FAILURE;
+
+              for (k = 0; k < BUF_SIZE; k++)
+                if (dst[k] != k + r)
+                  {
+                    printf("FAIL: round %u element %u: %d\n", r, k, dst[k]);
+                    return EXIT_FAILURE;
+                  }
+            }
+
+          if (test_image_kernel(context, devices[j], queue))
+            return EXIT_FAILURE;
+
+          clFinish(queue);
+          clReleaseMemObject(a);
+          clReleaseMemObject(b);
+          clReleaseCommandQueue(queue);
+          clReleaseContext(context);
+        }
+    }
+  return EXIT_SUCCESS;
+}
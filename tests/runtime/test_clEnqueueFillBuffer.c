@@ -0,0 +1,145 @@
+/* Tests clEnqueueFillBuffer with the pattern sizes of the OpenCL types,
+   and clEnqueueMigrateMemObjects keeping the contents of the buffers
+   unless they are declared undefined.
+
+   Copyright (c) 2014 pocl developers
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CL/cl.h>
+
+#define MAX_PLATFORMS 32
+#define MAX_DEVICES   32
+/* Large enough for the fill to be split over the threads. */
+#define BUF_SIZE      (8 * 1024 * 1024 + 256)
+
+int
+main(void)
+{
+  cl_int err;
+  cl_platform_id platforms[MAX_PLATFORMS];
+  cl_uint nplatforms;
+  cl_device_id devices[MAX_DEVICES];
+  cl_uint ndevices;
+  cl_uint i, j;
+  size_t k, pattern_size;
+  unsigned char pattern[128];
+  unsigned char *data = malloc(BUF_SIZE);
+
+  if (data == NULL)
+    return EXIT_FAILURE;
+  for (k = 0; k < sizeof(pattern); k++)
+    pattern[k] = k * 7 + 1;
+
+  err = clGetPlatformIDs(MAX_PLATFORMS, platforms, &nplatforms);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  for (i = 0; i < nplatforms; i++)
+    {
+      err = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, MAX_DEVICES,
+                           devices, &ndevices);
+      if (err != CL_SUCCESS)
+        return EXIT_FAILURE;
+
+      for (j = 0; j < ndevices; j++)
+        {
+          cl_context context = clCreateContext(NULL, 1, &devices[j], NULL, NULL, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+          cl_command_queue queue = clCreateCommandQueue(context, devices[j], 0, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+          cl_mem buf = clCreateBuffer(context, CL_MEM_READ_WRITE, BUF_SIZE, NULL, &err);
+          if (err != CL_SUCCESS)
+            return EXIT_FAILURE;
+
+          if (clEnqueueFillBuffer(queue, buf, pattern, 3, 0, BUF_SIZE,
+                                  0, NULL, NULL) != CL_INVALID_VALUE ||
+              clEnqueueFillBuffer(queue, buf, pattern, 4, 2, 16,
+                                  0, NULL, NULL) != CL_INVALID_VALUE)
+            {
+              printf("FAIL: invalid fill accepted\n");
+              return EXIT_FAILURE;
+            }
+
+          for (pattern_size = 1; pattern_size <= 128; pattern_size *= 2)
+            {
+              /* Leave the first and the last 128 bytes untouched. */
+              size_t offset = 128;
+              size_t size = BUF_SIZE - 256;
+
+              memset(data, 0, BUF_SIZE);
+              if (clEnqueueWriteBuffer(queue, buf, CL_FALSE, 0, BUF_SIZE, data,
+                                       0, NULL, NULL) != CL_SUCCESS)
+                return EXIT_FAILURE;
+              if (clEnqueueFillBuffer(queue, buf, pattern, pattern_size,
+                                      offset, size, 0, NULL, NULL) != CL_SUCCESS)
+                return EXIT_FAILURE;
+              if (clEnqueueReadBuffer(queue, buf, CL_TRUE, 0, BUF_SIZE, data,
+                                      0, NULL, NULL) != CL_SUCCESS)
+                return EXIT_FAILURE;
+
+              for (k = 0; k < BUF_SIZE; k++)
+                {
+                  unsigned char expected = 0;
+                  if (k >= offset && k < offset + size)
+                    expected = pattern[(k - offset) % pattern_size];
+                  if (data[k] != expected)
+                    {
+                      printf("FAIL: pattern size %u byte %u: %u\n",
+                             (unsigned)pattern_size, (unsigned)k, data[k]);
+                      return EXIT_FAILURE;
+                    }
+                }
+            }
+
+          /* Migrating keeps the contents. */
+          if (clEnqueueMigrateMemObjects(queue, 1, &buf, 0,
+                                         0, NULL, NULL) != CL_SUCCESS ||
+              clEnqueueMigrateMemObjects(queue, 1, &buf,
+                                         CL_MIGRATE_MEM_OBJECT_HOST,
+                                         0, NULL, NULL) != CL_SUCCESS)
+            return EXIT_FAILURE;
+          if (clEnqueueReadBuffer(queue, buf, CL_TRUE, 0, BUF_SIZE, data,
+                                  0, NULL, NULL) != CL_SUCCESS)
+            return EXIT_FAILURE;
+          if (data[BUF_SIZE / 2] != pattern[(BUF_SIZE / 2 - 128) % 128])
+            {
+              printf("FAIL: the contents changed in the migration\n");
+              return EXIT_FAILURE;
+            }
+          if (clEnqueueMigrateMemObjects(queue, 1, &buf,
+                                         CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED,
+                                         0, NULL, NULL) != CL_SUCCESS)
+            return EXIT_FAILURE;
+
+          clFinish(queue);
+          clReleaseMemObject(buf);
+          clReleaseCommandQueue(queue);
+          clReleaseContext(context);
+        }
+    }
+  free(data);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+/* Tests clEnqueueNDRangeKernel() with global work offsets: the same
+   kernel is launched over a buffer in tiles at different offsets.
+
+   Copyright (c) 2014 pocl developers
+   
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+   
+   The above copyright notice and this permission notice shall be included in
+   all copies or substantial portions of the Software.
+   
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+   THE SOFTWARE.
+*/
+#include <CL/cl.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TILE_SIZE 64
+#define NUM_TILES 16
+#define BUF_SIZE (TILE_SIZE * NUM_TILES)
+
+/* The unused dimensions of a 1D launch must have zero global ids. */
+char kernelSourceCode[] = 
+"kernel \n"
+"void test_kernel(global int *output) {\n"
+"    size_t i = get_global_id(0);\n"
+"    output[i] = i + 100000 * get_global_id(1) + 100000 * get_global_id(2);\n"
+"}\n";
+
+int main()
+{
+  size_t global_work_size[1] = { TILE_SIZE }, local_work_size[1] = { 16 };
+  size_t global_work_offset[1];
+  cl_int err;
+  cl_platform_id platforms[1];
+  cl_uint nplatforms;
+  cl_device_id devices[1];
+  cl_uint num_devices;
+  cl_program program;
+  cl_kernel kernel;
+  cl_command_queue queue;
+  cl_mem outputBuffer;
+  static cl_int output[BUF_SIZE];
+  int i;
+
+  err = clGetPlatformIDs(1, platforms, &nplatforms);	
+  if (err != CL_SUCCESS && !nplatforms)
+    return EXIT_FAILURE;
+  
+  err = clGetDeviceIDs(platforms[0], CL_DEVICE_TYPE_ALL, 1,
+                       devices, &num_devices);  
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  cl_context context = clCreateContext(NULL, num_devices, devices, NULL, 
+                                       NULL, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  queue = clCreateCommandQueue(context, devices[0], 0, NULL); 
+  if (!queue) 
+    {
+      puts("clCreateCommandQueue call failed\n");
+      return EXIT_FAILURE;
+    }
+
+  outputBuffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof (output),
+                                NULL, &err);
+  if (outputBuffer == NULL)
+    {
+      printf("clCreateBuffer call failed err = %d\n", err);
+      return EXIT_FAILURE;
+    }
+  
+  size_t kernel_size = strlen (kernelSourceCode);
+  char* kernel_buffer = kernelSourceCode;
+  
+  program = clCreateProgramWithSource (context, 1, 
+                                       (const char**)&kernel_buffer, 
+                                       &kernel_size, &err);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  err = clBuildProgram (program, num_devices, devices, NULL, NULL, NULL);
+  if (err != CL_SUCCESS)
+    return EXIT_FAILURE;
+
+  kernel = clCreateKernel (program, "test_kernel", NULL); 
+  if (!kernel) 
+    {
+      puts("clCreateKernel call failed\n");
+      return EXIT_FAILURE;
+    }
+  
+  err = clSetKernelArg (kernel, 0, sizeof (cl_mem), &outputBuffer);
+  if (err)
+    {
+      puts("clSetKernelArg failed\n");
+      return EXIT_FAILURE;
+    }
+
+  for (i = 0; i < NUM_TILES; ++i)
+    {
+      global_work_offset[0] = i * TILE_SIZE;
+      err = clEnqueueNDRangeKernel (queue, kernel, 1, global_work_offset, 
+                                    global_work_size, local_work_size, 
+                                    0, NULL, NULL); 
+      if (err != CL_SUCCESS) 
+        {
+          puts("clEnqueueNDRangeKernel call failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+
+  err = clEnqueueReadBuffer (queue, outputBuffer, CL_TRUE, 0, 
+                             sizeof (output), output, 0, NULL, NULL);
+  if (err != CL_SUCCESS) 
+    {
+      puts("clEnqueueReadBuffer call failed\n");
+      return EXIT_FAILURE;
+    }
+
+  for (i = 0; i < BUF_SIZE; ++i)
+    {
+      if (output[i] != i)
+        {
+          printf("FAIL: output[%d] = %d\n", i, output[i]);
+          return EXIT_FAILURE;
+        }
+    }
+
+  clReleaseMemObject (outputBuffer);
+  clReleaseKernel (kernel);
+  clReleaseProgram (program);
+  clReleaseCommandQueue (queue);
+  clReleaseContext (context);
+  return EXIT_SUCCESS;
+}
@@ -50,8 +50,8 @@ from optparse import OptionParser
 from subprocess import Popen, PIPE
 
 # With POCL we can reuse the old compilation results by
-# leaving the kernel compiler temp directories and rerunning
-# the same OpenCL app. This simulates a compiler cache in pocl.
+# rerunning the same OpenCL app, the second run finds the
+# kernels in the persistent kernel cache (POCL_KERNEL_CACHE).
 # At least NVIDIA OpenCL has a ccache in their implementation.
 POCL_EXCLUDE_COMPILATION_TIME = True
 